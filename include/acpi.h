@@ -0,0 +1,40 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MADT_MAX_CPUS 64
+#define ISA_IRQ_COUNT 16
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) AcpiSdtHeader;
+
+// What the kernel needs from the MADT ("APIC" table)
+typedef struct {
+    uint64_t lapic_address;
+    uint32_t cpu_count;                  // Enabled processors, the BSP included
+    uint8_t cpu_apic_ids[MADT_MAX_CPUS];
+    bool has_ioapic;
+    uint8_t ioapic_id;
+    uint32_t ioapic_address;
+    uint32_t ioapic_gsi_base;
+    uint32_t isa_irq_gsi[ISA_IRQ_COUNT];   // ISA IRQ -> GSI after source overrides
+    uint16_t isa_irq_flags[ISA_IRQ_COUNT]; // MPS polarity/trigger flags
+} MadtInfo;
+
+// rsdp_hint is the RSDP copy from the bootloader, or 0 to search the BIOS areas
+bool acpi_init(uint64_t rsdp_hint);
+const AcpiSdtHeader* acpi_find_table(const char* signature);
+const MadtInfo* acpi_madt();
+
+#endif // ACPI_H
@@ -0,0 +1,34 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LAPIC_REG_ID            0x020
+#define LAPIC_REG_EOI           0x0B0
+#define LAPIC_REG_SPURIOUS      0x0F0
+#define LAPIC_REG_ICR_LOW       0x300
+#define LAPIC_REG_ICR_HIGH      0x310
+#define LAPIC_REG_LVT_TIMER     0x320
+#define LAPIC_REG_TIMER_INITIAL 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+#define LAPIC_LVT_MASKED     (1 << 16)
+
+#define LAPIC_ICR_INIT         0x500
+#define LAPIC_ICR_STARTUP      0x600
+#define LAPIC_ICR_PENDING      (1 << 12)
+#define LAPIC_ICR_LEVEL_ASSERT (1 << 14)
+
+bool lapic_available();
+void lapic_init();
+bool lapic_enabled();
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+void lapic_eoi();
+uint32_t lapic_id();
+void lapic_send_ipi(uint32_t apic_id, uint32_t command);
+
+#endif // APIC_H
@@ -0,0 +1,28 @@
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Boot timeline. The early assembly stamps the TSC into boot_asm_tsc;
+// kernel_main then calls boot_phase as each init phase starts, which also
+// ends the one before, and boot_phases_done once the shell is reached.
+// Stamps stay in TSC cycles until the report, after calibration.
+
+#define BOOT_MAX_PHASES 32
+
+// Written by boot.asm and long_mode_start.asm
+enum {
+    BOOT_TSC_ENTRY,     // First instruction of start
+    BOOT_TSC_PAGING,    // Paging on, before the jump to 64-bit code
+    BOOT_TSC_LONG_MODE, // In long mode, about to call kernel_main
+    BOOT_TSC_COUNT
+};
+
+extern uint64_t boot_asm_tsc[BOOT_TSC_COUNT];
+
+void boot_phase(const char* name);
+void boot_phases_done();
+void boot_timeline(char* buffer, size_t buffer_size);
+
+#endif // BOOTTIME_H
@@ -0,0 +1,28 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+// Where ktime_ns reads the time from, best first
+typedef enum {
+    CLOCK_SOURCE_TICKS, // Until clock_init, or with neither of the others
+    CLOCK_SOURCE_HPET,
+    CLOCK_SOURCE_TSC,   // Only when invariant, so it counts at a fixed rate
+} ClockSource;
+
+void clock_init();
+uint64_t ktime_ns();
+ClockSource clock_source();
+uint64_t clock_tsc_hz();
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+uint64_t clock_tsc_ns(uint64_t tsc);
+uint64_t clock_tsc_mult();
+uint64_t clock_boot_realtime_ns();
+void udelay(uint32_t us);
+void clock_info(char* buffer, size_t buffer_size);
+
+#endif // CLOCK_H
@@ -0,0 +1,15 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Worst-case output size of lz_compress for an input of n bytes
+#define LZ_COMPRESS_BOUND(n) ((n) + ((n) / 255) + 16)
+
+// LZ4 block format codec. Both return the number of bytes written to dst,
+// or -1 if dst is too small or the compressed input is malformed.
+int lz_compress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity);
+int lz_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity);
+
+#endif // COMPRESS_H
@@ -0,0 +1,103 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+#define RFLAGS_IF (1 << 9)
+
+// Read the time-stamp counter
+static inline uint64_t rdtsc()
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx,
+                         uint32_t* ecx, uint32_t* edx)
+{
+    __asm__ volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint64_t read_cr0()
+{
+    uint64_t value;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint64_t value)
+{
+    __asm__ volatile("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr4()
+{
+    uint64_t value;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint64_t value)
+{
+    __asm__ volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+// Set an extended control register; XCR0 selects the XSAVE state components
+static inline void xsetbv(uint32_t index, uint64_t value)
+{
+    __asm__ volatile("xsetbv" : : "c"(index), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void interrupts_enable()
+{
+    __asm__ volatile("sti" ::: "memory");
+}
+
+static inline void interrupts_disable()
+{
+    __asm__ volatile("cli" ::: "memory");
+}
+
+// Disable interrupts, returning the previous RFLAGS for irq_restore
+static inline uint64_t irq_save()
+{
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags)
+{
+    if (flags & RFLAGS_IF) {
+        interrupts_enable();
+    }
+}
+
+static inline void cpu_halt()
+{
+    __asm__ volatile("hlt");
+}
+
+// Enable interrupts and halt. sti takes effect after the next instruction,
+// so an interrupt arriving in between still wakes the hlt.
+static inline void cpu_safe_halt()
+{
+    __asm__ volatile("sti; hlt" ::: "memory");
+}
+
+#endif // CPU_H
@@ -0,0 +1,79 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "memory.h"
+
+// Static x86_64 executables in the ramfs. Loading only reads the headers;
+// each PT_LOAD segment becomes a region of the new address space that is
+// filled from the file a page at a time as the program first touches it.
+
+// Segments must lie in [ELF_LOAD_BASE, ELF_LOAD_TOP), below the ring, vDSO
+// and stack areas
+#define ELF_LOAD_BASE USER_BASE
+#define ELF_LOAD_TOP (USER_BASE + 0x20000000ULL)
+#define ELF_MAX_SEGMENTS 8
+
+#define ELF_MAGIC 0x464C457F // "\x7FELF", read little-endian
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_X86_64 62
+#define PT_LOAD 1
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+typedef struct {
+    uint32_t magic;
+    uint8_t elf_class;
+    uint8_t data;
+    uint8_t version;
+    uint8_t pad[9];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t elf_version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) Elf64Header;
+
+typedef struct {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+} __attribute__((packed)) Elf64Phdr;
+
+// Error codes from elf_parse and elf_load
+#define ELF_ENOENT  -1 // No such file
+#define ELF_EFORMAT -2 // Not a static x86_64 executable
+#define ELF_ELAYOUT -3 // Segments overlap, leave the load area or miss the file
+#define ELF_ENOMEM  -4
+
+typedef struct {
+    uint64_t entry;
+    uint32_t generation;  // The file's, when the headers were read
+    int segment_count;
+    Elf64Phdr segments[ELF_MAX_SEGMENTS]; // PT_LOAD only, sorted by address
+} ElfInfo;
+
+int elf_parse(const char* path, ElfInfo* info);
+const char* elf_strerror(int error);
+
+struct VmSpace;
+int elf_load(const char* path, struct VmSpace** vm, uint64_t* entry);
+
+#endif // ELF_H
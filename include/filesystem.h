@@ -9,22 +9,55 @@
 #define MAX_FILES 64
 #define MAX_FILE_SIZE 4096
 
+// Files untouched for this many fs operations are candidates for compression
+#define FS_COLD_AGE 32
+#define FS_HOT_CACHE_SLOTS 4
+
 typedef struct {
     char name[MAX_FILENAME_LENGTH];
     uint32_t size;
     uint8_t* data;
+    uint32_t stored_size;   // Bytes held in data while compressed
+    uint32_t last_access;   // fs_clock value at the last read or write
+    bool compressed;
+    bool compress_enabled;
+    bool incompressible;    // Last attempt did not save space; cleared on write
+    uint32_t generation;    // Changes whenever the contents do, never reused
 } File;
 
+typedef struct {
+    uint32_t size;
+    uint32_t generation;
+    bool compressed;
+} FsStat;
+
+typedef struct {
+    uint32_t compressed_files;
+    uint64_t logical_bytes;     // Uncompressed size of the compressed files
+    uint64_t stored_bytes;      // Heap bytes those files actually occupy
+    uint64_t decompressions;
+    uint64_t decompress_cycles_total;
+    uint64_t decompress_cycles_max;
+    uint64_t cache_hits;
+} FsCompressionStats;
+
 void fs_init();
 int fs_create(const char* filename);
 int fs_write(const char* filename, const void* data, size_t size);
 int fs_read(const char* filename, void* buffer, size_t size);
+int fs_pread(const char* filename, void* buffer, size_t size, size_t offset);
+int fs_pwrite(const char* filename, const void* data, size_t size, size_t offset);
 int fs_delete(const char* filename);
+int fs_stat(const char* filename, FsStat* stat);
 void fs_list(char* buffer, size_t buffer_size);
 File* fs_open(const char* filename);
 void fs_close(File* file);
 int fs_seek(File* file, int offset, int origin);
 int fs_tell(File* file);
 int fs_mkdir(const char* dirname);
+int fs_set_compression(const char* filename, bool enabled);
+int fs_compress_cold(int max_files);
+int fs_compress_if_cold(const char* filename);
+void fs_get_compression_stats(FsCompressionStats* stats);
 
 #endif // FILESYSTEM_H
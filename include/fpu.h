@@ -0,0 +1,19 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stddef.h>
+#include "task.h"
+
+#define FPU_VECTOR 7 // #NM, raised by the first FPU/SSE/AVX use while CR0.TS is set
+
+// Tasks start without extended state. CR0.TS is set on every switch to a
+// task whose registers are not already loaded, and the #NM trap on its
+// first FPU instruction allocates or restores its save area. A task's
+// registers are saved on the way out only if it touched them.
+void fpu_init();
+void fpu_init_cpu();
+void fpu_switch(Task* prev, Task* next);
+void fpu_task_free(Task* task);
+void fpu_info(char* buffer, size_t buffer_size);
+
+#endif // FPU_H
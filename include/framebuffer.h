@@ -0,0 +1,11 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdbool.h>
+
+#define FONT_WIDTH 8
+#define FONT_HEIGHT 16
+
+bool framebuffer_init();
+
+#endif // FRAMEBUFFER_H
@@ -0,0 +1,33 @@
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include <stdint.h>
+
+#define IDT_ENTRIES 256
+#define IRQ_BASE 32          // PIC IRQs are remapped to vectors 32-47
+#define IRQ_COUNT 16
+#define IRQ_TIMER 0
+#define IRQ_KEYBOARD 1
+#define IRQ_COM1 4
+#define SPURIOUS_VECTOR 0xFF
+#define IST_DOUBLE_FAULT 1   // TSS stack index, so a stack overflow can still report
+
+// Register state pushed by the stubs in interrupt_stubs.asm, lowest address first
+typedef struct {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector, error_code;
+    uint64_t rip, cs, rflags, rsp, ss; // Pushed by the CPU
+} InterruptFrame;
+
+typedef void (*interrupt_handler_t)(InterruptFrame* frame);
+
+void init_interrupts();
+void idt_load();
+void register_interrupt_handler(uint8_t vector, interrupt_handler_t handler);
+void interrupt_dispatch(InterruptFrame* frame);
+
+void pic_mask_irq(uint8_t irq);
+void pic_unmask_irq(uint8_t irq);
+
+#endif // INTERRUPT_H
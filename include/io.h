@@ -15,4 +15,10 @@ static inline void outb(unsigned short port, unsigned char data)
     __asm__ volatile("outb %0, %1" : : "a"(data), "Nd"(port));
 }
 
+// Give slow devices such as the PIC time to settle between writes
+static inline void io_wait()
+{
+    outb(0x80, 0);
+}
+
 #endif
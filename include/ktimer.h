@@ -0,0 +1,56 @@
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "spinlock.h"
+
+#define KTIMER_LEVELS 4
+#define KTIMER_SLOT_BITS 6
+#define KTIMER_SLOTS (1 << KTIMER_SLOT_BITS)
+// Furthest ahead a timer can be placed; later expiries are clamped to it
+#define KTIMER_MAX_DELTA ((1ULL << (KTIMER_LEVELS * KTIMER_SLOT_BITS)) - 1)
+
+// A callback run from the timer softirq once its expiry tick has passed.
+// Periodic timers are queued again before their callback runs.
+typedef struct KTimer {
+    struct KTimer* next;
+    struct KTimer** pprev; // Link pointing at this timer; NULL when not queued
+    uint64_t expires;      // Tick the timer is due on
+    uint64_t period;       // Ticks between runs; 0 for a one-shot timer
+    void (*func)(struct KTimer* timer);
+    void* data;
+} KTimer;
+
+#define KTIMER_INIT(func, data) { NULL, NULL, 0, 0, func, data }
+
+// Level n slots are 64^n ticks wide, so insertion and cancellation are O(1)
+// and a timer is only moved when its slot on the next level up comes due
+typedef struct TimerWheel {
+    spinlock_t lock;
+    uint64_t now;          // Next tick to process
+    uint32_t pending;
+    KTimer* slots[KTIMER_LEVELS][KTIMER_SLOTS];
+} TimerWheel;
+
+// Driven by the BSP's timer tick
+extern TimerWheel timer_wheel;
+
+void ktimer_wheel_init(TimerWheel* wheel, uint64_t now);
+void ktimer_init(KTimer* timer, void (*func)(KTimer* timer), void* data);
+void ktimer_add_to(TimerWheel* wheel, KTimer* timer, uint64_t expires);
+bool ktimer_cancel_from(TimerWheel* wheel, KTimer* timer);
+void ktimer_run_wheel(TimerWheel* wheel, uint64_t now);
+bool ktimer_wheel_next(TimerWheel* wheel, uint64_t* tick);
+
+void ktimer_add(KTimer* timer, uint64_t delay_ticks);
+void ktimer_add_periodic(KTimer* timer, uint64_t period_ticks);
+bool ktimer_cancel(KTimer* timer);
+void ktimer_run(uint64_t now);
+bool ktimer_next_expiry(uint64_t* tick);
+
+static inline bool ktimer_pending(const KTimer* timer) {
+    return __atomic_load_n(&timer->pprev, __ATOMIC_RELAXED) != NULL;
+}
+
+#endif // KTIMER_H
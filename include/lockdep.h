@@ -0,0 +1,47 @@
+#ifndef LOCKDEP_H
+#define LOCKDEP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock debugging is compiled in with -DLOCK_DEBUG (make DEBUG_FLAGS=-DLOCK_DEBUG).
+// Every lock then carries a name; locks sharing a name form one class, with
+// acquisition and contention counters, and taking two classes in both
+// orders is reported as a potential deadlock. Without it the hooks below
+// compile to nothing and locks carry no extra fields.
+#ifdef LOCK_DEBUG
+
+#define LOCKDEP_MAX_CLASSES 32
+#define LOCKDEP_MAX_HELD 8 // Per CPU
+
+typedef struct {
+    const char* name;
+    volatile int class;   // Index into the class table plus one; 0 until first use
+} LockDep;
+
+#define LOCKDEP_FIELD LockDep dep;
+#define LOCKDEP_INIT(name) , { name, 0 }
+#define lockdep_set_name(lock, lock_name) ((lock)->dep.name = (lock_name), (lock)->dep.class = 0)
+
+void lockdep_init();
+void lockdep_acquired(LockDep* dep, bool trylock);
+void lockdep_released(LockDep* dep);
+void lockdep_contended(LockDep* dep);
+
+#else
+
+#define LOCKDEP_FIELD
+#define LOCKDEP_INIT(name)
+#define lockdep_set_name(lock, lock_name) ((void)(lock_name))
+#define lockdep_init() ((void)0)
+#define lockdep_acquired(dep, trylock) ((void)0)
+#define lockdep_released(dep) ((void)0)
+#define lockdep_contended(dep) ((void)0)
+
+#endif // LOCK_DEBUG
+
+// Per-class counters for the `locks` command; a note when compiled out
+void lockdep_stats(char* buffer, size_t buffer_size);
+
+#endif // LOCKDEP_H
@@ -0,0 +1,64 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+// Messages more verbose than this compile to nothing. Override with
+// -DLOG_BUILD_LEVEL=LOG_LEVEL_DEBUG to keep the debug traces.
+#ifndef LOG_BUILD_LEVEL
+#define LOG_BUILD_LEVEL LOG_LEVEL_INFO
+#endif
+
+enum log_subsystem {
+    LOG_KERNEL = 0,
+    LOG_MEM,
+    LOG_FS,
+    LOG_TASK,
+    LOG_SHELL,
+    LOG_DRIVER,
+    LOG_SUBSYSTEM_COUNT
+};
+
+#define LOG_RING_SIZE 256 // Records; must be a power of two
+#define LOG_MESSAGE_MAX 120
+
+void klog(int level, int subsystem, const char* format, ...);
+void log_set_level(int level);
+int log_get_level();
+void log_set_subsystem(int subsystem, bool enabled);
+int log_subsystem_by_name(const char* name);
+void log_flush();
+void log_set_notify(void (*notify)(void));
+void log_dump(void (*write)(const char* message));
+
+#if LOG_BUILD_LEVEL >= LOG_LEVEL_ERROR
+#define log_error(subsystem, ...) klog(LOG_LEVEL_ERROR, subsystem, __VA_ARGS__)
+#else
+#define log_error(subsystem, ...) do { } while (0)
+#endif
+
+#if LOG_BUILD_LEVEL >= LOG_LEVEL_WARN
+#define log_warn(subsystem, ...) klog(LOG_LEVEL_WARN, subsystem, __VA_ARGS__)
+#else
+#define log_warn(subsystem, ...) do { } while (0)
+#endif
+
+#if LOG_BUILD_LEVEL >= LOG_LEVEL_INFO
+#define log_info(subsystem, ...) klog(LOG_LEVEL_INFO, subsystem, __VA_ARGS__)
+#else
+#define log_info(subsystem, ...) do { } while (0)
+#endif
+
+#if LOG_BUILD_LEVEL >= LOG_LEVEL_DEBUG
+#define log_debug(subsystem, ...) klog(LOG_LEVEL_DEBUG, subsystem, __VA_ARGS__)
+#else
+#define log_debug(subsystem, ...) do { } while (0)
+#endif
+
+#endif // LOG_H
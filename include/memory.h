@@ -8,6 +8,16 @@
 #define PAGE_SIZE 4096
 #define KERNEL_BASE 0xffffffff80000000
 
+#define PAGE_PRESENT  0x1
+#define PAGE_WRITABLE 0x2
+#define PAGE_USER     0x4
+#define PAGE_SHARED   0x200 // Software bit: not freed with the address space
+
+// User mappings live in PML4 slot 1, which each address space has to
+// itself; every other slot is shared with the kernel's page tables
+#define USER_BASE 0x0000008000000000ULL
+#define USER_TOP  0x0000010000000000ULL
+
 // Physical memory management
 void init_physical_memory(uint64_t mem_size);
 void* allocate_physical_page();
@@ -19,6 +29,13 @@ void map_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags);
 void unmap_page(uint64_t virtual_addr);
 uint64_t get_physical_address(uint64_t virtual_addr);
 
+// Per-task address spaces, named by their CR3 value
+uint64_t kernel_address_space();
+uint64_t address_space_create();
+void address_space_destroy(uint64_t cr3);
+bool map_user_page(uint64_t cr3, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags);
+bool user_access_ok(const void* addr, size_t size, bool write);
+
 // Heap memory management
 void init_heap();
 void* kmalloc(size_t size);
@@ -34,6 +51,8 @@ typedef struct {
     uint64_t free_memory;
     uint64_t used_memory;
     uint64_t reserved_memory;
+    uint64_t heap_allocs;   // kmalloc calls that succeeded since init_heap
+    uint64_t heap_frees;
 } MemoryInfo;
 
 void get_memory_info(MemoryInfo* info);
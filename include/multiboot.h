@@ -0,0 +1,48 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MULTIBOOT_TAG_END       0
+#define MULTIBOOT_TAG_CMDLINE   1
+#define MULTIBOOT_TAG_FRAMEBUFFER 8
+#define MULTIBOOT_TAG_ACPI_OLD  14
+#define MULTIBOOT_TAG_ACPI_NEW  15
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+} __attribute__((packed)) MultibootTag;
+
+#define MULTIBOOT_FRAMEBUFFER_RGB 1
+#define MULTIBOOT_FRAMEBUFFER_TEXT 2
+
+// Followed by colour information; for RGB framebuffers, the position and
+// width of each channel within a pixel
+typedef struct {
+    MultibootTag tag;
+    uint64_t address;
+    uint32_t pitch;         // Bytes per scanline
+    uint32_t width;
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t type;
+    uint16_t reserved;
+    uint8_t red_position;
+    uint8_t red_size;
+    uint8_t green_position;
+    uint8_t green_size;
+    uint8_t blue_position;
+    uint8_t blue_size;
+} __attribute__((packed)) MultibootFramebuffer;
+
+// Takes the physical address of the boot information GRUB left in ebx
+void multiboot_init(uint64_t info_address);
+const MultibootTag* multiboot_find_tag(uint32_t type);
+const char* multiboot_cmdline();
+bool multiboot_cmdline_value(const char* key, char* value, size_t value_size);
+uint64_t multiboot_rsdp();
+
+#endif // MULTIBOOT_H
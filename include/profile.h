@@ -0,0 +1,32 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "interrupt.h"
+
+// Sampling profiler driven by the timer interrupt, so it needs no PMU and
+// works under QEMU TCG. While running, every interval_ms-th tick on each
+// CPU records the interrupted RIP, the current task and a frame-pointer
+// backtrace into that CPU's buffer. profile_dump streams the samples to
+// serial for tools/prof-symbolize.py.
+
+#define PROF_SAMPLES_PER_CPU 2048
+#define PROF_MAX_DEPTH 6
+
+typedef struct {
+    uint64_t rip;
+    int32_t task_id;
+    uint8_t depth;          // Entries used in stack
+    uint8_t user;           // Interrupted in ring 3; no backtrace
+    uint64_t stack[PROF_MAX_DEPTH]; // Return addresses, innermost first
+} ProfSample;
+
+bool profile_start(uint32_t interval_ms);
+void profile_stop();
+void profile_tick(InterruptFrame* frame);
+void profile_dump();
+void profile_status(char* buffer, size_t buffer_size);
+
+#endif // PROFILE_H
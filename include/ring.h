@@ -0,0 +1,43 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Lock-free rings of fixed-size entries. The caller supplies the storage;
+// capacity must be a power of two. Positions run freely and are masked on
+// use, so a full ring is told apart from an empty one without a spare slot.
+
+// One producer and one consumer, e.g. an interrupt handler feeding a task
+typedef struct {
+    uint8_t* buffer;
+    uint32_t entry_size;
+    uint32_t mask;
+    volatile uint32_t head;  // Next position the producer fills
+    volatile uint32_t tail;  // Next position the consumer empties
+} SpscRing;
+
+void spsc_init(SpscRing* ring, void* buffer, uint32_t entry_size, uint32_t capacity);
+bool spsc_push(SpscRing* ring, const void* entry);
+bool spsc_pop(SpscRing* ring, void* entry);
+uint32_t spsc_count(const SpscRing* ring);
+
+// Any number of producers, on any CPU or in interrupt handlers, and one
+// consumer. Producers claim a position with a compare-and-swap and publish
+// it through the slot's sequence number, so a slow producer never lets the
+// consumer read a half-written entry.
+typedef struct {
+    uint8_t* buffer;
+    volatile uint32_t* sequence; // One per slot
+    uint32_t entry_size;
+    uint32_t mask;
+    volatile uint32_t head;      // Next position a producer claims
+    uint32_t tail;               // Consumer only
+} MpscRing;
+
+void mpsc_init(MpscRing* ring, void* buffer, uint32_t* sequence, uint32_t entry_size,
+               uint32_t capacity);
+bool mpsc_push(MpscRing* ring, const void* entry);
+bool mpsc_pop(MpscRing* ring, void* entry);
+
+#endif // RING_H
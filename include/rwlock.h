@@ -0,0 +1,138 @@
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include "spinlock.h"
+
+#define RWLOCK_WRITER  0x80000000u // Held for writing
+#define RWLOCK_WAITING 0x40000000u // A writer is waiting; new readers hold off
+#define RWLOCK_READERS 0x3FFFFFFFu
+
+// Reader-writer spinlock in a single word: a reader count plus writer
+// bits. An uncontended lock or unlock is one atomic operation. Writers
+// announce themselves so a steady stream of readers can't starve them.
+typedef struct {
+    volatile uint32_t state;
+    LOCKDEP_FIELD
+} rwlock_t;
+
+#define RWLOCK_INIT(name) { 0 LOCKDEP_INIT(name) }
+
+static inline void rwlock_init(rwlock_t* lock, const char* name)
+{
+    lock->state = 0;
+    lockdep_set_name(lock, name);
+}
+
+static inline bool read_trylock(rwlock_t* lock)
+{
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    if (state & (RWLOCK_WRITER | RWLOCK_WAITING)) {
+        return false;
+    }
+    if (!__atomic_compare_exchange_n(&lock->state, &state, state + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    lockdep_acquired(&lock->dep, true);
+    return true;
+}
+
+static inline void read_lock(rwlock_t* lock)
+{
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    bool contended = false;
+    while (1) {
+        if (!(state & (RWLOCK_WRITER | RWLOCK_WAITING))) {
+            if (__atomic_compare_exchange_n(&lock->state, &state, state + 1, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue; // Another reader got in first; state was reloaded
+        }
+        if (!contended) {
+            contended = true;
+            lockdep_contended(&lock->dep);
+        }
+        cpu_relax();
+        state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    }
+    lockdep_acquired(&lock->dep, false);
+}
+
+static inline void read_unlock(rwlock_t* lock)
+{
+    lockdep_released(&lock->dep);
+    __atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool write_trylock(rwlock_t* lock)
+{
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    if (state & ~RWLOCK_WAITING) {
+        return false;
+    }
+    if (!__atomic_compare_exchange_n(&lock->state, &state, RWLOCK_WRITER, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    lockdep_acquired(&lock->dep, true);
+    return true;
+}
+
+static inline void write_lock(rwlock_t* lock)
+{
+    uint32_t state = 0;
+    bool contended = false;
+    while (!__atomic_compare_exchange_n(&lock->state, &state, RWLOCK_WRITER, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (!contended) {
+            contended = true;
+            lockdep_contended(&lock->dep);
+        }
+        if (!(state & RWLOCK_WAITING)) {
+            __atomic_fetch_or(&lock->state, RWLOCK_WAITING, __ATOMIC_RELAXED);
+        }
+        cpu_relax();
+        // Taking the lock clears WAITING; a writer still queued behind us
+        // sets it again on its next pass
+        state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if (state & ~RWLOCK_WAITING) {
+            state = RWLOCK_WAITING;
+        }
+    }
+    lockdep_acquired(&lock->dep, false);
+}
+
+static inline void write_unlock(rwlock_t* lock)
+{
+    lockdep_released(&lock->dep);
+    __atomic_fetch_and(&lock->state, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t read_lock_irqsave(rwlock_t* lock)
+{
+    uint64_t flags = lock_irq_save();
+    read_lock(lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(rwlock_t* lock, uint64_t flags)
+{
+    read_unlock(lock);
+    lock_irq_restore(flags);
+}
+
+static inline uint64_t write_lock_irqsave(rwlock_t* lock)
+{
+    uint64_t flags = lock_irq_save();
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t* lock, uint64_t flags)
+{
+    write_unlock(lock);
+    lock_irq_restore(flags);
+}
+
+#endif // RWLOCK_H
@@ -0,0 +1,8 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+// Runs the subsystem unit tests, reporting each result through report.
+// Returns the number of failed checks.
+int run_selftests(void (*report)(const char* message));
+
+#endif // SELFTEST_H
@@ -0,0 +1,58 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include "spinlock.h"
+
+// Sequence lock for small, read-mostly data. Writers serialize on the
+// spinlock and bump the sequence before and after updating, so it is odd
+// while a write is in progress. Readers never write shared memory: they
+// copy the data and retry if the sequence moved.
+//
+//     uint32_t seq;
+//     do {
+//         seq = read_seqbegin(&lock);
+//         copy = data;
+//     } while (read_seqretry(&lock, seq));
+typedef struct {
+    volatile uint32_t sequence;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INIT(name) { 0, SPINLOCK_INIT(name) }
+
+static inline void seqlock_init(seqlock_t* lock, const char* name)
+{
+    lock->sequence = 0;
+    spin_init(&lock->lock, name);
+}
+
+static inline uint32_t read_seqbegin(const seqlock_t* lock)
+{
+    uint32_t sequence;
+    while ((sequence = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_relax();
+    }
+    return sequence;
+}
+
+static inline bool read_seqretry(const seqlock_t* lock, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline uint64_t write_seqlock_irqsave(seqlock_t* lock)
+{
+    uint64_t flags = spin_lock_irqsave(&lock->lock);
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return flags;
+}
+
+static inline void write_sequnlock_irqrestore(seqlock_t* lock, uint64_t flags)
+{
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&lock->lock, flags);
+}
+
+#endif // SEQLOCK_H
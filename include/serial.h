@@ -1,7 +1,14 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
-void serial_init();
+#include <stdint.h>
+
+#define SERIAL_DEFAULT_BAUD 115200 // Override with serial=<baud> on the kernel command line
+
+void serial_init(uint32_t baud);
+void serial_init_irq();
 void serial_write(const char *str);
+void serial_flush();
+void serial_write_polled(const char *str);
 
 #endif
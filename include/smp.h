@@ -0,0 +1,99 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "softirq.h"
+#include "task.h"
+
+#define MAX_CPUS 16
+
+// Per-CPU GDT: flat kernel code/data, user data/code, then the 16-byte TSS
+// descriptor. SYSRET takes the user selectors from fixed offsets, so user
+// data must sit just below user code.
+#define GDT_ENTRIES 7
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_DATA 0x18
+#define GDT_USER_CODE 0x20
+#define GDT_TSS 0x28
+#define USER_DATA_SELECTOR (GDT_USER_DATA | 3)
+#define USER_CODE_SELECTOR (GDT_USER_CODE | 3)
+
+// The AP trampoline is copied here; SIPI vectors name a page below 1MB
+#define AP_TRAMPOLINE_ADDR 0x8000
+
+#define RESCHEDULE_VECTOR 0xF0
+
+typedef struct {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed)) Tss;
+
+typedef struct Cpu {
+    struct Cpu* self;           // Must stay first: this_cpu() reads %gs:0
+    uint64_t kernel_rsp;        // Current task's kernel stack top; %gs:8 in syscall_entry
+    uint64_t user_rsp;          // Scratch for syscall_entry; %gs:16
+    int id;                     // Logical index; 0 is the bootstrap processor
+    uint32_t apic_id;
+    volatile bool online;
+
+    // Scheduler state, only touched by this CPU or under rq.lock
+    Task* current;
+    Task* idle;                 // Runs when the queues are empty, if set
+    Task* prev;                 // Switched away from; finished by schedule_tail
+    RunQueue rq;
+    volatile uint32_t ticks_left;
+    volatile int need_resched;
+    uint32_t balance_ticks;
+    Task idle_task;
+
+    // Scheduler latency, recorded by this CPU under rq.lock
+    uint64_t switch_start;      // TSC at entry to the switch in progress
+    LatencyHist wakeup_latency; // task_wake to running
+    LatencyHist switch_cost;    // __schedule entry to schedule_tail
+
+    // Lazy FPU switching: owner's state may still be live in the registers
+    Task* fpu_owner;
+    uint64_t fpu_saves;
+    uint64_t fpu_restores;
+
+    // Deferred work raised on this CPU, run on interrupt exit or when idle
+    volatile uint32_t softirq_pending;
+    int in_softirq;
+    Tasklet* tasklets;
+    Tasklet* tasklet_tail;
+    uint64_t softirq_counts[SOFTIRQ_COUNT];
+
+    // Tick state, only touched by this CPU
+    volatile bool tick_stopped;  // Idle with a one-shot timer instead of the tick
+    uint64_t idle_wakeups;       // Halts ended by an interrupt
+    uint64_t timer_interrupts;
+
+    uint64_t gdt[GDT_ENTRIES] __attribute__((aligned(16)));
+    Tss tss __attribute__((aligned(16)));
+    uint8_t double_fault_stack[4096] __attribute__((aligned(16)));
+} Cpu;
+
+// Only stable while the caller cannot migrate, i.e. with interrupts off
+static inline Cpu* this_cpu()
+{
+    Cpu* cpu;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+void smp_init_bsp();
+void smp_start_aps();
+int smp_cpu_count();
+Cpu* smp_cpu(int id);
+void smp_send_reschedule(Cpu* cpu);
+void smp_list(char* buffer, size_t buffer_size);
+uint64_t smp_bench(int tasks);
+
+#endif // SMP_H
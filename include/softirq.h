@@ -0,0 +1,39 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Softirqs are per-CPU bottom halves: an interrupt handler raises one and
+// it runs on the same CPU on the way out of the interrupt, with interrupts
+// enabled but before any task switch. Handlers must not block.
+enum softirq_nr {
+    SOFTIRQ_TIMER = 0,  // Runs the timer wheel for the BSP's tick
+    SOFTIRQ_TASKLET,
+    SOFTIRQ_COUNT
+};
+
+typedef void (*softirq_handler_t)(void);
+
+// A tasklet is a one-shot deferred call. Scheduling it again before it has
+// run does nothing, and the same tasklet never runs on two CPUs at once.
+typedef struct Tasklet {
+    struct Tasklet* next;
+    void (*func)(void* data);
+    void* data;
+    volatile uint32_t state;
+} Tasklet;
+
+#define TASKLET_SCHEDULED 1
+#define TASKLET_RUNNING 2
+#define TASKLET_INIT(func, data) { NULL, func, data, 0 }
+
+void softirq_init();
+void open_softirq(int nr, softirq_handler_t handler);
+void raise_softirq(int nr);
+void do_softirq();
+void tasklet_init(Tasklet* tasklet, void (*func)(void* data), void* data);
+void tasklet_schedule(Tasklet* tasklet);
+void softirq_stats(char* buffer, size_t buffer_size);
+
+#endif // SOFTIRQ_H
@@ -0,0 +1,171 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "lockdep.h"
+
+// Ticket lock: lockers take the next ticket with one atomic add and wait
+// for the owner counter to reach it, so the lock is handed out in FIFO
+// order. Only the holder writes owner, so unlocking is a plain store.
+typedef struct {
+    union {
+        volatile uint32_t word;
+        struct {
+            volatile uint16_t owner; // Ticket being served
+            volatile uint16_t next;  // Next ticket to hand out
+        } tickets;
+    };
+    LOCKDEP_FIELD
+} spinlock_t;
+
+#define SPINLOCK_INIT(name) { { 0 } LOCKDEP_INIT(name) }
+
+#define TICKET_NEXT_ONE (1u << 16)
+
+static inline void cpu_relax()
+{
+    __asm__ volatile("pause" ::: "memory");
+}
+
+// Interrupts are masked while any lock is held, so a lock taken in an
+// interrupt handler can't deadlock against the code it interrupted
+static inline uint64_t lock_irq_save()
+{
+#ifdef HOSTED
+    return 0; // An ordinary process has no interrupts to mask
+#else
+    return irq_save();
+#endif
+}
+
+static inline void lock_irq_restore(uint64_t flags)
+{
+#ifdef HOSTED
+    (void)flags;
+#else
+    irq_restore(flags);
+#endif
+}
+
+static inline void spin_init(spinlock_t* lock, const char* name)
+{
+    lock->word = 0;
+    lockdep_set_name(lock, name);
+}
+
+static inline void spin_lock(spinlock_t* lock)
+{
+    uint32_t word = __atomic_fetch_add(&lock->word, TICKET_NEXT_ONE, __ATOMIC_ACQUIRE);
+    uint16_t ticket = word >> 16;
+    if ((uint16_t)word != ticket) {
+        lockdep_contended(&lock->dep);
+        while (__atomic_load_n(&lock->tickets.owner, __ATOMIC_ACQUIRE) != ticket) {
+            cpu_relax();
+        }
+    }
+    lockdep_acquired(&lock->dep, false);
+}
+
+static inline bool spin_trylock(spinlock_t* lock)
+{
+    uint32_t word = __atomic_load_n(&lock->word, __ATOMIC_RELAXED);
+    if ((uint16_t)word != (uint16_t)(word >> 16)) {
+        return false;
+    }
+    if (!__atomic_compare_exchange_n(&lock->word, &word, word + TICKET_NEXT_ONE, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    lockdep_acquired(&lock->dep, true);
+    return true;
+}
+
+static inline void spin_unlock(spinlock_t* lock)
+{
+    lockdep_released(&lock->dep);
+    __atomic_store_n(&lock->tickets.owner, (uint16_t)(lock->tickets.owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline bool spin_is_locked(spinlock_t* lock)
+{
+    uint32_t word = __atomic_load_n(&lock->word, __ATOMIC_RELAXED);
+    return (uint16_t)word != (uint16_t)(word >> 16);
+}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock)
+{
+    uint64_t flags = lock_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags)
+{
+    spin_unlock(lock);
+    lock_irq_restore(flags);
+}
+
+// MCS lock: each waiter spins on a flag in its own queue node, usually on
+// its stack, so a contended lock costs one cache line transfer per handoff
+// rather than every waiter hammering the lock word
+typedef struct McsNode {
+    struct McsNode* volatile next;
+    volatile uint32_t locked;
+} McsNode;
+
+typedef struct {
+    McsNode* volatile tail;
+    LOCKDEP_FIELD
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT(name) { NULL LOCKDEP_INIT(name) }
+
+static inline void mcs_lock(mcs_lock_t* lock, McsNode* node)
+{
+    node->next = NULL;
+    node->locked = 1;
+    McsNode* prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev) {
+        lockdep_contended(&lock->dep);
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+    lockdep_acquired(&lock->dep, false);
+}
+
+static inline void mcs_unlock(mcs_lock_t* lock, McsNode* node)
+{
+    lockdep_released(&lock->dep);
+    McsNode* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        McsNode* expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        // A locker swapped itself in but has not linked behind us yet
+        while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) {
+            cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t mcs_lock_irqsave(mcs_lock_t* lock, McsNode* node)
+{
+    uint64_t flags = lock_irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t* lock, McsNode* node, uint64_t flags)
+{
+    mcs_unlock(lock, node);
+    lock_irq_restore(flags);
+}
+
+#endif // SPINLOCK_H
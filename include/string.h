@@ -3,15 +3,39 @@
 
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 void* memcpy(void* dest, const void* src, size_t n);
 void* memset(void* s, int c, size_t n);
+void* memmove(void* dest, const void* src, size_t n);
+int memcmp(const void* s1, const void* s2, size_t n);
 char* strncpy(char* dest, const char* src, size_t n);
 int strcmp(const char* s1, const char* s2);
 size_t strlen(const char* s);
 char* strchr(const char* s, int c);
 char* strtok(char* str, const char* delim);
 int snprintf(char* str, size_t size, const char* format, ...);
+int vsnprintf(char* str, size_t size, const char* format, va_list args);
 void int_to_string(int value, char* str);
 
+// memcpy and memset dispatch to one of these, chosen by string_init from
+// CPUID; they are exported for the self-tests and benchmarks
+void string_init();
+const char* string_variant();
+bool string_has_erms();
+void* memcpy_bytes(void* dest, const void* src, size_t n);
+void* memset_bytes(void* s, int c, size_t n);
+void* memcpy_words(void* dest, const void* src, size_t n);
+void* memset_words(void* s, int c, size_t n);
+void* memcpy_erms(void* dest, const void* src, size_t n);
+void* memset_erms(void* s, int c, size_t n);
+#ifdef HOSTED
+bool string_has_avx2();
+void* memcpy_sse2(void* dest, const void* src, size_t n);
+void* memset_sse2(void* s, int c, size_t n);
+void* memcpy_avx2(void* dest, const void* src, size_t n);
+void* memset_avx2(void* s, int c, size_t n);
+#endif // HOSTED
+
 #endif // STRING_H
@@ -0,0 +1,51 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// System call numbers, passed in rax. User programs written in assembly
+// hard-code these, so only ever append.
+enum {
+    SYS_NULL = 0,     // Does nothing; for measuring entry and exit
+    SYS_EXIT,         // (status)
+    SYS_YIELD,
+    SYS_SLEEP,        // (ms)
+    SYS_GETPID,
+    SYS_WRITE,        // (buffer, length): to the console
+    SYS_TIME_NS,      // Nanoseconds since boot
+    SYS_FS_CREATE,    // (name)
+    SYS_FS_DELETE,    // (name)
+    SYS_FS_READ,      // (name, buffer, size)
+    SYS_FS_WRITE,     // (name, buffer, size)
+    SYS_FS_LIST,      // (buffer, size)
+    SYS_URING_SETUP,  // (entries, flags): returns the ring's address
+    SYS_URING_ENTER,  // (to_submit, min_complete, flags)
+    SYS_GETCPU,
+    SYS_COUNT
+};
+
+// Negative results; ramfs calls otherwise return what the fs_ function did
+#define SYSCALL_EBADF -9
+#define SYSCALL_ENOMEM -12
+#define SYSCALL_EFAULT -14  // A pointer argument isn't mapped user memory
+#define SYSCALL_EBUSY -16
+#define SYSCALL_EINVAL -22
+#define SYSCALL_EMFILE -24
+#define SYSCALL_ENOSYS -38
+
+// Registers saved by syscall_entry, lowest address first. Arguments come
+// in rdi, rsi, rdx, r10, r8 and r9: SYSCALL itself takes rcx and r11.
+typedef struct {
+    uint64_t arg5, arg4, arg3, arg2, arg1, arg0;
+    uint64_t number;       // rax
+    uint64_t rip, rflags;  // From rcx and r11
+    uint64_t rsp;
+} SyscallFrame;
+
+typedef int64_t (*syscall_handler_t)(SyscallFrame* frame);
+
+void syscall_init_cpu();
+int64_t syscall_dispatch(SyscallFrame* frame);
+
+#endif // SYSCALL_H
@@ -1,22 +1,137 @@
 #ifndef TASK_H
 #define TASK_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include "memory.h"
+#include "ktimer.h"
+#include "spinlock.h"
 
-#define MAX_TASKS 10
-#define STACK_SIZE 4096
+#define STACK_SIZE 16384
+#define TASK_POOL_CHUNK 64
 
-typedef struct {
+// Kernel stacks live in their own region. Each slot is an unmapped guard
+// page followed by STACK_SIZE mapped bytes, so overflowing a stack faults
+// instead of corrupting its neighbour.
+#define STACK_REGION_BASE 0xffffffffc0000000
+#define STACK_SLOT_SIZE (PAGE_SIZE + STACK_SIZE)
+#define STACK_REGION_SLOTS 16384
+#define SCHED_DEFAULT_QUANTUM_MS 10
+
+// Priority 0 is the most urgent. A runnable task always preempts tasks of
+// lower priority; tasks of equal priority share the CPU by virtual runtime.
+#define SCHED_PRIORITIES 8
+#define SCHED_PRIORITY_HIGH 2
+#define SCHED_PRIORITY_NORMAL 4
+#define SCHED_PRIORITY_LOW 6
+#define NICE_MIN -20
+#define NICE_MAX 19
+
+// CPUs compare run queue lengths this often and pull work from the busiest
+#define SCHED_BALANCE_MS 100
+
+// Latency histograms have one bucket per power of two TSC cycles; the last
+// also takes everything longer
+#define SCHED_HIST_BUCKETS 32
+
+// A woken task preempts one of equal priority that is this many vruntime
+// cycles ahead of it, so sleepers run promptly without thrashing
+#define SCHED_WAKEUP_GRANULARITY 1000000
+
+struct WaitQueue;
+struct UserProcess;
+struct Uring;
+struct VmSpace;
+
+typedef enum {
+    TASK_READY,
+    TASK_RUNNING,
+    TASK_BLOCKED,
+    TASK_DEAD       // Exited; waiting to be reaped
+} TaskState;
+
+typedef struct Task {
     uint64_t rsp;  // Stack pointer
     uint64_t cr3;  // Page table base register
     void (*entry)(void);  // Entry point of the task
+    void* arg;            // Passed by create_task_arg; the task reads it back
     int id;
     char name[32];
+    TaskState state;
+    int priority;
+    int nice;              // Scales the CPU share within a priority
+    uint32_t weight;       // Derived from nice; 1024 at nice 0
+    uint64_t vruntime;     // TSC cycles run, scaled by 1024 / weight
+    uint64_t exec_start;   // TSC when the task last started running
+    struct Task* next;     // Run queue link, sorted by vruntime
+    struct Task* all_next; // Every live task, for lookup and ps
+    struct Task* all_prev;
+    uint64_t stack_base;   // Lowest address of the stack slot's usable pages
+    int cpu;               // CPU whose run queue holds, or last held, the task
+    volatile int on_cpu;   // Set until the switch away from the task completes
+    struct WaitQueue* wait_queue; // Queue the task is waiting on, if any
+    struct Task* wait_next;
+    KTimer sleep_timer;    // Wakes the task from sleep_ms
+    uint8_t* fpu_state;    // 64-byte aligned save area, allocated on first FPU use
+    void* fpu_block;       // The allocation fpu_state lies in
+    int fpu_cpu;           // CPU that last loaded fpu_state into its registers
+    struct UserProcess* user; // Set while the task runs a user program
+    struct Uring* uring;   // Its submission ring, once set up
+    struct VmSpace* vm;    // Lazily backed regions of its address space
+
+    // Accounting in TSC cycles, kept by the scheduler under the rq lock
+    uint64_t sum_exec;     // Time on a CPU
+    uint64_t wait_sum;     // Time queued as ready without running
+    uint64_t ready_since;  // When last queued; 0 while not queued
+    uint64_t switches;     // Times switched onto a CPU
+    bool woken;            // Queued by task_wake rather than preemption
+    uint64_t top_sample;   // sum_exec when top last sampled the task
 } Task;
 
+typedef struct {
+    uint64_t buckets[SCHED_HIST_BUCKETS]; // Bucket n: [2^n, 2^(n+1)) cycles
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} LatencyHist;
+
+// Each CPU schedules from its own queues; remote CPUs only take the lock to
+// enqueue a woken task or to steal work
+typedef struct RunQueue {
+    spinlock_t lock;
+    Task* queues[SCHED_PRIORITIES];          // Sorted by vruntime
+    uint64_t min_vruntime[SCHED_PRIORITIES];
+    uint32_t ready_bitmap;                   // Bit set for every non-empty queue
+    volatile uint32_t nr_ready;
+} RunQueue;
+
 void init_tasking();
-void create_task(int id, char* name, void (*entry)(void));
+void sched_init_cpu(Task* idle);
+void sched_idle();
+void schedule_tail();
+int create_task(const char* name, void (*entry)(void));
+int create_task_arg(const char* name, void (*entry)(void), void* arg);
+void task_exit();
 void schedule();
 void yield();
 
+// Preemption: the timer calls scheduler_tick on every tick, and the
+// interrupt exit path calls preempt_check to switch once the quantum is used
+void scheduler_tick();
+void preempt_check();
+void sched_set_quantum_ms(uint32_t ms);
+uint32_t sched_get_quantum_ms();
+
+int task_set_priority(int id, int priority);
+int task_set_nice(int id, int nice);
+bool task_get_name(int id, char* name, size_t size);
+Task* current_task();
+void task_block();
+void task_wake(Task* task);
+void task_list(char* buffer, size_t buffer_size);
+void task_top(char* buffer, size_t buffer_size, uint32_t sample_ms);
+void sched_stats_dump(void (*write)(const char* line));
+bool task_is_stack_guard(uint64_t address);
+
 #endif // TASK_H
@@ -0,0 +1,23 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_HZ 1000              // Scheduler tick rate
+#define PIT_FREQUENCY 1193182
+#define LAPIC_TIMER_VECTOR 0x30
+
+void timer_init(uint32_t hz, bool nohz);
+void timer_init_ap();
+uint64_t timer_ticks();
+bool timer_using_lapic();
+bool timer_nohz();
+void timer_idle_enter();
+void timer_irq_enter();
+void timer_added(uint64_t expires);
+void timer_wakeup_stats(char* buffer, size_t buffer_size, uint32_t sample_ms);
+void pit_wait_ms(uint32_t ms);
+
+#endif // TIMER_H
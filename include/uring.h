@@ -0,0 +1,100 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesystem.h"
+#include "memory.h"
+#include "wait.h"
+
+// Batched asynchronous ramfs calls. A user task shares a submission ring
+// and a completion ring with the kernel, mapped at URING_BASE: it fills
+// submission entries and advances sq_tail, the kernel executes them in
+// order and posts completions at cq_tail, and the task reaps those by
+// advancing cq_head, all without a system call. One SYS_URING_ENTER then
+// submits a whole batch, or with URING_SETUP_SQPOLL a kernel task polls the
+// ring and the task only enters to wake it or to wait.
+
+#define URING_BASE (USER_BASE + 0x20000000ULL)
+#define URING_MAX_ENTRIES 256   // Submission entries; the completion ring is twice as big
+#define URING_MAX_FILES 16      // Open files per ring
+#define URING_SQPOLL_IDLE_MS 10 // Poller spins this long without work before sleeping
+#define URING_BENCH_DEFAULT_ROUNDS 100
+
+// Setup flags
+#define URING_SETUP_SQPOLL 0x1
+
+// Enter flags
+#define URING_ENTER_SQ_WAKEUP 0x1
+
+// UringShared.flags, set by the kernel
+#define URING_SQ_NEED_WAKEUP 0x1 // The poller is asleep; enter with URING_ENTER_SQ_WAKEUP
+
+enum {
+    URING_OP_NOP = 0,
+    URING_OP_OPEN,   // addr: file name; the result is a ring-local fd
+    URING_OP_CLOSE,
+    URING_OP_READ,   // Up to len bytes at offset into addr
+    URING_OP_WRITE,  // len bytes from addr at offset
+    URING_OP_FSYNC,  // Completes once every earlier entry has
+    URING_OP_COUNT
+};
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    int32_t fd;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t offset;
+    uint64_t user_data; // Handed back in the completion
+} UringSqe;
+
+typedef struct {
+    uint64_t user_data;
+    int32_t result;     // As the matching syscall would return
+    uint32_t flags;
+} UringCqe;
+
+// Start of the shared region. The kernel keeps its own copy of everything
+// it relies on, so the task scribbling here only hurts the task.
+typedef struct {
+    volatile uint32_t sq_head;   // Written by the kernel
+    volatile uint32_t sq_tail;   // Written by the task
+    volatile uint32_t cq_head;   // Written by the task
+    volatile uint32_t cq_tail;   // Written by the kernel
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    volatile uint32_t flags;
+    uint32_t setup_flags;
+    uint32_t sqes_offset;        // From the start of the region
+    uint32_t cqes_offset;
+} UringShared;
+
+typedef struct Uring {
+    UringShared* shared;
+    UringSqe* sqes;
+    UringCqe* cqes;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_head;
+    volatile uint32_t cq_tail;
+    char files[URING_MAX_FILES][MAX_FILENAME_LENGTH]; // Empty name: slot free
+    uint64_t cr3;
+    struct VmSpace* vm;          // The owner's, so the poller can fault in its buffers
+    bool sqpoll;                 // A poller task consumes the ring
+    volatile bool stopping;
+    volatile bool poller_done;
+    WaitQueue cq_wait;           // Tasks in SYS_URING_ENTER waiting for completions
+    WaitQueue poll_wait;         // The poller, asleep
+    uint64_t submitted;
+    uint64_t batches;
+} Uring;
+
+int64_t uring_setup(uint32_t entries, uint32_t flags);
+int64_t uring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+void uring_release(Task* task);
+uint64_t uring_bench(uint32_t rounds, bool sqpoll);
+
+#endif // URING_H
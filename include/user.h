@@ -0,0 +1,27 @@
+#ifndef USER_H
+#define USER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "interrupt.h"
+#include "memory.h"
+
+// A user program's image is copied to USER_BASE; its stack grows down
+// from USER_STACK_TOP
+#define USER_IMAGE_MAX (16 * PAGE_SIZE)
+#define USER_STACK_TOP (USER_BASE + 0x40000000ULL)
+#define USER_STACK_PAGES 4
+
+#define SYSCALL_BENCH_DEFAULT_CALLS 100000
+
+bool user_copy_string(char* dest, const char* src, size_t size);
+bool user_map_zeroed(uint64_t virtual_addr, size_t size);
+bool user_run(const char* name, const void* image, size_t size, uint64_t arg, int64_t* status);
+int user_exec(const char* path, uint64_t arg, int64_t* status);
+void user_install_programs();
+void user_exit(int64_t status) __attribute__((noreturn));
+void user_fault(InterruptFrame* frame);
+uint64_t syscall_bench(uint32_t calls);
+
+#endif // USER_H
@@ -0,0 +1,55 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+#include "memory.h"
+#include "seqlock.h"
+#include "smp.h"
+
+// Every user address space gets two pages at VDSO_BASE: a read-only data
+// page the kernel keeps current, then a copy of the functions in
+// vdso_text.c, which read the time and CPU from it without a system call.
+// User code finds the functions through VdsoData.entries.
+#define VDSO_BASE (USER_BASE + 0x30000000ULL)
+#define VDSO_DATA VDSO_BASE
+#define VDSO_TEXT (VDSO_BASE + PAGE_SIZE)
+#define VDSO_UPDATE_MS 1000
+#define VDSO_BENCH_DEFAULT_CALLS 100000
+
+// Indexes into VdsoData.entries
+enum {
+    VDSO_TIME_NS,   // uint64_t (void): like SYS_TIME_NS
+    VDSO_WALL_NS,   // uint64_t (void): nanoseconds since 1970
+    VDSO_GETCPU,    // int (void): the CPU the caller ran on
+    VDSO_ENTRY_COUNT
+};
+
+typedef struct {
+    uint32_t apic_id;
+    uint32_t online;
+} VdsoCpu;
+
+typedef struct {
+    uint64_t entries[VDSO_ENTRY_COUNT]; // Must stay first; user programs hard-code it
+    uint32_t clock_source;      // A ClockSource; the vDSO falls back to syscalls unless TSC
+    uint32_t has_rdtscp;        // TSC_AUX holds the CPU id, so rdtscp reports it
+    uint64_t tsc_mult;          // Nanoseconds per cycle, 32.32 fixed point
+    uint64_t tsc_base;          // The remaining fields are under lock
+    uint64_t mono_ns;           // ktime_ns at tsc_base
+    uint64_t wall_ns;           // Nanoseconds since 1970 at tsc_base
+    uint32_t cpu_count;
+    VdsoCpu cpus[MAX_CPUS];
+    seqlock_t lock;             // Readers only use the sequence
+} VdsoData;
+
+void vdso_init();
+void vdso_init_cpu();
+bool vdso_map(uint64_t cr3);
+void vdso_bench(uint32_t calls, uint64_t* vdso_ns, uint64_t* syscall_ns);
+
+// The user-side library, in vdso_text.c
+uint64_t vdso_time_ns();
+uint64_t vdso_wall_ns();
+int vdso_getcpu();
+
+#endif // VDSO_H
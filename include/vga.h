@@ -4,6 +4,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define VGA_REFRESH_HZ 50 // Unflushed output shows within 1/VGA_REFRESH_HZ s
+
+// Largest text grid any backend may ask for
+#define CONSOLE_MAX_COLUMNS 256
+#define CONSOLE_MAX_ROWS 128
+
 enum vga_color {
     VGA_COLOR_BLACK = 0,
     VGA_COLOR_BLUE = 1,
@@ -23,11 +29,28 @@ enum vga_color {
     VGA_COLOR_WHITE = 15,
 };
 
+// Where the console's text ends up. Cells are VGA text entries: character
+// in the low byte, foreground and background colour in the high byte.
+typedef struct ConsoleBackend {
+    const char* name;
+    // Draw cells [start, end) of screen row y; cursor_x is the cursor's
+    // column if it is on this row, else -1
+    void (*draw_cells)(size_t y, const uint16_t* cells, size_t start, size_t end, int cursor_x);
+    // Move the whole picture up by lines rows; NULL to redraw instead
+    void (*scroll)(size_t lines);
+    // Place a hardware cursor; NULL if draw_cells draws it
+    void (*set_cursor)(size_t x, size_t y);
+} ConsoleBackend;
+
 void vga_init();
+void vga_set_backend(const ConsoleBackend* backend, size_t columns, size_t rows);
 void vga_setcolor(uint8_t color);
 void vga_putchar(char c);
 void vga_write(const char* data);
 void vga_writestring(const char* data);
 void vga_clear();
+void vga_flush();
+void vga_write_sync(const char* data);
+void vga_set_notify(void (*notify)(void));
 
 #endif // VGA_H
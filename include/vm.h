@@ -0,0 +1,62 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesystem.h"
+#include "spinlock.h"
+
+// Lazily backed parts of a user address space. A region records where its
+// pages come from; the page fault handler fills a page from the backing
+// file, or with zeroes past the file's bytes, the first time it is touched.
+// Read-only file pages go through a SharedText so every address space
+// running the same version of a file maps the same physical pages.
+
+#define VM_MAX_SHARED_PAGES 4096 // Read-only span one file can share, in pages
+
+typedef struct SharedText {
+    char file[MAX_FILENAME_LENGTH];
+    uint32_t generation;
+    int refs;               // Address spaces using it, plus one while cached
+    uint64_t base;          // Address of pages[0]
+    uint32_t page_count;
+    uint64_t* pages;        // Physical pages; 0 until first faulted in
+    struct SharedText* next;
+} SharedText;
+
+typedef struct VmRegion {
+    uint64_t start;         // Page aligned
+    uint64_t end;
+    uint64_t page_flags;    // PAGE_WRITABLE or 0
+    uint64_t file_vaddr;    // Where the file bytes begin; zero-filled around them
+    uint64_t file_offset;
+    uint64_t file_size;
+    struct VmRegion* next;  // Sorted by start
+} VmRegion;
+
+typedef struct VmSpace {
+    spinlock_t lock;        // Serializes mapping faulted pages; the task and its poller both fault
+    char file[MAX_FILENAME_LENGTH]; // Backs every file region
+    uint32_t generation;    // The file's at load; a later write fails further faults
+    SharedText* shared;     // Read-only regions' pages, if there are any
+    VmRegion* regions;
+} VmSpace;
+
+typedef struct {
+    uint64_t file_faults;   // Pages read in from a file
+    uint64_t zero_faults;   // Pages with no file bytes in them
+    uint64_t shared_hits;   // Faults satisfied by an already loaded shared page
+    uint64_t shared_pages;  // Physical pages held by shared text
+} VmStats;
+
+VmSpace* vm_create(const char* file, uint32_t generation);
+bool vm_add_region(VmSpace* vm, uint64_t start, uint64_t end, uint64_t page_flags,
+                   uint64_t file_vaddr, uint64_t file_offset, uint64_t file_size);
+bool vm_share_text(VmSpace* vm);
+void vm_destroy(VmSpace* vm);
+bool vm_handle_fault(uint64_t address, bool write);
+bool vm_user_access(const void* addr, size_t size, bool write);
+void vm_get_stats(VmStats* stats);
+
+#endif // VM_H
@@ -0,0 +1,40 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "spinlock.h"
+#include "task.h"
+
+typedef struct WaitQueue {
+    spinlock_t lock;
+    Task* head;        // FIFO through Task.wait_next
+} WaitQueue;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT("wait_queue"), NULL }
+
+void wait_queue_init(WaitQueue* queue);
+void wait_prepare(WaitQueue* queue);
+void wait_finish(WaitQueue* queue);
+void wake_up(WaitQueue* queue);
+void wake_up_one(WaitQueue* queue);
+bool wait_queue_active(WaitQueue* queue);
+
+// Block the current task until condition is true. The condition is checked
+// after the task is queued, so a wake_up racing with the check is not lost.
+#define wait_event(queue, condition)     \
+    do {                                 \
+        while (1) {                      \
+            wait_prepare(queue);         \
+            if (condition) {             \
+                break;                   \
+            }                            \
+            schedule();                  \
+        }                                \
+        wait_finish(queue);              \
+    } while (0)
+
+// Block the current task for at least ms milliseconds of timer ticks
+void sleep_ms(uint32_t ms);
+
+#endif // WAIT_H
@@ -0,0 +1,45 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "spinlock.h"
+#include "wait.h"
+
+#define WORKQUEUE_MAX_WORKERS 4
+#define WORKQUEUE_BATCH 16 // Items a worker takes per trip to the queue lock
+
+// A unit of deferred work run in task context by a workqueue's workers, so
+// unlike a softirq it may block. Queueing it again before it starts does
+// nothing; once it has started it can be queued again.
+typedef struct Work {
+    struct Work* next;
+    void (*func)(struct Work* work);
+    volatile uint32_t pending;
+} Work;
+
+#define WORK_INIT(func) { NULL, func, 0 }
+
+typedef struct WorkQueue {
+    const char* name;
+    spinlock_t lock;
+    Work* head;
+    Work* tail;
+    WaitQueue wait;       // Idle workers
+    int workers;
+    uint64_t queued;
+    uint64_t completed;
+    uint64_t batches;
+    struct WorkQueue* next_queue;
+} WorkQueue;
+
+// Shared queue for short jobs, started by workqueue_init
+extern WorkQueue* system_wq;
+
+void workqueue_init();
+WorkQueue* workqueue_create(const char* name, int workers);
+bool queue_work(WorkQueue* queue, Work* work);
+void workqueue_stats(char* buffer, size_t buffer_size);
+
+#endif // WORKQUEUE_H
@@ -0,0 +1,173 @@
+#include "acpi.h"
+#include "string.h"
+#include "log.h"
+
+#define MADT_TYPE_LOCAL_APIC        0
+#define MADT_TYPE_IO_APIC           1
+#define MADT_TYPE_SOURCE_OVERRIDE   2
+#define MADT_TYPE_LAPIC_OVERRIDE    5
+#define MADT_LAPIC_ENABLED          (1 << 0)
+#define MADT_LAPIC_ONLINE_CAPABLE   (1 << 1)
+
+#define BIOS_EBDA_POINTER 0x40E
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END   0x100000
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    // ACPI 2.0+
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) AcpiRsdp;
+
+typedef struct {
+    AcpiSdtHeader header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) AcpiMadt;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) MadtEntry;
+
+// Tables are read in place: firmware puts them in low memory, which the
+// boot page tables identity map
+static const AcpiSdtHeader* root_table = NULL;
+static bool root_is_xsdt = false;
+static MadtInfo madt_info;
+static bool madt_found = false;
+
+static bool acpi_checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+static const AcpiRsdp* rsdp_scan(uint64_t start, uint64_t end) {
+    for (uint64_t address = start; address + sizeof(AcpiRsdp) <= end; address += 16) {
+        const AcpiRsdp* rsdp = (const AcpiRsdp*)address;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum_ok(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+// Legacy BIOS places the RSDP in the first KiB of the EBDA or in the ROM area
+static const AcpiRsdp* rsdp_find() {
+    uint64_t ebda = (uint64_t)*(volatile uint16_t*)BIOS_EBDA_POINTER << 4;
+    const AcpiRsdp* rsdp = ebda ? rsdp_scan(ebda, ebda + 1024) : NULL;
+    return rsdp ? rsdp : rsdp_scan(BIOS_ROM_START, BIOS_ROM_END);
+}
+
+static void madt_parse(const AcpiMadt* madt) {
+    memset(&madt_info, 0, sizeof(madt_info));
+    madt_info.lapic_address = madt->lapic_address;
+    for (int irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        madt_info.isa_irq_gsi[irq] = irq;
+    }
+
+    const uint8_t* p = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (p + sizeof(MadtEntry) <= end) {
+        const MadtEntry* entry = (const MadtEntry*)p;
+        if (entry->length < sizeof(MadtEntry)) {
+            break; // Malformed; don't loop forever
+        }
+
+        switch (entry->type) {
+        case MADT_TYPE_LOCAL_APIC: {
+            uint8_t apic_id = p[3];
+            uint32_t flags = *(const uint32_t*)(p + 4);
+            if ((flags & MADT_LAPIC_ENABLED) && madt_info.cpu_count < MADT_MAX_CPUS) {
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = apic_id;
+            }
+            break;
+        }
+        case MADT_TYPE_IO_APIC:
+            if (!madt_info.has_ioapic) {
+                madt_info.has_ioapic = true;
+                madt_info.ioapic_id = p[2];
+                madt_info.ioapic_address = *(const uint32_t*)(p + 4);
+                madt_info.ioapic_gsi_base = *(const uint32_t*)(p + 8);
+            }
+            break;
+        case MADT_TYPE_SOURCE_OVERRIDE: {
+            uint8_t source = p[3];
+            if (source < ISA_IRQ_COUNT) {
+                madt_info.isa_irq_gsi[source] = *(const uint32_t*)(p + 4);
+                madt_info.isa_irq_flags[source] = *(const uint16_t*)(p + 8);
+            }
+            break;
+        }
+        case MADT_TYPE_LAPIC_OVERRIDE:
+            madt_info.lapic_address = *(const uint64_t*)(p + 4);
+            break;
+        }
+        p += entry->length;
+    }
+    madt_found = true;
+}
+
+bool acpi_init(uint64_t rsdp_hint) {
+    const AcpiRsdp* rsdp = rsdp_hint ? (const AcpiRsdp*)rsdp_hint : rsdp_find();
+    if (!rsdp || memcmp(rsdp->signature, "RSD PTR ", 8) != 0) {
+        log_warn(LOG_KERNEL, "ACPI: no RSDP found\n");
+        return false;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address) {
+        root_table = (const AcpiSdtHeader*)rsdp->xsdt_address;
+        root_is_xsdt = true;
+    } else {
+        root_table = (const AcpiSdtHeader*)(uint64_t)rsdp->rsdt_address;
+        root_is_xsdt = false;
+    }
+    if (!acpi_checksum_ok(root_table, root_table->length)) {
+        log_warn(LOG_KERNEL, "ACPI: bad %s checksum\n", root_is_xsdt ? "XSDT" : "RSDT");
+        root_table = NULL;
+        return false;
+    }
+
+    const AcpiSdtHeader* madt = acpi_find_table("APIC");
+    if (madt) {
+        madt_parse((const AcpiMadt*)madt);
+        log_info(LOG_KERNEL, "ACPI: %u CPUs, I/O APIC %s\n", madt_info.cpu_count,
+                 madt_info.has_ioapic ? "present" : "absent");
+    }
+    return true;
+}
+
+const AcpiSdtHeader* acpi_find_table(const char* signature) {
+    if (!root_table) {
+        return NULL;
+    }
+
+    uint32_t entry_size = root_is_xsdt ? 8 : 4;
+    uint32_t count = (root_table->length - sizeof(AcpiSdtHeader)) / entry_size;
+    const uint8_t* entries = (const uint8_t*)(root_table + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t address = root_is_xsdt ? *(const uint64_t*)(entries + i * 8)
+                                        : *(const uint32_t*)(entries + i * 4);
+        const AcpiSdtHeader* table = (const AcpiSdtHeader*)address;
+        if (memcmp(table->signature, signature, 4) == 0 &&
+            acpi_checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+const MadtInfo* acpi_madt() {
+    return madt_found ? &madt_info : NULL;
+}
@@ -0,0 +1,62 @@
+#include "apic.h"
+#include "cpu.h"
+#include "memory.h"
+#include "interrupt.h"
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define APIC_BASE_ENABLE (1 << 11)
+#define LAPIC_SVR_ENABLE (1 << 8)
+
+#define PAGE_PRESENT_WRITABLE 0x3
+#define PAGE_CACHE_DISABLE 0x18 // PCD | PWT
+
+static volatile uint32_t* lapic_base = 0;
+
+bool lapic_available() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 9)) != 0;
+}
+
+void lapic_init() {
+    uint64_t base = rdmsr(IA32_APIC_BASE_MSR);
+    wrmsr(IA32_APIC_BASE_MSR, base | APIC_BASE_ENABLE);
+
+    uint64_t phys = base & 0xFFFFF000;
+    map_page(phys, phys, PAGE_PRESENT_WRITABLE | PAGE_CACHE_DISABLE);
+    lapic_base = (volatile uint32_t*)phys;
+
+    lapic_write(LAPIC_REG_SPURIOUS, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+}
+
+bool lapic_enabled() {
+    return lapic_base != 0;
+}
+
+uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+uint32_t lapic_id() {
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+// command is a vector or delivery mode for the low ICR word. Interrupts stay
+// off between the two writes so a handler's IPI cannot retarget this one.
+void lapic_send_ipi(uint32_t apic_id, uint32_t command) {
+    uint64_t flags = irq_save();
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, command);
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        // Wait for the local APIC to accept the IPI
+    }
+    irq_restore(flags);
+}
@@ -1,11 +1,18 @@
 ; bootloader/boot.asm
 global start
 extern long_mode_start
+extern boot_asm_tsc
 
 section .text
 bits 32
 start:
     mov esp, stack_top
+    mov edi, ebx ; multiboot info pointer; cpuid below clobbers ebx
+    mov esi, eax ; rdtsc clobbers the multiboot magic
+    rdtsc
+    mov [boot_asm_tsc], eax        ; boot_asm_tsc[BOOT_TSC_ENTRY]
+    mov [boot_asm_tsc + 4], edx
+    mov eax, esi
 
     call check_multiboot
     call check_cpuid
@@ -14,6 +21,10 @@ start:
     call set_up_page_tables
     call enable_paging
 
+    rdtsc
+    mov [boot_asm_tsc + 8], eax    ; boot_asm_tsc[BOOT_TSC_PAGING]
+    mov [boot_asm_tsc + 12], edx
+
     ; load the 64-bit GDT
     lgdt [gdt64.pointer]
 
@@ -0,0 +1,68 @@
+#include "boottime.h"
+#include "clock.h"
+#include "cpu.h"
+#include "string.h"
+
+typedef struct {
+    const char* name;
+    uint64_t start;     // TSC
+} BootPhase;
+
+uint64_t boot_asm_tsc[BOOT_TSC_COUNT];
+
+// Only the BSP touches these, before the other CPUs start. Every phase ends
+// where the next begins, and the last at done_tsc, so the durations add up
+// to the whole boot.
+static BootPhase phases[BOOT_MAX_PHASES];
+static int phase_count = 0;
+static uint64_t done_tsc = 0;
+
+void boot_phase(const char* name) {
+    if (phase_count < BOOT_MAX_PHASES && !done_tsc) {
+        phases[phase_count].name = name;
+        phases[phase_count].start = rdtsc();
+        phase_count++;
+    }
+}
+
+void boot_phases_done() {
+    if (!done_tsc) {
+        done_tsc = rdtsc();
+    }
+}
+
+static uint64_t to_us(uint64_t cycles) {
+    return clock_tsc_hz() ? clock_cycles_to_ns(cycles) / 1000 : cycles;
+}
+
+static size_t add_line(char* buffer, size_t buffer_size, size_t offset, const char* name,
+                       uint64_t start, uint64_t end) {
+    if (offset >= buffer_size - 1 || !start || end < start) {
+        return offset;
+    }
+    uint64_t entry = boot_asm_tsc[BOOT_TSC_ENTRY];
+    return offset + snprintf(buffer + offset, buffer_size - offset, "%10llu %10llu  %s\n",
+                             to_us(start - entry), to_us(end - start), name);
+}
+
+// One line per phase, timed from the first instruction of the kernel; the
+// TSC reading there also shows how long firmware and the loader took,
+// since the TSC counts from reset
+void boot_timeline(char* buffer, size_t buffer_size) {
+    const char* unit = clock_tsc_hz() ? "us" : "cycles";
+    uint64_t entry = boot_asm_tsc[BOOT_TSC_ENTRY];
+    uint64_t end = done_tsc ? done_tsc : rdtsc();
+    size_t offset = snprintf(buffer, buffer_size, "Boot timeline (%s)\n     START   DURATION  PHASE\n", unit);
+    offset = add_line(buffer, buffer_size, offset, "boot.asm: CPU checks, page tables",
+                      entry, boot_asm_tsc[BOOT_TSC_PAGING]);
+    offset = add_line(buffer, buffer_size, offset, "long_mode_start.asm: GDT, segments",
+                      boot_asm_tsc[BOOT_TSC_PAGING], boot_asm_tsc[BOOT_TSC_LONG_MODE]);
+    for (int i = 0; i < phase_count; i++) {
+        offset = add_line(buffer, buffer_size, offset, phases[i].name, phases[i].start,
+                          i + 1 < phase_count ? phases[i + 1].start : end);
+    }
+    if (offset < buffer_size - 1) {
+        snprintf(buffer + offset, buffer_size - offset, "Total %llu %s to the shell%s, %llu %s before kernel entry\n",
+                 to_us(end - entry), unit, done_tsc ? "" : " so far", to_us(entry), unit);
+    }
+}
@@ -0,0 +1,239 @@
+#include "clock.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "io.h"
+#include "log.h"
+#include "memory.h"
+#include "spinlock.h"
+#include "string.h"
+#include "timer.h"
+
+#define PAGE_PRESENT_WRITABLE 0x3
+#define PAGE_CACHE_DISABLE 0x18 // PCD | PWT
+
+#define HPET_REG_CAPABILITIES 0x00 // Counter period in femtoseconds in the high half
+#define HPET_REG_CONFIG 0x10
+#define HPET_REG_COUNTER 0xF0
+#define HPET_CONFIG_ENABLE 0x1
+#define FS_PER_NS 1000000ULL
+
+#define TSC_CALIBRATION_MS 50 // Within the PIT's 54 ms one-shot limit
+
+#define CMOS_ADDRESS 0x70
+#define CMOS_DATA 0x71
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+#define RTC_UPDATING 0x80 // Status A: the registers are about to change
+#define RTC_24_HOUR 0x02  // Status B
+#define RTC_BINARY 0x04   // Status B: values are not BCD
+#define RTC_PM 0x80       // Hour register, in 12-hour mode
+#define SECONDS_PER_DAY 86400
+
+// The "HPET" ACPI table, up to the base address we need
+typedef struct {
+    AcpiSdtHeader header;
+    uint32_t event_timer_block_id;
+    uint8_t address_space_id;
+    uint8_t register_bit_width;
+    uint8_t register_bit_offset;
+    uint8_t reserved;
+    uint64_t address;
+} __attribute__((packed)) AcpiHpet;
+
+static ClockSource source = CLOCK_SOURCE_TICKS;
+static const char* source_names[] = { "ticks", "HPET", "TSC" };
+static bool tsc_invariant = false;
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_base = 0;
+static uint64_t tsc_mult = 0;   // Nanoseconds per cycle, 32.32 fixed point
+static volatile uint64_t* hpet = NULL;
+static uint64_t hpet_period_fs = 0;
+static uint64_t hpet_mult = 0;  // Nanoseconds per HPET tick, 32.32 fixed point
+static uint64_t hpet_base = 0;
+static uint64_t boot_wall_ns = 0; // Realtime at ktime 0, from the RTC
+
+static uint64_t hpet_read(uint32_t reg) {
+    return hpet[reg / 8];
+}
+
+static void hpet_write(uint32_t reg, uint64_t value) {
+    hpet[reg / 8] = value;
+}
+
+// Maps and starts the HPET's main counter if ACPI describes one
+static bool hpet_init() {
+    const AcpiHpet* table = (const AcpiHpet*)acpi_find_table("HPET");
+    if (!table || table->address_space_id != 0) { // 0: system memory
+        return false;
+    }
+    map_page(table->address & ~0xFFFULL, table->address & ~0xFFFULL,
+             PAGE_PRESENT_WRITABLE | PAGE_CACHE_DISABLE);
+    hpet = (volatile uint64_t*)table->address;
+    hpet_period_fs = hpet_read(HPET_REG_CAPABILITIES) >> 32;
+    if (hpet_period_fs == 0 || hpet_period_fs > 100000000) { // The spec caps it at 100 ns
+        hpet = NULL;
+        return false;
+    }
+    hpet_mult = (hpet_period_fs << 32) / FS_PER_NS;
+    hpet_write(HPET_REG_CONFIG, hpet_read(HPET_REG_CONFIG) | HPET_CONFIG_ENABLE);
+    return true;
+}
+
+static bool tsc_is_invariant() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000007) {
+        return false;
+    }
+    cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 8)) != 0;
+}
+
+// Counts TSC cycles across a known interval: 10 ms of HPET counter when
+// there is one, otherwise a PIT channel 2 one-shot
+static uint64_t tsc_calibrate() {
+    if (hpet) {
+        uint64_t hpet_ticks = 10 * 1000000 * FS_PER_NS / hpet_period_fs;
+        uint64_t start = hpet_read(HPET_REG_COUNTER);
+        uint64_t tsc_start = rdtsc();
+        while (hpet_read(HPET_REG_COUNTER) - start < hpet_ticks)
+            ;
+        uint64_t elapsed_ns = (hpet_read(HPET_REG_COUNTER) - start) * hpet_period_fs / FS_PER_NS;
+        uint64_t cycles = rdtsc() - tsc_start;
+        return cycles * NSEC_PER_SEC / elapsed_ns;
+    }
+
+    uint64_t tsc_start = rdtsc();
+    pit_wait_ms(TSC_CALIBRATION_MS);
+    return (rdtsc() - tsc_start) * (1000 / TSC_CALIBRATION_MS);
+}
+
+static uint8_t cmos_read(uint8_t reg) {
+    outb(CMOS_ADDRESS, reg);
+    return inb(CMOS_DATA);
+}
+
+// Days from 1970-01-01 to the given civil date
+static uint64_t days_from_civil(uint32_t year, uint32_t month, uint32_t day) {
+    year -= month <= 2;
+    uint32_t era = year / 400;
+    uint32_t year_of_era = year - era * 400;
+    uint32_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return (uint64_t)era * 146097 + day_of_era - 719468;
+}
+
+// Seconds since 1970 from the CMOS clock, which only has second resolution.
+// The registers are read until two passes agree, so an update midway
+// through is never seen half applied.
+static uint64_t rtc_read_seconds() {
+    static const uint8_t registers[6] = { 0x00, 0x02, 0x04, 0x07, 0x08, 0x09 }; // s m h D M Y
+    uint8_t values[6];
+    uint8_t check[6];
+    do {
+        while (cmos_read(RTC_STATUS_A) & RTC_UPDATING) {
+            cpu_relax();
+        }
+        for (int i = 0; i < 6; i++) {
+            values[i] = cmos_read(registers[i]);
+        }
+        while (cmos_read(RTC_STATUS_A) & RTC_UPDATING) {
+            cpu_relax();
+        }
+        for (int i = 0; i < 6; i++) {
+            check[i] = cmos_read(registers[i]);
+        }
+    } while (memcmp(values, check, sizeof(values)) != 0);
+
+    uint8_t status = cmos_read(RTC_STATUS_B);
+    bool pm = values[2] & RTC_PM;
+    values[2] &= ~RTC_PM;
+    if (!(status & RTC_BINARY)) {
+        for (int i = 0; i < 6; i++) {
+            values[i] = (values[i] & 0x0F) + (values[i] >> 4) * 10;
+        }
+    }
+    if (!(status & RTC_24_HOUR)) {
+        values[2] = values[2] % 12 + (pm ? 12 : 0);
+    }
+    uint64_t days = days_from_civil(2000 + values[5], values[4], values[3]);
+    return days * SECONDS_PER_DAY + values[2] * 3600 + values[1] * 60 + values[0];
+}
+
+// Needs ACPI for the HPET, and paging to map it
+void clock_init() {
+    bool has_hpet = hpet_init();
+    tsc_invariant = tsc_is_invariant();
+    tsc_hz = tsc_calibrate();
+    tsc_mult = (NSEC_PER_SEC << 32) / tsc_hz;
+
+    if (tsc_invariant) {
+        tsc_base = rdtsc();
+        source = CLOCK_SOURCE_TSC;
+    } else if (has_hpet) {
+        hpet_base = hpet_read(HPET_REG_COUNTER);
+        source = CLOCK_SOURCE_HPET;
+    }
+    boot_wall_ns = rtc_read_seconds() * NSEC_PER_SEC - ktime_ns();
+    log_info(LOG_DRIVER, "Clock: %s, TSC %llu kHz%s, calibrated against %s\n",
+             source_names[source], tsc_hz / 1000, tsc_invariant ? " (invariant)" : "",
+             has_hpet ? "HPET" : "PIT");
+}
+
+// Nanoseconds since clock_init
+uint64_t ktime_ns() {
+    switch (source) {
+    case CLOCK_SOURCE_TSC:
+        return (uint64_t)(((unsigned __int128)(rdtsc() - tsc_base) * tsc_mult) >> 32);
+    case CLOCK_SOURCE_HPET:
+        return (uint64_t)(((unsigned __int128)(hpet_read(HPET_REG_COUNTER) - hpet_base) * hpet_mult) >> 32);
+    default:
+        return timer_ticks() * (NSEC_PER_SEC / TIMER_HZ);
+    }
+}
+
+ClockSource clock_source() {
+    return source;
+}
+
+uint64_t clock_tsc_hz() {
+    return tsc_hz;
+}
+
+// ktime_ns at a TSC reading; only meaningful with the TSC clocksource
+uint64_t clock_tsc_ns(uint64_t tsc) {
+    return (uint64_t)(((unsigned __int128)(tsc - tsc_base) * tsc_mult) >> 32);
+}
+
+// Nanoseconds per TSC cycle in 32.32 fixed point
+uint64_t clock_tsc_mult() {
+    return tsc_mult;
+}
+
+// Nanoseconds since 1970 at ktime 0, from the RTC; the realtime clock is
+// this plus ktime_ns
+uint64_t clock_boot_realtime_ns() {
+    return boot_wall_ns;
+}
+
+// For reporting rdtsc differences; 0 before clock_init
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * tsc_mult) >> 32);
+}
+
+// Busy-waits; only for short hardware delays
+void udelay(uint32_t us) {
+    uint64_t end = ktime_ns() + (uint64_t)us * 1000;
+    while (ktime_ns() < end) {
+        cpu_relax();
+    }
+}
+
+void clock_info(char* buffer, size_t buffer_size) {
+    uint64_t now = ktime_ns();
+    snprintf(buffer, buffer_size,
+             "Source: %s\nTSC: %llu kHz, %s\nHPET: %s\nUptime: %llu.%llu s\nRealtime: %llu s since 1970\n",
+             source_names[source], tsc_hz / 1000, tsc_invariant ? "invariant" : "not invariant",
+             hpet ? "present" : "absent", now / NSEC_PER_SEC, now % NSEC_PER_SEC / 1000000,
+             (boot_wall_ns + now) / NSEC_PER_SEC);
+}
@@ -0,0 +1,156 @@
+#include "compress.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5   // The final 5 bytes are always literals
+#define LZ_MF_LIMIT 12       // No match may start in the last 12 bytes
+#define LZ_MAX_OFFSET 65535
+
+// Last position seen for each hashed 4-byte sequence. Candidates are always
+// verified against the input, so stale entries from earlier calls are harmless.
+static uint32_t lz_hash_table[1 << LZ_HASH_BITS];
+
+static inline uint32_t lz_read32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t* lz_write_length(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static uint8_t* lz_write_sequence(uint8_t* op, const uint8_t* literals, size_t literal_length,
+                                  size_t offset, size_t match_length) {
+    uint8_t* token = op++;
+    size_t match_code = match_length - LZ_MIN_MATCH;
+
+    *token = (uint8_t)((literal_length >= 15 ? 15 : literal_length) << 4);
+    if (literal_length >= 15) {
+        op = lz_write_length(op, literal_length - 15);
+    }
+    for (size_t i = 0; i < literal_length; i++) {
+        *op++ = literals[i];
+    }
+
+    if (match_length == 0) {
+        return op; // Final literal-only sequence
+    }
+
+    *op++ = (uint8_t)(offset & 0xFF);
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)(match_code >= 15 ? 15 : match_code);
+    if (match_code >= 15) {
+        op = lz_write_length(op, match_code - 15);
+    }
+    return op;
+}
+
+int lz_compress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity) {
+    if (dst_capacity < LZ_COMPRESS_BOUND(src_size)) {
+        return -1;
+    }
+
+    uint8_t* op = dst;
+    size_t ip = 0;
+    size_t anchor = 0;
+
+    if (src_size > LZ_MF_LIMIT) {
+        size_t match_limit = src_size - LZ_MF_LIMIT;
+        size_t match_end_limit = src_size - LZ_LAST_LITERALS;
+
+        while (ip < match_limit) {
+            uint32_t sequence = lz_read32(src + ip);
+            uint32_t hash = lz_hash(sequence);
+            size_t candidate = lz_hash_table[hash];
+            lz_hash_table[hash] = (uint32_t)ip;
+
+            if (candidate >= ip || ip - candidate > LZ_MAX_OFFSET ||
+                lz_read32(src + candidate) != sequence) {
+                ip++;
+                continue;
+            }
+
+            size_t match_length = LZ_MIN_MATCH;
+            while (ip + match_length < match_end_limit &&
+                   src[candidate + match_length] == src[ip + match_length]) {
+                match_length++;
+            }
+
+            op = lz_write_sequence(op, src + anchor, ip - anchor, ip - candidate, match_length);
+            ip += match_length;
+            anchor = ip;
+        }
+    }
+
+    op = lz_write_sequence(op, src + anchor, src_size - anchor, 0, 0);
+    return (int)(op - dst);
+}
+
+int lz_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* in_end = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* out_end = dst + dst_capacity;
+
+    while (ip < in_end) {
+        uint8_t token = *ip++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= in_end) return -1;
+                extra = *ip++;
+                literal_length += extra;
+            } while (extra == 255);
+        }
+
+        if (literal_length > (size_t)(in_end - ip) || literal_length > (size_t)(out_end - op)) {
+            return -1;
+        }
+        for (size_t i = 0; i < literal_length; i++) {
+            *op++ = *ip++;
+        }
+
+        if (ip >= in_end) {
+            break; // Final sequence carries no match
+        }
+
+        if (in_end - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+
+        size_t match_length = token & 0x0F;
+        if (match_length == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= in_end) return -1;
+                extra = *ip++;
+                match_length += extra;
+            } while (extra == 255);
+        }
+        match_length += LZ_MIN_MATCH;
+
+        if (match_length > (size_t)(out_end - op)) {
+            return -1;
+        }
+        // Byte copy: the match may overlap the bytes it is producing
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < match_length; i++) {
+            *op++ = *match++;
+        }
+    }
+
+    return (int)(op - dst);
+}
@@ -0,0 +1,120 @@
+#include "framebuffer.h"
+#include "log.h"
+#include "memory.h"
+#include "multiboot.h"
+#include "vga.h"
+
+#define FRAMEBUFFER_PAGE_FLAGS 0xB // present + writable + write-through
+#define IDENTITY_MAPPED_LIMIT 0x40000000 // The boot page tables cover the first 1GB
+
+extern const uint8_t font8x8[95][8];
+
+static volatile uint8_t* fb_base;
+static uint32_t fb_pitch;
+static uint32_t fb_rows;                  // Text rows that fit
+
+// VGA's sixteen text colours as 8-bit RGB, packed into the framebuffer's
+// pixel format by framebuffer_init
+static const uint8_t vga_palette[16][3] = {
+    { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0xAA }, { 0x00, 0xAA, 0x00 }, { 0x00, 0xAA, 0xAA },
+    { 0xAA, 0x00, 0x00 }, { 0xAA, 0x00, 0xAA }, { 0xAA, 0x55, 0x00 }, { 0xAA, 0xAA, 0xAA },
+    { 0x55, 0x55, 0x55 }, { 0x55, 0x55, 0xFF }, { 0x55, 0xFF, 0x55 }, { 0x55, 0xFF, 0xFF },
+    { 0xFF, 0x55, 0x55 }, { 0xFF, 0x55, 0xFF }, { 0xFF, 0xFF, 0x55 }, { 0xFF, 0xFF, 0xFF },
+};
+
+// Two pixels of each colour side by side, ready for 8-byte stores
+static uint64_t colour_pairs[16];
+
+// expand[bits][i] selects pixels 2i and 2i+1 of a glyph row: all ones
+// where the font sets the pixel, so a row is four mask-and-merge stores
+static uint64_t expand[256][4];
+
+static uint32_t pack_channel(uint8_t value, uint8_t position, uint8_t size) {
+    return size >= 8 ? (uint32_t)value << position : (uint32_t)(value >> (8 - size)) << position;
+}
+
+static void build_tables(const MultibootFramebuffer* info) {
+    for (int i = 0; i < 16; i++) {
+        uint32_t pixel = pack_channel(vga_palette[i][0], info->red_position, info->red_size) |
+                         pack_channel(vga_palette[i][1], info->green_position, info->green_size) |
+                         pack_channel(vga_palette[i][2], info->blue_position, info->blue_size);
+        colour_pairs[i] = (uint64_t)pixel << 32 | pixel;
+    }
+    for (int bits = 0; bits < 256; bits++) {
+        for (int i = 0; i < 4; i++) {
+            uint64_t left = (bits >> (2 * i)) & 1 ? 0xFFFFFFFFULL : 0;
+            uint64_t right = (bits >> (2 * i + 1)) & 1 ? 0xFFFFFFFF00000000ULL : 0;
+            expand[bits][i] = left | right;
+        }
+    }
+}
+
+static void fb_draw_cells(size_t y, const uint16_t* cells, size_t start, size_t end, int cursor_x) {
+    for (size_t x = start; x < end; x++) {
+        uint8_t c = cells[x] & 0xFF;
+        uint8_t attribute = cells[x] >> 8;
+        const uint8_t* glyph = font8x8[c >= 0x20 && c < 0x7F ? c - 0x20 : 0];
+        uint64_t fg = colour_pairs[attribute & 0x0F];
+        uint64_t bg = colour_pairs[attribute >> 4];
+
+        volatile uint8_t* line = fb_base + y * FONT_HEIGHT * fb_pitch + x * FONT_WIDTH * 4;
+        for (int gy = 0; gy < FONT_HEIGHT; gy++, line += fb_pitch) {
+            uint8_t bits = glyph[gy / 2];
+            if ((int)x == cursor_x && gy >= FONT_HEIGHT - 2) {
+                bits = 0xFF; // Underline cursor
+            }
+            const uint64_t* mask = expand[bits];
+            volatile uint64_t* pixels = (volatile uint64_t*)line;
+            pixels[0] = (fg & mask[0]) | (bg & ~mask[0]);
+            pixels[1] = (fg & mask[1]) | (bg & ~mask[1]);
+            pixels[2] = (fg & mask[2]) | (bg & ~mask[2]);
+            pixels[3] = (fg & mask[3]) | (bg & ~mask[3]);
+        }
+    }
+}
+
+// One copy of everything below the top `lines` rows; the console redraws
+// the rows uncovered at the bottom
+static void fb_scroll(size_t lines) {
+    size_t offset = lines * FONT_HEIGHT * fb_pitch;
+    size_t count = (fb_rows - lines) * FONT_HEIGHT * fb_pitch / 8;
+    volatile uint64_t* to = (volatile uint64_t*)fb_base;
+    volatile uint64_t* from = (volatile uint64_t*)(fb_base + offset);
+    for (size_t i = 0; i < count; i++) {
+        to[i] = from[i];
+    }
+}
+
+static const ConsoleBackend fb_backend = { "framebuffer", fb_draw_cells, fb_scroll, NULL };
+
+// Moves the console onto the framebuffer GRUB set up, if it is one we can
+// draw on: 32 bits per pixel, direct RGB. Needs the page allocator to map
+// it. Returns false, leaving VGA text mode in use, otherwise.
+bool framebuffer_init() {
+    const MultibootFramebuffer* info =
+        (const MultibootFramebuffer*)multiboot_find_tag(MULTIBOOT_TAG_FRAMEBUFFER);
+    if (!info || info->type != MULTIBOOT_FRAMEBUFFER_RGB || info->bpp != 32) {
+        return false;
+    }
+
+    uint64_t size = (uint64_t)info->pitch * info->height;
+    if (info->address + size > IDENTITY_MAPPED_LIMIT) {
+        uint64_t first = info->address & ~(uint64_t)(PAGE_SIZE - 1);
+        for (uint64_t addr = first; addr < info->address + size; addr += PAGE_SIZE) {
+            map_page(addr, addr, FRAMEBUFFER_PAGE_FLAGS);
+        }
+    }
+
+    fb_base = (volatile uint8_t*)info->address;
+    fb_pitch = info->pitch;
+    fb_rows = info->height / FONT_HEIGHT;
+    if (fb_rows > CONSOLE_MAX_ROWS) {
+        fb_rows = CONSOLE_MAX_ROWS;
+    }
+    build_tables(info);
+    vga_set_backend(&fb_backend, info->width / FONT_WIDTH, fb_rows);
+
+    log_info(LOG_DRIVER, "Framebuffer: %ux%u at %p, %ux%u text\n", info->width, info->height,
+             (void*)info->address, info->width / FONT_WIDTH, fb_rows);
+    return true;
+}
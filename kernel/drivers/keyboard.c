@@ -2,30 +2,125 @@
 #include "io.h"
 #include "vga.h"
 #include "string.h"
+#include "log.h"
+#include "interrupt.h"
+#include "ring.h"
+#include "wait.h"
 
 #define KEYBOARD_DATA_PORT 0x60
 #define KEYBOARD_STATUS_PORT 0x64
-#define ENTER_KEY_CODE 0x1C
+#define KEYBOARD_RING_SIZE 64 // Scancodes; must be a power of two
 
-static char keyboard_map[128] = {
+#define SCANCODE_RELEASE 0x80
+#define SCANCODE_EXTENDED 0xE0
+#define SCANCODE_LEFT_SHIFT 0x2A
+#define SCANCODE_RIGHT_SHIFT 0x36
+#define SCANCODE_CTRL 0x1D
+#define SCANCODE_CAPS_LOCK 0x3A
+#define SCANCODE_ENTER 0x1C
+
+static const char keyboard_map[128] = {
     0,  27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
     '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
     0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0,
     '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0, '*', 0, ' '
 };
 
+static const char keyboard_shift_map[128] = {
+    0,  27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
+    '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
+    0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~', 0,
+    '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0, '*', 0, ' '
+};
+
+// IRQ1 only reaches the BSP, so the handler is the ring's one producer;
+// read_input, run by the shell alone, is its one consumer
+static uint8_t scancode_buffer[KEYBOARD_RING_SIZE];
+static SpscRing scancode_ring;
+
+// Tasks waiting in read_input for a scancode
+static WaitQueue keyboard_wait = WAIT_QUEUE_INIT;
+
+// Modifier state, only touched by the consumer
+static bool shift_held = false;
+static bool ctrl_held = false;
+static bool caps_lock = false;
+static bool extended = false;
+
+// Moves every byte the controller holds into the ring. Translation waits
+// for the reader, so the handler stays short.
+static void keyboard_handler(InterruptFrame* frame) {
+    (void)frame;
+    bool queued = false;
+    while (inb(KEYBOARD_STATUS_PORT) & 1) {
+        uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+        if (spsc_push(&scancode_ring, &scancode)) {
+            queued = true;
+        } else {
+            log_warn(LOG_DRIVER, "Keyboard: scancode ring full, key dropped\n");
+        }
+    }
+    if (queued) {
+        wake_up(&keyboard_wait);
+    }
+}
+
+// Needs the IDT and PIC set up by init_interrupts
 void keyboard_init() {
-    // Keyboard initialization code (if needed)
+    spsc_init(&scancode_ring, scancode_buffer, 1, KEYBOARD_RING_SIZE);
+    register_interrupt_handler(IRQ_BASE + IRQ_KEYBOARD, keyboard_handler);
+    pic_unmask_irq(IRQ_KEYBOARD);
+}
+
+// Applies one scancode to the modifier state and returns the character it
+// types, or 0 if it types none
+static char translate_scancode(uint8_t scancode) {
+    if (scancode == SCANCODE_EXTENDED) {
+        extended = true;
+        return 0;
+    }
+    bool was_extended = extended;
+    extended = false;
+
+    bool released = scancode & SCANCODE_RELEASE;
+    uint8_t key = scancode & ~SCANCODE_RELEASE;
+    if (key == SCANCODE_CTRL) {
+        ctrl_held = !released; // Left, or right when extended
+        return 0;
+    }
+    if (was_extended) {
+        // Keypad enter is the only extended key that types anything
+        return !released && key == SCANCODE_ENTER ? '\n' : 0;
+    }
+    if (key == SCANCODE_LEFT_SHIFT || key == SCANCODE_RIGHT_SHIFT) {
+        shift_held = !released;
+        return 0;
+    }
+    if (released) {
+        return 0;
+    }
+    if (key == SCANCODE_CAPS_LOCK) {
+        caps_lock = !caps_lock;
+        return 0;
+    }
+
+    char c = shift_held ? keyboard_shift_map[key] : keyboard_map[key];
+    if (caps_lock && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+        c ^= 0x20;
+    }
+    if (ctrl_held && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+        c &= 0x1F;
+    }
+    return c;
 }
 
+// Returns the next typed character, or 0 once the ring is empty
 char keyboard_read_char() {
-    if (inb(KEYBOARD_STATUS_PORT) & 1) {
-        unsigned char scancode = inb(KEYBOARD_DATA_PORT);
-        if (!(scancode & 0x80)) {
-            if (scancode == ENTER_KEY_CODE) {
-                return '\n';
-            }
-            return keyboard_map[scancode];
+    uint8_t scancode;
+    while (spsc_pop(&scancode_ring, &scancode)) {
+        char c = translate_scancode(scancode);
+        if (c) {
+            return c;
         }
     }
     return 0;
@@ -36,26 +131,27 @@ void read_input(char* buffer) {
     char c;
     vga_writestring("Input: ");
     while (1) {
-        c = keyboard_read_char();
-        if (c == '\n') {
-            buffer[i] = '\0';
-            vga_putchar('\n');
-            vga_writestring("Finished input: ");
-            vga_writestring(buffer);
-            vga_putchar('\n');
-            return;
-        } else if (c != 0) {
-            if (c == '\b' && i > 0) {
-                i--;
-                vga_putchar('\b');
-                vga_putchar(' ');
-                vga_putchar('\b');
+        // Show the echo so far, then sleep until IRQ1 queues a scancode
+        vga_flush();
+        wait_event(&keyboard_wait, spsc_count(&scancode_ring) > 0);
+        while ((c = keyboard_read_char()) != 0) {
+            if (c == '\n') {
+                buffer[i] = '\0';
+                vga_putchar('\n');
+                vga_flush();
+                log_debug(LOG_DRIVER, "Finished input: %s\n", buffer);
+                return;
+            } else if (c == '\b') {
+                if (i > 0) {
+                    i--;
+                    vga_putchar('\b');
+                    vga_putchar(' ');
+                    vga_putchar('\b');
+                }
             } else if (c >= ' ' && c <= '~' && i < 127) {
                 buffer[i++] = c;
                 vga_putchar(c);
             }
         }
-        // Add a small delay to prevent busy-waiting
-        for (volatile int j = 0; j < 10000; j++) {}
     }
 }
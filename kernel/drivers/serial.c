@@ -1,35 +1,167 @@
 #include "serial.h"
+#include "interrupt.h"
 #include "io.h"
+#include "spinlock.h"
+#include "string.h"
 
 #define SERIAL_PORT 0x3F8 // COM1 port address
+#define SERIAL_CLOCK 115200 // Baud rate at divisor 1
+#define SERIAL_FIFO_SIZE 16
+#define SERIAL_TX_RING_SIZE 4096 // Bytes; must be a power of two
 
-void serial_init()
+#define SERIAL_IER 1
+#define SERIAL_IIR 2
+#define SERIAL_LSR 5
+#define SERIAL_IER_THRE 0x02
+#define SERIAL_IIR_NONE 0x01     // No interrupt pending
+#define SERIAL_LSR_THRE 0x20     // Transmit FIFO empty
+
+// Bytes waiting for the UART. Writers on any CPU copy into it under the
+// lock; the transmit-empty interrupt, or a writer finding the UART idle,
+// moves up to a FIFO's worth at a time to the hardware.
+static char tx_ring[SERIAL_TX_RING_SIZE];
+static uint32_t tx_head = 0; // Next byte written
+static uint32_t tx_tail = 0; // Next byte sent
+static spinlock_t tx_lock = SPINLOCK_INIT("serial");
+static bool tx_interrupts = false; // Until serial_init_irq, writers drain the ring themselves
+
+static int serial_is_transmit_empty()
+{
+    return inb(SERIAL_PORT + SERIAL_LSR) & SERIAL_LSR_THRE;
+}
+
+// Called with tx_lock held. The FIFO only takes a new batch once it is
+// completely empty, which THRE reports.
+static void tx_refill()
 {
-    outb(SERIAL_PORT + 1, 0x00); // Disable all interrupts
-    outb(SERIAL_PORT + 3, 0x80); // Enable DLAB (set baud rate divisor)
-    outb(SERIAL_PORT + 0, 0x03); // Set divisor to 3 (low byte) 38400 baud
-    outb(SERIAL_PORT + 1, 0x00); //                  (high byte)
-    outb(SERIAL_PORT + 3, 0x03); // 8 bits, no parity, one stop bit
-    outb(SERIAL_PORT + 2, 0xC7); // Enable FIFO, clear them, with 14-byte threshold
-    outb(SERIAL_PORT + 4, 0x0B); // IRQs enabled, RTS/DSR set
+    if (tx_tail == tx_head || !serial_is_transmit_empty()) {
+        return;
+    }
+    for (int i = 0; i < SERIAL_FIFO_SIZE && tx_tail != tx_head; i++) {
+        outb(SERIAL_PORT, tx_ring[tx_tail++ & (SERIAL_TX_RING_SIZE - 1)]);
+    }
+}
+
+// Called with tx_lock held: busy-waits until the ring is empty
+static void tx_drain()
+{
+    while (tx_tail != tx_head) {
+        while (!serial_is_transmit_empty())
+            ;
+        tx_refill();
+    }
+}
+
+// baud must divide 115200; anything else falls back to SERIAL_DEFAULT_BAUD
+void serial_init(uint32_t baud)
+{
+    if (baud == 0 || baud > SERIAL_CLOCK || SERIAL_CLOCK % baud != 0) {
+        baud = SERIAL_DEFAULT_BAUD;
+    }
+    uint16_t divisor = SERIAL_CLOCK / baud;
+
+    outb(SERIAL_PORT + 1, 0x00);           // Disable all interrupts
+    outb(SERIAL_PORT + 3, 0x80);           // Enable DLAB (set baud rate divisor)
+    outb(SERIAL_PORT + 0, divisor & 0xFF); // Divisor low byte
+    outb(SERIAL_PORT + 1, divisor >> 8);   //         high byte
+    outb(SERIAL_PORT + 3, 0x03);           // 8 bits, no parity, one stop bit
+    outb(SERIAL_PORT + 2, 0xC7);           // Enable FIFO, clear them, with 14-byte threshold
+    outb(SERIAL_PORT + 4, 0x0B);           // IRQs enabled, RTS/DSR set
 }
 
-int serial_is_transmit_empty()
+static void serial_handler(InterruptFrame* frame)
 {
-    return inb(SERIAL_PORT + 5) & 0x20;
+    (void)frame;
+    spin_lock(&tx_lock);
+    // Reading IIR acknowledges a transmit-empty interrupt; loop until none
+    // is pending so the (edge-triggered) PIC line drops and can fire again
+    while (!(inb(SERIAL_PORT + SERIAL_IIR) & SERIAL_IIR_NONE)) {
+        if (!serial_is_transmit_empty() || tx_tail == tx_head) {
+            break;
+        }
+        tx_refill();
+    }
+    spin_unlock(&tx_lock);
 }
 
-void serial_write_char(char c)
+// Needs the IDT and PIC set up by init_interrupts. Enabling the interrupt
+// with the FIFO already empty raises it at once, which sends whatever
+// was queued before.
+void serial_init_irq()
 {
-    while (serial_is_transmit_empty() == 0)
-        ;
-    outb(SERIAL_PORT, c);
+    register_interrupt_handler(IRQ_BASE + IRQ_COM1, serial_handler);
+    pic_unmask_irq(IRQ_COM1);
+
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    tx_interrupts = true;
+    outb(SERIAL_PORT + SERIAL_IER, SERIAL_IER_THRE);
+    tx_refill();
+    spin_unlock_irqrestore(&tx_lock, flags);
 }
 
+// Queues str and returns without waiting for the UART, unless the ring is
+// a full 4 KB behind, in which case the caller sends bytes until it fits
 void serial_write(const char *str)
 {
+    size_t length = strlen(str);
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    while (length > 0) {
+        uint32_t space = SERIAL_TX_RING_SIZE - (tx_head - tx_tail);
+        if (space == 0) {
+            while (!serial_is_transmit_empty())
+                ;
+            tx_refill();
+            continue;
+        }
+
+        uint32_t offset = tx_head & (SERIAL_TX_RING_SIZE - 1);
+        uint32_t chunk = SERIAL_TX_RING_SIZE - offset; // Up to the end of the buffer
+        if (chunk > space) {
+            chunk = space;
+        }
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(tx_ring + offset, str, chunk);
+        tx_head += chunk;
+        str += chunk;
+        length -= chunk;
+    }
+
+    if (tx_interrupts) {
+        tx_refill(); // Start the UART if it is idle; the interrupt does the rest
+    } else {
+        tx_drain();
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+// Sends everything queued, busy-waiting on the UART. For panic paths, so
+// it gives up on the lock after a while rather than deadlock on a CPU
+// that died holding it.
+void serial_flush()
+{
+    uint64_t flags = lock_irq_save();
+    bool locked = false;
+    for (int attempt = 0; attempt < 1000000 && !locked; attempt++) {
+        locked = spin_trylock(&tx_lock);
+    }
+    tx_drain();
+    if (locked) {
+        spin_unlock(&tx_lock);
+    }
+    lock_irq_restore(flags);
+}
+
+// Flushes the ring, then sends str directly. Used where the normal path
+// can't be trusted, such as a fault inside serial_write itself.
+void serial_write_polled(const char *str)
+{
+    serial_flush();
     while (*str)
     {
-        serial_write_char(*str++);
+        while (!serial_is_transmit_empty())
+            ;
+        outb(SERIAL_PORT, *str++);
     }
 }
@@ -0,0 +1,287 @@
+#include "timer.h"
+#include "apic.h"
+#include "clock.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "io.h"
+#include "log.h"
+#include "task.h"
+#include "smp.h"
+#include "string.h"
+#include "wait.h"
+#include "ktimer.h"
+#include "softirq.h"
+#include "profile.h"
+
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND  0x43
+#define PIT_GATE_PORT 0x61
+
+#define LAPIC_TIMER_DIVIDE_16 0x3
+#define LAPIC_TIMER_TSC_DEADLINE (2 << 17)
+#define LAPIC_CALIBRATION_MS 10
+#define MSR_TSC_DEADLINE 0x6E0
+#define CPUID_TSC_DEADLINE (1 << 24) // Leaf 1, ECX
+
+static volatile uint64_t tick_count = 0;
+static bool using_lapic = false;
+static uint32_t timer_hz = TIMER_HZ;
+static uint32_t lapic_ticks_per_second = 0;
+
+// Tickless idle: CPUs with nothing to run stop their periodic tick and arm
+// a one-shot interrupt for the next timer instead. The BSP then derives
+// tick_count from ktime_ns, since ticks no longer arrive one by one.
+static bool nohz = false;
+static bool tsc_deadline = false;
+static uint64_t ns_per_tick;
+static uint64_t tick_epoch_ns;
+
+// The tick the BSP's one-shot is armed for while its tick is stopped, or 0
+// while it is still choosing one, so that timer_added always kicks it then
+static volatile uint64_t bsp_wake_tick = 0;
+
+// Called on the BSP with interrupts off; true if the count moved
+static bool update_ticks() {
+    if (!nohz) {
+        tick_count++;
+        return true;
+    }
+    uint64_t ticks = (ktime_ns() - tick_epoch_ns) / ns_per_tick;
+    if (ticks <= tick_count) {
+        return false;
+    }
+    tick_count = ticks;
+    return true;
+}
+
+// Every CPU takes its own LAPIC timer interrupt; the BSP's keeps the time
+static void timer_handler(InterruptFrame* frame) {
+    Cpu* cpu = this_cpu();
+    cpu->timer_interrupts++;
+    profile_tick(frame);
+    if (cpu->id == 0) {
+        update_ticks();
+        raise_softirq(SOFTIRQ_TIMER);
+    }
+    scheduler_tick();
+}
+
+static void lapic_timer_periodic() {
+    if (tsc_deadline) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    }
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, lapic_ticks_per_second / timer_hz);
+}
+
+// A single interrupt ns from now, in TSC-deadline mode where the CPU has it
+static void lapic_timer_oneshot(uint64_t ns) {
+    if (tsc_deadline) {
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_TSC_DEADLINE);
+        // The LVT write must land before the MSR write that arms the timer
+        __asm__ volatile("mfence" ::: "memory");
+        wrmsr(MSR_TSC_DEADLINE, rdtsc() + ns * clock_tsc_hz() / NSEC_PER_SEC);
+        return;
+    }
+    uint64_t count = ns * lapic_ticks_per_second / NSEC_PER_SEC;
+    if (count == 0) {
+        count = 1;
+    } else if (count > 0xFFFFFFFF) {
+        count = 0xFFFFFFFF;
+    }
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, count);
+}
+
+// Called by the idle loop with interrupts off, just before halting. Stops
+// the tick until the next timer on the wheel (on the BSP, which runs it),
+// but never for longer than the balance interval so idle CPUs still look
+// for work to steal.
+void timer_idle_enter() {
+    if (!nohz) {
+        return;
+    }
+    Cpu* cpu = this_cpu();
+    if (cpu->id == 0) {
+        // Marked stopped before the wheel is read, so a timer another CPU
+        // adds after that read kicks this one
+        __atomic_store_n(&bsp_wake_tick, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&cpu->tick_stopped, true, __ATOMIC_SEQ_CST);
+    }
+    uint64_t wake_tick = tick_count + SCHED_BALANCE_MS * TIMER_HZ / 1000;
+    uint64_t next;
+    if (cpu->id == 0 && ktimer_next_expiry(&next) && next < wake_tick) {
+        wake_tick = next;
+    }
+    if (wake_tick <= tick_count + 1) {
+        cpu->tick_stopped = false;
+        return; // Due within a tick anyway
+    }
+
+    uint64_t deadline = tick_epoch_ns + wake_tick * ns_per_tick;
+    uint64_t now = ktime_ns();
+    lapic_timer_oneshot(deadline > now ? deadline - now : 0);
+    cpu->tick_stopped = true;
+    if (cpu->id == 0) {
+        __atomic_store_n(&bsp_wake_tick, wake_tick, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Called once a timer expiring at tick expires is on the wheel. Only the
+// BSP runs the wheel, so if its tick is stopped until later than that, it
+// is woken to re-arm its one-shot.
+void timer_added(uint64_t expires) {
+    if (!nohz) {
+        return;
+    }
+    Cpu* bsp = smp_cpu(0);
+    if (bsp == this_cpu() || !__atomic_load_n(&bsp->tick_stopped, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    uint64_t wake_tick = __atomic_load_n(&bsp_wake_tick, __ATOMIC_SEQ_CST);
+    if (wake_tick == 0 || expires < wake_tick) {
+        smp_send_reschedule(bsp);
+    }
+}
+
+// Called at the start of every interrupt; restarts the tick on a CPU
+// leaving tickless idle, before anything it wakes gets to run
+void timer_irq_enter() {
+    Cpu* cpu = this_cpu();
+    if (!cpu->tick_stopped) {
+        return;
+    }
+    cpu->tick_stopped = false;
+    lapic_timer_periodic();
+    if (cpu->id == 0 && update_ticks()) {
+        raise_softirq(SOFTIRQ_TIMER);
+    }
+}
+
+static void timer_softirq() {
+    ktimer_run(tick_count);
+}
+
+// Busy-wait using PIT channel 2, which is not wired to an interrupt.
+// Limited to about 54 ms by the 16-bit counter.
+void pit_wait_ms(uint32_t ms) {
+    uint32_t count = PIT_FREQUENCY / 1000 * ms;
+    if (count > 0xFFFF) {
+        count = 0xFFFF;
+    }
+
+    uint8_t gate = inb(PIT_GATE_PORT) & ~0x03;  // Gate low, speaker off
+    outb(PIT_GATE_PORT, gate);
+    outb(PIT_COMMAND, 0xB0);                     // Channel 2, lo/hi byte, mode 0
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+    outb(PIT_GATE_PORT, gate | 0x01);            // Raise the gate to start counting
+
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        // OUT2 goes high when the count reaches zero
+    }
+}
+
+static void pit_init(uint32_t hz) {
+    uint32_t divisor = PIT_FREQUENCY / hz;
+    outb(PIT_COMMAND, 0x36); // Channel 0, lo/hi byte, mode 3 (square wave)
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+
+    register_interrupt_handler(IRQ_BASE + IRQ_TIMER, timer_handler);
+    pic_unmask_irq(IRQ_TIMER);
+}
+
+// Count LAPIC timer ticks across a PIT-timed interval, then run the timer
+// periodically at timer_hz
+static void lapic_timer_init() {
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0xFFFFFFFF);
+    pit_wait_ms(LAPIC_CALIBRATION_MS);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CURRENT);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+
+    lapic_ticks_per_second = elapsed * (1000 / LAPIC_CALIBRATION_MS);
+    log_info(LOG_DRIVER, "LAPIC timer: %u ticks/s\n", lapic_ticks_per_second);
+
+    register_interrupt_handler(LAPIC_TIMER_VECTOR, timer_handler);
+    lapic_timer_periodic();
+}
+
+// Prefers the local APIC timer; falls back to the PIT on IRQ0. Tickless
+// idle needs the LAPIC for per-CPU one-shots and a clocksource that keeps
+// counting without the tick.
+void timer_init(uint32_t hz, bool allow_nohz) {
+    timer_hz = hz;
+    ns_per_tick = NSEC_PER_SEC / hz;
+    open_softirq(SOFTIRQ_TIMER, timer_softirq);
+    if (lapic_available()) {
+        lapic_init();
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        tsc_deadline = (ecx & CPUID_TSC_DEADLINE) && clock_source() == CLOCK_SOURCE_TSC;
+        lapic_timer_init();
+        using_lapic = true;
+    } else {
+        pit_init(hz);
+        using_lapic = false;
+    }
+    tick_epoch_ns = ktime_ns();
+    nohz = allow_nohz && using_lapic && clock_source() != CLOCK_SOURCE_TICKS;
+    log_info(LOG_DRIVER, "Timer: %u Hz via %s, %s\n", hz, using_lapic ? "LAPIC" : "PIT",
+             !nohz ? "periodic" : tsc_deadline ? "tickless idle (TSC deadline)" : "tickless idle");
+}
+
+// Starts an application processor's LAPIC timer using the BSP's calibration
+void timer_init_ap() {
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_timer_periodic();
+}
+
+// With nohz the BSP's count stands still while its tick is stopped, so
+// other CPUs would time new timers from a stale tick; the clocksource is
+// read instead
+uint64_t timer_ticks() {
+    if (nohz) {
+        return (ktime_ns() - tick_epoch_ns) / ns_per_tick;
+    }
+    return tick_count;
+}
+
+bool timer_using_lapic() {
+    return using_lapic;
+}
+
+bool timer_nohz() {
+    return nohz;
+}
+
+// Counts each CPU's idle wakeups and timer interrupts over sample_ms, so
+// idle efficiency can be compared with and without nohz=0
+void timer_wakeup_stats(char* buffer, size_t buffer_size, uint32_t sample_ms) {
+    uint64_t wakeups[MAX_CPUS];
+    uint64_t interrupts[MAX_CPUS];
+    int cpus = smp_cpu_count();
+    for (int i = 0; i < cpus; i++) {
+        wakeups[i] = __atomic_load_n(&smp_cpu(i)->idle_wakeups, __ATOMIC_RELAXED);
+        interrupts[i] = __atomic_load_n(&smp_cpu(i)->timer_interrupts, __ATOMIC_RELAXED);
+    }
+    uint64_t start = ktime_ns();
+    sleep_ms(sample_ms);
+    uint64_t elapsed_ms = (ktime_ns() - start) / 1000000;
+    if (elapsed_ms == 0) {
+        elapsed_ms = 1;
+    }
+
+    size_t offset = snprintf(buffer, buffer_size, "Tick: %s, %llu ms sample\nCPU  WAKEUPS/S  TIMER IRQS/S\n",
+                             nohz ? "tickless idle" : "periodic", elapsed_ms);
+    for (int i = 0; i < cpus && offset < buffer_size - 1; i++) {
+        Cpu* cpu = smp_cpu(i);
+        uint64_t woke = __atomic_load_n(&cpu->idle_wakeups, __ATOMIC_RELAXED) - wakeups[i];
+        uint64_t fired = __atomic_load_n(&cpu->timer_interrupts, __ATOMIC_RELAXED) - interrupts[i];
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-3d %10llu %13llu\n",
+                           cpu->id, woke * 1000 / elapsed_ms, fired * 1000 / elapsed_ms);
+    }
+}
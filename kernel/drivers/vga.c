@@ -1,14 +1,38 @@
 #include "vga.h"
 #include "io.h"
+#include "spinlock.h"
 
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 #define VGA_BUFFER 0xB8000
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define VGA_CURSOR_HIGH 0x0E
+#define VGA_CURSOR_LOW 0x0F
+
+// Text is drawn into a RAM copy of the screen and handed to the backend,
+// which owns the slow video memory, only by vga_flush. Screen row y is
+// shadow row (console_top + y) % CONSOLE_MAX_ROWS, so scrolling just moves
+// console_top.
+static uint16_t console_shadow[CONSOLE_MAX_ROWS][CONSOLE_MAX_COLUMNS] __attribute__((aligned(8)));
+static size_t console_top;
+static size_t console_columns = VGA_WIDTH;
+static size_t console_rows = VGA_HEIGHT;
+
+// Cells [dirty_start[y], dirty_end[y]) of screen row y differ from what
+// the backend shows; rows scrolled since the last flush are pending_scroll
+static uint16_t dirty_start[CONSOLE_MAX_ROWS];
+static uint16_t dirty_end[CONSOLE_MAX_ROWS];
+static volatile bool console_dirty;
+static size_t pending_scroll;
+static int drawn_cursor_x = -1; // Where a drawn cursor was last put
+static int drawn_cursor_y = -1;
 
-static uint16_t* vga_buffer = (uint16_t*)VGA_BUFFER;
 static uint8_t vga_color;
-static uint8_t vga_column;
-static uint8_t vga_row;
+static uint16_t vga_column;
+static uint16_t vga_row;
+static spinlock_t vga_lock = SPINLOCK_INIT("vga");
+static void (*vga_notify)(void) = NULL;
 
 static inline uint8_t vga_entry_color(enum vga_color fg, enum vga_color bg) {
     return fg | bg << 4;
@@ -18,64 +42,229 @@ static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
     return (uint16_t)uc | (uint16_t)color << 8;
 }
 
-void vga_init() {
+// VGA text memory: cells are copied four at a time, and the hardware
+// cursor is moved once per flush
+static void text_draw_cells(size_t y, const uint16_t* cells, size_t start, size_t end, int cursor_x) {
+    (void)cursor_x;
+    const uint64_t* from = (const uint64_t*)cells;
+    volatile uint64_t* to = (volatile uint64_t*)((uint16_t*)VGA_BUFFER + y * VGA_WIDTH);
+    for (size_t i = start / 4; i < (end + 3) / 4; i++) {
+        to[i] = from[i];
+    }
+}
+
+static void text_set_cursor(size_t x, size_t y) {
+    uint16_t position = y * VGA_WIDTH + x;
+    outb(VGA_CRTC_INDEX, VGA_CURSOR_LOW);
+    outb(VGA_CRTC_DATA, position & 0xFF);
+    outb(VGA_CRTC_INDEX, VGA_CURSOR_HIGH);
+    outb(VGA_CRTC_DATA, position >> 8);
+}
+
+// Rewriting every row costs less than reading uncached text memory back
+static const ConsoleBackend text_backend = { "VGA text", text_draw_cells, NULL, text_set_cursor };
+static const ConsoleBackend* console_backend = &text_backend;
+
+static inline uint16_t* vga_shadow_row(size_t y) {
+    return console_shadow[(console_top + y) % CONSOLE_MAX_ROWS];
+}
+
+static void mark_dirty(size_t y, size_t start, size_t end) {
+    if (start < dirty_start[y]) {
+        dirty_start[y] = start;
+    }
+    if (end > dirty_end[y]) {
+        dirty_end[y] = end;
+    }
+    console_dirty = true;
+}
+
+static void mark_clean(size_t y) {
+    dirty_start[y] = CONSOLE_MAX_COLUMNS;
+    dirty_end[y] = 0;
+}
+
+static void mark_all_dirty() {
+    for (size_t y = 0; y < console_rows; y++) {
+        dirty_start[y] = 0;
+        dirty_end[y] = console_columns;
+    }
+    console_dirty = true;
+}
+
+static void vga_clear_cells(uint16_t* row, size_t start, size_t end) {
+    uint16_t blank = vga_entry(' ', vga_color);
+    for (size_t x = start; x < end; x++) {
+        row[x] = blank;
+    }
+}
+
+// Called with vga_lock held
+static void vga_clear_locked() {
+    console_top = 0;
+    for (size_t y = 0; y < console_rows; y++) {
+        vga_clear_cells(vga_shadow_row(y), 0, console_columns);
+    }
+    pending_scroll = 0;
+    mark_all_dirty();
     vga_row = 0;
     vga_column = 0;
+}
+
+// Called with vga_lock held. Scrolls the backend, draws the dirty spans,
+// then places the cursor.
+static void vga_flush_locked() {
+    const ConsoleBackend* backend = console_backend;
+    if (pending_scroll) {
+        if (backend->scroll && pending_scroll < console_rows) {
+            backend->scroll(pending_scroll);
+            drawn_cursor_y -= (int)pending_scroll; // Moved up with the text
+        } else {
+            mark_all_dirty();
+            drawn_cursor_y = -1;
+        }
+        pending_scroll = 0;
+    }
+
+    // A drawn cursor is part of its cell, so moving it redraws two cells
+    if (!backend->set_cursor && (drawn_cursor_x != vga_column || drawn_cursor_y != vga_row)) {
+        if (drawn_cursor_y >= 0) {
+            mark_dirty(drawn_cursor_y, drawn_cursor_x, drawn_cursor_x + 1);
+        }
+        if (vga_column < console_columns) {
+            mark_dirty(vga_row, vga_column, vga_column + 1);
+        }
+    }
+
+    if (console_dirty) {
+        console_dirty = false;
+        for (size_t y = 0; y < console_rows; y++) {
+            if (dirty_start[y] < dirty_end[y]) {
+                backend->draw_cells(y, vga_shadow_row(y), dirty_start[y], dirty_end[y],
+                                    y == vga_row ? vga_column : -1);
+                mark_clean(y);
+            }
+        }
+    }
+
+    if (backend->set_cursor) {
+        backend->set_cursor(vga_column, vga_row);
+    }
+    drawn_cursor_x = vga_column;
+    drawn_cursor_y = vga_row;
+}
+
+void vga_init() {
     vga_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            vga_buffer[index] = vga_entry(' ', vga_color);
+    vga_clear_locked();
+    vga_flush_locked();
+}
+
+// Switches output to another backend of the given size in cells. What is
+// on screen is kept, anchored at the top left, and redrawn.
+void vga_set_backend(const ConsoleBackend* backend, size_t columns, size_t rows) {
+    if (columns > CONSOLE_MAX_COLUMNS) {
+        columns = CONSOLE_MAX_COLUMNS;
+    }
+    if (rows > CONSOLE_MAX_ROWS) {
+        rows = CONSOLE_MAX_ROWS;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&vga_lock);
+    for (size_t y = 0; y < rows; y++) {
+        size_t keep = y < console_rows ? console_columns : 0;
+        if (keep < columns) {
+            vga_clear_cells(vga_shadow_row(y), keep, columns);
         }
     }
+    // Keep the cursor row on screen if the new one is shorter
+    if (vga_row >= rows) {
+        console_top = (console_top + vga_row - rows + 1) % CONSOLE_MAX_ROWS;
+        vga_row = rows - 1;
+    }
+    if (vga_column >= columns) {
+        vga_column = 0;
+    }
+
+    console_backend = backend;
+    console_columns = columns;
+    console_rows = rows;
+    pending_scroll = 0;
+    drawn_cursor_x = -1;
+    drawn_cursor_y = -1;
+    mark_all_dirty();
+    vga_flush_locked();
+    spin_unlock_irqrestore(&vga_lock, flags);
 }
 
 void vga_setcolor(uint8_t color) {
     vga_color = color;
 }
 
-void vga_putentryat(char c, uint8_t color, size_t x, size_t y) {
-    const size_t index = y * VGA_WIDTH + x;
-    vga_buffer[index] = vga_entry(c, color);
+static void vga_putentryat(char c, uint8_t color, size_t x, size_t y) {
+    vga_shadow_row(y)[x] = vga_entry(c, color);
+    mark_dirty(y, x, x + 1);
 }
 
-void vga_scroll() {
-    for (size_t y = 1; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t to_index = (y - 1) * VGA_WIDTH + x;
-            const size_t from_index = y * VGA_WIDTH + x;
-            vga_buffer[to_index] = vga_buffer[from_index];
-        }
+// The old top row becomes the new, blank bottom row. Dirty spans move up
+// with their text; the backend catches up with one scroll at flush time.
+static void vga_scroll() {
+    console_top = (console_top + 1) % CONSOLE_MAX_ROWS;
+    vga_clear_cells(vga_shadow_row(console_rows - 1), 0, console_columns);
+    for (size_t y = 0; y + 1 < console_rows; y++) {
+        dirty_start[y] = dirty_start[y + 1];
+        dirty_end[y] = dirty_end[y + 1];
     }
+    dirty_start[console_rows - 1] = 0;
+    dirty_end[console_rows - 1] = console_columns;
+    pending_scroll++;
+    console_dirty = true;
+}
 
-    for (size_t x = 0; x < VGA_WIDTH; x++) {
-        const size_t index = (VGA_HEIGHT - 1) * VGA_WIDTH + x;
-        vga_buffer[index] = vga_entry(' ', vga_color);
+static void vga_newline() {
+    vga_column = 0;
+    if (++vga_row == console_rows) {
+        vga_scroll();
+        vga_row = console_rows - 1;
     }
 }
 
-void vga_putchar(char c) {
+// Called with vga_lock held
+static void vga_putchar_locked(char c) {
     if (c == '\n') {
-        vga_column = 0;
-        if (++vga_row == VGA_HEIGHT) {
-            vga_scroll();
-            vga_row = VGA_HEIGHT - 1;
-        }
+        vga_newline();
     } else {
         vga_putentryat(c, vga_color, vga_column, vga_row);
-        if (++vga_column == VGA_WIDTH) {
-            vga_column = 0;
-            if (++vga_row == VGA_HEIGHT) {
-                vga_scroll();
-                vga_row = VGA_HEIGHT - 1;
-            }
+        if (++vga_column == console_columns) {
+            vga_newline();
         }
     }
 }
 
+// Called after a write leaves output unflushed, outside vga_lock
+static void notify_dirty() {
+    void (*notify)(void) = __atomic_load_n(&vga_notify, __ATOMIC_ACQUIRE);
+    if (notify && console_dirty) {
+        notify();
+    }
+}
+
+// Output appears at the next vga_flush, which the shell and the log
+// worker call when they finish writing and the notify hook arranges
+// otherwise
+void vga_putchar(char c) {
+    uint64_t flags = spin_lock_irqsave(&vga_lock);
+    vga_putchar_locked(c);
+    spin_unlock_irqrestore(&vga_lock, flags);
+    notify_dirty();
+}
+
 void vga_write(const char* data) {
+    uint64_t flags = spin_lock_irqsave(&vga_lock);
     for (size_t i = 0; data[i] != '\0'; i++)
-        vga_putchar(data[i]);
+        vga_putchar_locked(data[i]);
+    spin_unlock_irqrestore(&vga_lock, flags);
+    notify_dirty();
 }
 
 void vga_writestring(const char* data) {
@@ -83,12 +272,44 @@ void vga_writestring(const char* data) {
 }
 
 void vga_clear() {
-    for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            vga_buffer[index] = vga_entry(' ', vga_color);
-        }
+    uint64_t flags = spin_lock_irqsave(&vga_lock);
+    vga_clear_locked();
+    spin_unlock_irqrestore(&vga_lock, flags);
+    notify_dirty();
+}
+
+// Lets a timer flush output that nobody else flushes, instead of polling
+void vga_set_notify(void (*notify)(void)) {
+    __atomic_store_n(&vga_notify, notify, __ATOMIC_RELEASE);
+}
+
+// Skips the work if nothing changed, or if another CPU is writing; it
+// flushes again when it finishes
+void vga_flush() {
+    if (!console_dirty && drawn_cursor_x == vga_column && drawn_cursor_y == vga_row) {
+        return;
     }
-    vga_row = 0;
-    vga_column = 0;
+    uint64_t flags = lock_irq_save();
+    if (spin_trylock(&vga_lock)) {
+        vga_flush_locked();
+        spin_unlock(&vga_lock);
+    }
+    lock_irq_restore(flags);
+}
+
+// Writes and shows data at once. For panic paths, so it gives up on the
+// lock after a while rather than deadlock on a CPU that died holding it.
+void vga_write_sync(const char* data) {
+    uint64_t flags = lock_irq_save();
+    bool locked = false;
+    for (int attempt = 0; attempt < 1000000 && !locked; attempt++) {
+        locked = spin_trylock(&vga_lock);
+    }
+    for (size_t i = 0; data[i] != '\0'; i++)
+        vga_putchar_locked(data[i]);
+    vga_flush_locked();
+    if (locked) {
+        spin_unlock(&vga_lock);
+    }
+    lock_irq_restore(flags);
 }
@@ -0,0 +1,117 @@
+#include "elf.h"
+#include "filesystem.h"
+#include "string.h"
+#ifndef HOSTED
+#include "vm.h"
+#endif
+
+static uint64_t page_down(uint64_t address) {
+    return address & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+static uint64_t page_up(uint64_t address) {
+    return page_down(address + PAGE_SIZE - 1);
+}
+
+// Reads and checks the headers of path, leaving its PT_LOAD segments in
+// info sorted by address. Only the headers are read, however big the file.
+int elf_parse(const char* path, ElfInfo* info) {
+    FsStat stat;
+    if (fs_stat(path, &stat) < 0) {
+        return ELF_ENOENT;
+    }
+    Elf64Header header;
+    if (fs_pread(path, &header, sizeof(header), 0) != sizeof(header) || header.magic != ELF_MAGIC ||
+        header.elf_class != ELFCLASS64 || header.data != ELFDATA2LSB || header.type != ET_EXEC ||
+        header.machine != EM_X86_64 || header.phentsize != sizeof(Elf64Phdr)) {
+        return ELF_EFORMAT;
+    }
+
+    memset(info, 0, sizeof(ElfInfo));
+    info->entry = header.entry;
+    info->generation = stat.generation;
+    for (int i = 0; i < header.phnum; i++) {
+        Elf64Phdr phdr;
+        if (fs_pread(path, &phdr, sizeof(phdr), header.phoff + i * sizeof(phdr)) != sizeof(phdr)) {
+            return ELF_EFORMAT;
+        }
+        if (phdr.type != PT_LOAD || phdr.memsz == 0) {
+            continue;
+        }
+        if (info->segment_count == ELF_MAX_SEGMENTS) {
+            return ELF_EFORMAT;
+        }
+        if (phdr.filesz > phdr.memsz || phdr.offset > stat.size || phdr.filesz > stat.size - phdr.offset ||
+            phdr.vaddr < ELF_LOAD_BASE || phdr.vaddr >= ELF_LOAD_TOP || phdr.memsz > ELF_LOAD_TOP - phdr.vaddr) {
+            return ELF_ELAYOUT;
+        }
+        int slot = info->segment_count++;
+        while (slot > 0 && info->segments[slot - 1].vaddr > phdr.vaddr) {
+            info->segments[slot] = info->segments[slot - 1];
+            slot--;
+        }
+        info->segments[slot] = phdr;
+    }
+
+    // Each page belongs to one segment, so a fault knows what fills it
+    bool entry_ok = false;
+    for (int i = 0; i < info->segment_count; i++) {
+        Elf64Phdr* segment = &info->segments[i];
+        if (i > 0 && page_down(segment->vaddr) < page_up(segment[-1].vaddr + segment[-1].memsz)) {
+            return ELF_ELAYOUT;
+        }
+        if ((segment->flags & PF_X) && info->entry >= segment->vaddr &&
+            info->entry < segment->vaddr + segment->memsz) {
+            entry_ok = true;
+        }
+    }
+    return entry_ok ? 0 : ELF_EFORMAT;
+}
+
+const char* elf_strerror(int error) {
+    switch (error) {
+    case ELF_ENOENT:
+        return "file not found";
+    case ELF_EFORMAT:
+        return "not a static x86_64 executable";
+    case ELF_ELAYOUT:
+        return "bad segment layout";
+    case ELF_ENOMEM:
+        return "out of memory";
+    default:
+        return "unknown error";
+    }
+}
+
+#ifndef HOSTED
+// Describes path's segments in a new VmSpace for the calling task to adopt.
+// Nothing is mapped or read beyond the headers: the page fault handler
+// loads each page when the program first touches it.
+int elf_load(const char* path, VmSpace** vm, uint64_t* entry) {
+    ElfInfo info;
+    int error = elf_parse(path, &info);
+    if (error < 0) {
+        return error;
+    }
+    VmSpace* space = vm_create(path, info.generation);
+    if (!space) {
+        return ELF_ENOMEM;
+    }
+    for (int i = 0; i < info.segment_count; i++) {
+        Elf64Phdr* segment = &info.segments[i];
+        if (!vm_add_region(space, page_down(segment->vaddr), page_up(segment->vaddr + segment->memsz),
+                           (segment->flags & PF_W) ? PAGE_WRITABLE : 0, segment->vaddr,
+                           segment->offset, segment->filesz)) {
+            vm_destroy(space);
+            return ELF_ENOMEM;
+        }
+    }
+    if (!vm_share_text(space)) {
+        vm_destroy(space);
+        return ELF_ENOMEM;
+    }
+    *vm = space;
+    *entry = info.entry;
+    return 0;
+}
+#endif // HOSTED
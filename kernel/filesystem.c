@@ -1,7 +1,11 @@
 #include "filesystem.h"
 #include "memory.h"
 #include "string.h"
-#include "vga.h"
+#include "log.h"
+#include "compress.h"
+#include "cpu.h"
+#include "rwlock.h"
+#include "seqlock.h"
 
 #define FS_SEEK_SET 0
 #define FS_SEEK_CUR 1
@@ -26,31 +30,197 @@ typedef struct {
 
 static Directory root_directory;
 
+// Decompressed copies of recently read compressed files
+typedef struct {
+    File* file;
+    uint8_t* data;
+    uint32_t last_use;
+} HotCacheSlot;
+
+static HotCacheSlot hot_cache[FS_HOT_CACHE_SLOTS];
+static uint32_t fs_clock = 0;
+static uint32_t fs_generation = 0;
+static uint8_t compress_buffer[LZ_COMPRESS_BOUND(MAX_FILE_SIZE)];
+
+// Guards the files, the directory and the hot cache. Reading a plain file
+// only needs it for reading; anything that may decompress takes it for
+// writing. The ramfs is never used from interrupt context, so interrupts
+// stay on while it is held, however long a whole-file compression takes.
+static rwlock_t fs_lock = RWLOCK_INIT("fs");
+
+// Kept up to date as files are compressed and inflated so fsstat can read
+// them without the fs lock. Only written with fs_lock held for writing.
+static FsCompressionStats compression_stats;
+static seqlock_t stats_lock = SEQLOCK_INIT("fs_stats");
+
+// Concurrent readers may touch files at the same time
+static void fs_touch(File* file) {
+    __atomic_store_n(&file->last_access, __atomic_add_fetch(&fs_clock, 1, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+}
+
+// Adds (sign 1) or removes (sign -1) a compressed file from the totals
+static void account_compressed(File* file, int sign) {
+    uint64_t flags = write_seqlock_irqsave(&stats_lock);
+    compression_stats.compressed_files += sign;
+    compression_stats.logical_bytes += (int64_t)sign * file->size;
+    compression_stats.stored_bytes += (int64_t)sign * file->stored_size;
+    write_sequnlock_irqrestore(&stats_lock, flags);
+}
+
+static File* find_file(const char* filename) {
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(files[i].name, filename) == 0) {
+            return &files[i];
+        }
+    }
+    return NULL;
+}
+
+static void cache_forget(File* file) {
+    for (int i = 0; i < FS_HOT_CACHE_SLOTS; i++) {
+        if (hot_cache[i].file == file) {
+            hot_cache[i].file = NULL;
+        }
+    }
+}
+
+static void cache_move(File* from, File* to) {
+    for (int i = 0; i < FS_HOT_CACHE_SLOTS; i++) {
+        if (hot_cache[i].file == from) {
+            hot_cache[i].file = to;
+        }
+    }
+}
+
+// Returns the uncompressed contents of a file, decompressing into the hot
+// cache if needed. Returns NULL if the compressed data is corrupt.
+static const uint8_t* fs_file_contents(File* file) {
+    if (!file->compressed) {
+        return file->data;
+    }
+
+    HotCacheSlot* victim = NULL;
+    for (int i = 0; i < FS_HOT_CACHE_SLOTS; i++) {
+        HotCacheSlot* slot = &hot_cache[i];
+        if (slot->file == file) {
+            slot->last_use = fs_clock;
+            uint64_t flags = write_seqlock_irqsave(&stats_lock);
+            compression_stats.cache_hits++;
+            write_sequnlock_irqrestore(&stats_lock, flags);
+            return slot->data;
+        }
+        if (!slot->data) {
+            continue;
+        }
+        if (!victim || !slot->file || (victim->file && slot->last_use < victim->last_use)) {
+            victim = slot;
+        }
+    }
+    if (!victim) {
+        log_error(LOG_FS, "Error: No hot cache available\n");
+        return NULL;
+    }
+
+    uint64_t start = rdtsc();
+    int size = lz_decompress(file->data, file->stored_size, victim->data, MAX_FILE_SIZE);
+    uint64_t cycles = rdtsc() - start;
+
+    if (size != (int)file->size) {
+        log_error(LOG_FS, "Error: Corrupt compressed file\n");
+        victim->file = NULL;
+        return NULL;
+    }
+
+    uint64_t flags = write_seqlock_irqsave(&stats_lock);
+    compression_stats.decompressions++;
+    compression_stats.decompress_cycles_total += cycles;
+    if (cycles > compression_stats.decompress_cycles_max) {
+        compression_stats.decompress_cycles_max = cycles;
+    }
+    write_sequnlock_irqrestore(&stats_lock, flags);
+
+    victim->file = file;
+    victim->last_use = fs_clock;
+    return victim->data;
+}
+
+// Gives a compressed file a plain MAX_FILE_SIZE buffer again
+static int fs_inflate(File* file, bool keep_contents) {
+    uint8_t* data = kmalloc(MAX_FILE_SIZE);
+    if (!data) {
+        log_error(LOG_FS, "Error: Failed to allocate memory for file\n");
+        return -1;
+    }
+
+    if (keep_contents) {
+        const uint8_t* contents = fs_file_contents(file);
+        if (!contents) {
+            kfree(data);
+            return -1;
+        }
+        memcpy(data, contents, file->size);
+    }
+
+    cache_forget(file);
+    account_compressed(file, -1);
+    kfree(file->data);
+    file->data = data;
+    file->stored_size = 0;
+    file->compressed = false;
+    return 0;
+}
+
+static int fs_compress_file(File* file) {
+    int packed_size = lz_compress(file->data, file->size, compress_buffer, sizeof(compress_buffer));
+
+    // Not worth keeping unless it saves at least an eighth of the file
+    if (packed_size < 0 || (uint32_t)packed_size >= file->size - file->size / 8) {
+        file->incompressible = true;
+        return -1;
+    }
+
+    uint8_t* packed = kmalloc(packed_size);
+    if (!packed) {
+        return -1;
+    }
+    memcpy(packed, compress_buffer, packed_size);
+
+    kfree(file->data);
+    file->data = packed;
+    file->stored_size = packed_size;
+    file->compressed = true;
+    account_compressed(file, 1);
+    return 0;
+}
+
 void fs_init() {
-    vga_writestring("Initializing filesystem...\n");
+    log_info(LOG_FS, "Initializing filesystem...\n");
     memset(files, 0, sizeof(files));
     memset(&root_directory, 0, sizeof(root_directory));
     file_count = 0;
-    vga_writestring("Filesystem initialized. Max files: ");
-    char max_files_str[10];
-    int_to_string(MAX_FILES, max_files_str);
-    vga_writestring(max_files_str);
-    vga_writestring("\n");
+    fs_clock = 0;
+    memset(&compression_stats, 0, sizeof(compression_stats));
+    for (int i = 0; i < FS_HOT_CACHE_SLOTS; i++) {
+        hot_cache[i].file = NULL;
+        hot_cache[i].last_use = 0;
+        if (!hot_cache[i].data) {
+            hot_cache[i].data = kmalloc(MAX_FILE_SIZE);
+        }
+    }
+    log_info(LOG_FS, "Filesystem initialized. Max files: %d\n", MAX_FILES);
 }
 
-int fs_create(const char* filename) {
-    vga_writestring("Creating file: ");
-    vga_writestring(filename);
-    vga_writestring("\n");
+static int create_file(const char* filename) {
 
     if (file_count >= MAX_FILES) {
-        vga_writestring("Error: Maximum number of files reached\n");
+        log_warn(LOG_FS, "Error: Maximum number of files reached\n");
         return -1;
     }
 
     for (int i = 0; i < file_count; i++) {
         if (strcmp(files[i].name, filename) == 0) {
-            vga_writestring("Error: File already exists\n");
+            log_debug(LOG_FS, "Error: File already exists\n");
             return -2;
         }
     }
@@ -59,9 +229,15 @@ int fs_create(const char* filename) {
     strncpy(file->name, filename, MAX_FILENAME_LENGTH - 1);
     file->name[MAX_FILENAME_LENGTH - 1] = '\0';
     file->size = 0;
+    file->stored_size = 0;
+    file->last_access = fs_clock;
+    file->compressed = false;
+    file->compress_enabled = true;
+    file->incompressible = false;
+    file->generation = ++fs_generation;
     file->data = kmalloc(MAX_FILE_SIZE);
     if (!file->data) {
-        vga_writestring("Error: Failed to allocate memory for file\n");
+        log_error(LOG_FS, "Error: Failed to allocate memory for file\n");
         return -3;
     }
 
@@ -73,79 +249,156 @@ int fs_create(const char* filename) {
         entry->file_index = file_count;
         entry->is_directory = false;
     } else {
-        vga_writestring("Error: Root directory is full\n");
+        log_warn(LOG_FS, "Error: Root directory is full\n");
         kfree(file->data);
         return -4;
     }
 
-    vga_writestring("File created successfully\n");
     return file_count++;
 }
 
-int fs_write(const char* filename, const void* data, size_t size) {
-    vga_writestring("Writing to file: ");
-    vga_writestring(filename);
-    vga_writestring("\n");
+int fs_create(const char* filename) {
+    log_debug(LOG_FS, "Creating file: %s\n", filename);
+    write_lock(&fs_lock);
+    int result = create_file(filename);
+    write_unlock(&fs_lock);
+    if (result >= 0) {
+        log_debug(LOG_FS, "File created successfully\n");
+    }
+    return result;
+}
 
-    File* file = fs_open(filename);
+// Stores size bytes at offset, zero-filling any gap after the old end. With
+// truncate the file ends after them; otherwise it only ever grows.
+static int write_file(const char* filename, const void* data, size_t size, size_t offset, bool truncate) {
+    File* file = find_file(filename);
     if (!file) {
-        vga_writestring("Error: File not found\n");
+        log_debug(LOG_FS, "Error: File not found\n");
         return -1;
     }
-
-    if (size > MAX_FILE_SIZE) {
-        vga_writestring("Warning: Truncating file to maximum size\n");
-        size = MAX_FILE_SIZE;
+    if (offset > MAX_FILE_SIZE) {
+        return -1;
     }
 
-    memcpy(file->data, data, size);
-    file->size = size;
+    if (size > MAX_FILE_SIZE - offset) {
+        log_warn(LOG_FS, "Warning: Truncating file to maximum size\n");
+        size = MAX_FILE_SIZE - offset;
+    }
 
-    vga_writestring("Write successful. Bytes written: ");
-    char size_str[20];
-    int_to_string(size, size_str);
-    vga_writestring(size_str);
-    vga_writestring("\n");
+    // Only a whole-file rewrite can drop the old contents unread
+    if (file->compressed && fs_inflate(file, !(truncate && offset == 0)) < 0) {
+        return -1;
+    }
 
+    if (offset > file->size) {
+        memset(file->data + file->size, 0, offset - file->size);
+    }
+    memcpy(file->data + offset, data, size);
+    if (truncate || offset + size > file->size) {
+        file->size = offset + size;
+    }
+    file->incompressible = false;
+    file->generation = ++fs_generation;
+    fs_touch(file);
     return size;
 }
 
-int fs_read(const char* filename, void* buffer, size_t size) {
-    vga_writestring("Reading from file: ");
-    vga_writestring(filename);
-    vga_writestring("\n");
+int fs_write(const char* filename, const void* data, size_t size) {
+    log_debug(LOG_FS, "Writing to file: %s\n", filename);
+    write_lock(&fs_lock);
+    int result = write_file(filename, data, size, 0, true);
+    write_unlock(&fs_lock);
+    if (result >= 0) {
+        log_debug(LOG_FS, "Write successful. Bytes written: %u\n", (unsigned int)result);
+    }
+    return result;
+}
 
-    File* file = fs_open(filename);
-    if (!file) {
-        vga_writestring("Error: File not found\n");
-        return -1;
+// Writes at offset without truncating, for callers that keep a position
+int fs_pwrite(const char* filename, const void* data, size_t size, size_t offset) {
+    write_lock(&fs_lock);
+    int result = write_file(filename, data, size, offset, false);
+    write_unlock(&fs_lock);
+    return result;
+}
+
+static int read_file(File* file, void* buffer, size_t size, size_t offset) {
+    if (offset >= file->size) {
+        fs_touch(file);
+        return 0;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
     }
 
-    if (size > file->size) {
-        size = file->size;
+    const uint8_t* contents = fs_file_contents(file);
+    if (!contents) {
+        return -1;
     }
+    memcpy(buffer, contents + offset, size);
+    fs_touch(file);
+    return size;
+}
 
-    memcpy(buffer, file->data, size);
+int fs_read(const char* filename, void* buffer, size_t size) {
+    log_debug(LOG_FS, "Reading from file: %s\n", filename);
+    return fs_pread(filename, buffer, size, 0);
+}
 
-    vga_writestring("Read successful. Bytes read: ");
-    char size_str[20];
-    int_to_string(size, size_str);
-    vga_writestring(size_str);
-    vga_writestring("\n");
+// Reads up to size bytes starting at offset; 0 at or past the end
+int fs_pread(const char* filename, void* buffer, size_t size, size_t offset) {
+    // A plain file is copied under the read lock. A compressed one may need
+    // decompressing into the hot cache, so it is looked up again for writing.
+    read_lock(&fs_lock);
+    File* file = find_file(filename);
+    bool plain = file && !file->compressed;
+    int result = plain ? read_file(file, buffer, size, offset) : -1;
+    read_unlock(&fs_lock);
+
+    if (!plain) {
+        write_lock(&fs_lock);
+        file = find_file(filename);
+        result = file ? read_file(file, buffer, size, offset) : -1;
+        write_unlock(&fs_lock);
+    }
 
-    return size;
+    if (!file) {
+        log_debug(LOG_FS, "Error: File not found\n");
+    } else if (result >= 0) {
+        log_debug(LOG_FS, "Read successful. Bytes read: %u\n", (unsigned int)result);
+    }
+    return result;
+}
+
+// Size and generation without reading the contents; -1 if there is no such
+// file. Callers that cache what they read compare generations to notice
+// later writes.
+int fs_stat(const char* filename, FsStat* stat) {
+    read_lock(&fs_lock);
+    File* file = find_file(filename);
+    if (file) {
+        stat->size = file->size;
+        stat->generation = file->generation;
+        stat->compressed = file->compressed;
+    }
+    read_unlock(&fs_lock);
+    return file ? 0 : -1;
 }
 
 int fs_delete(const char* filename) {
-    vga_writestring("Deleting file: ");
-    vga_writestring(filename);
-    vga_writestring("\n");
+    log_debug(LOG_FS, "Deleting file: %s\n", filename);
 
+    write_lock(&fs_lock);
     for (int i = 0; i < file_count; i++) {
         if (strcmp(files[i].name, filename) == 0) {
+            cache_forget(&files[i]);
+            if (files[i].compressed) {
+                account_compressed(&files[i], -1);
+            }
             kfree(files[i].data);
             if (i < file_count - 1) {
                 files[i] = files[file_count - 1];
+                cache_move(&files[file_count - 1], &files[i]);
             }
             file_count--;
 
@@ -159,19 +412,22 @@ int fs_delete(const char* filename) {
                     break;
                 }
             }
+            write_unlock(&fs_lock);
 
-            vga_writestring("File deleted successfully\n");
+            log_debug(LOG_FS, "File deleted successfully\n");
             return 0;
         }
     }
+    write_unlock(&fs_lock);
 
-    vga_writestring("Error: File not found\n");
+    log_debug(LOG_FS, "Error: File not found\n");
     return -1;
 }
 
 void fs_list(char* buffer, size_t buffer_size) {
-    vga_writestring("Listing files and directories...\n");
+    log_debug(LOG_FS, "Listing files and directories...\n");
     size_t offset = 0;
+    read_lock(&fs_lock);
     for (int i = 0; i < root_directory.entry_count && offset < buffer_size - 1; i++) {
         DirectoryEntry* entry = &root_directory.entries[i];
         int written = snprintf(buffer + offset, buffer_size - offset,
@@ -185,17 +441,20 @@ void fs_list(char* buffer, size_t buffer_size) {
             break;
         }
     }
+    read_unlock(&fs_lock);
     buffer[offset] = '\0';
-    vga_writestring("File and directory list generated\n");
+    log_debug(LOG_FS, "File and directory list generated\n");
 }
 
+// Only a snapshot: the pointer is returned after fs_lock is dropped, and
+// fs_delete moves the last File into the deleted one's slot, so deleting
+// any file may make it describe another. Use it to check that a file
+// exists, and the name-based calls for anything else.
 File* fs_open(const char* filename) {
-    for (int i = 0; i < file_count; i++) {
-        if (strcmp(files[i].name, filename) == 0) {
-            return &files[i];
-        }
-    }
-    return NULL;
+    read_lock(&fs_lock);
+    File* file = find_file(filename);
+    read_unlock(&fs_lock);
+    return file;
 }
 
 void fs_close(File* file) {
@@ -240,19 +499,15 @@ int fs_tell(File* file) {
     return 0; // In this simple implementation, we always return 0
 }
 
-int fs_mkdir(const char* dirname) {
-    vga_writestring("Creating directory: ");
-    vga_writestring(dirname);
-    vga_writestring("\n");
-
+static int create_directory(const char* dirname) {
     if (root_directory.entry_count >= MAX_DIRECTORY_ENTRIES) {
-        vga_writestring("Error: Root directory is full\n");
+        log_warn(LOG_FS, "Error: Root directory is full\n");
         return -1;
     }
 
     for (int i = 0; i < root_directory.entry_count; i++) {
         if (strcmp(root_directory.entries[i].name, dirname) == 0) {
-            vga_writestring("Error: Directory or file already exists\n");
+            log_debug(LOG_FS, "Error: Directory or file already exists\n");
             return -2;
         }
     }
@@ -262,7 +517,77 @@ int fs_mkdir(const char* dirname) {
     new_dir->name[MAX_FILENAME_LENGTH - 1] = '\0';
     new_dir->is_directory = true;
     new_dir->file_index = -1;  // Directories don't have a file index
-
-    vga_writestring("Directory created successfully\n");
     return 0;
 }
+
+int fs_mkdir(const char* dirname) {
+    log_debug(LOG_FS, "Creating directory: %s\n", dirname);
+    write_lock(&fs_lock);
+    int result = create_directory(dirname);
+    write_unlock(&fs_lock);
+    if (result == 0) {
+        log_debug(LOG_FS, "Directory created successfully\n");
+    }
+    return result;
+}
+
+int fs_set_compression(const char* filename, bool enabled) {
+    write_lock(&fs_lock);
+    File* file = find_file(filename);
+    int result = file ? 0 : -1;
+    if (file) {
+        file->compress_enabled = enabled;
+        if (!enabled && file->compressed) {
+            result = fs_inflate(file, true);
+        }
+    }
+    write_unlock(&fs_lock);
+
+    if (!file) {
+        log_debug(LOG_FS, "Error: File not found\n");
+    }
+    return result;
+}
+
+// Called with fs_lock held for writing
+static bool compress_if_cold(File* file) {
+    if (file->compressed || !file->compress_enabled || file->incompressible || file->size == 0) {
+        return false;
+    }
+    if (fs_clock - file->last_access < FS_COLD_AGE) {
+        return false;
+    }
+    return fs_compress_file(file) == 0;
+}
+
+// Compresses up to max_files files that have not been accessed recently.
+// Meant to be called from a background task. Returns the number compressed.
+int fs_compress_cold(int max_files) {
+    int compressed = 0;
+    write_lock(&fs_lock);
+    for (int i = 0; i < file_count && compressed < max_files; i++) {
+        if (compress_if_cold(&files[i])) {
+            compressed++;
+        }
+    }
+    write_unlock(&fs_lock);
+    return compressed;
+}
+
+// fs_compress_cold for one file: 1 if it was compressed, 0 if it is not
+// cold or does not compress, -1 if there is no such file
+int fs_compress_if_cold(const char* filename) {
+    write_lock(&fs_lock);
+    File* file = find_file(filename);
+    int result = file ? compress_if_cold(file) : -1;
+    write_unlock(&fs_lock);
+    return result;
+}
+
+void fs_get_compression_stats(FsCompressionStats* stats) {
+    uint32_t sequence;
+    do {
+        sequence = read_seqbegin(&stats_lock);
+        *stats = compression_stats;
+    } while (read_seqretry(&stats_lock, sequence));
+}
@@ -0,0 +1,191 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "log.h"
+#include "memory.h"
+#include "smp.h"
+#include "string.h"
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_OSXSAVE (1 << 18)
+
+#define CPUID_ECX_XSAVE (1 << 26)
+#define CPUID_ECX_AVX (1 << 28)
+#define CPUID_XSAVE_LEAF 0x0D
+#define CPUID_XSAVEOPT (1 << 0) // Leaf 0x0D, subleaf 1, EAX
+
+// XCR0 state components
+#define XFEATURE_X87 (1 << 0)
+#define XFEATURE_SSE (1 << 1)
+#define XFEATURE_AVX (1 << 2)
+#define XFEATURE_AVX512 (7 << 5) // Opmask, ZMM_Hi256 and Hi16_ZMM go together
+
+#define FXSAVE_SIZE 512
+#define FPU_STATE_ALIGN 64
+#define FCW_DEFAULT 0x037F   // x87 exceptions masked, extended precision
+#define MXCSR_DEFAULT 0x1F80 // SSE exceptions masked, round to nearest
+#define MXCSR_OFFSET 24
+
+typedef enum {
+    FPU_FXSAVE,
+    FPU_XSAVE,
+    FPU_XSAVEOPT    // XSAVE that skips components unchanged since XRSTOR
+} FpuSaveMode;
+
+static const char* save_mode_names[] = { "fxsave", "xsave", "xsaveopt" };
+
+static FpuSaveMode save_mode = FPU_FXSAVE;
+static uint64_t xfeatures = XFEATURE_X87 | XFEATURE_SSE;
+static uint32_t state_size = FXSAVE_SIZE;
+
+static void save_state(uint8_t* area) {
+    uint32_t lo = (uint32_t)xfeatures;
+    uint32_t hi = (uint32_t)(xfeatures >> 32);
+    switch (save_mode) {
+    case FPU_XSAVEOPT:
+        __asm__ volatile("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_XSAVE:
+        __asm__ volatile("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_FXSAVE:
+        __asm__ volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+        break;
+    }
+}
+
+static void restore_state(uint8_t* area) {
+    uint32_t lo = (uint32_t)xfeatures;
+    uint32_t hi = (uint32_t)(xfeatures >> 32);
+    if (save_mode == FPU_FXSAVE) {
+        __asm__ volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+    } else {
+        __asm__ volatile("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    }
+}
+
+static inline void clts() {
+    __asm__ volatile("clts" ::: "memory");
+}
+
+static inline void stts() {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+// A zeroed XSAVE header marks every component as in its initial state, so
+// only the control words need filling in; FXRSTOR reads them directly
+static bool alloc_state(Task* task) {
+    uint8_t* block = kmalloc(state_size + FPU_STATE_ALIGN);
+    if (!block) {
+        return false;
+    }
+    uint8_t* area = (uint8_t*)(((uint64_t)block + FPU_STATE_ALIGN - 1) & ~(uint64_t)(FPU_STATE_ALIGN - 1));
+    memset(area, 0, state_size);
+    *(uint16_t*)area = FCW_DEFAULT;
+    *(uint32_t*)(area + MXCSR_OFFSET) = MXCSR_DEFAULT;
+    task->fpu_block = block;
+    task->fpu_state = area;
+    return true;
+}
+
+// #NM: the current task used the FPU while CR0.TS was set. Whatever is in
+// the registers was saved when its owner was switched out.
+static void fpu_trap(InterruptFrame* frame) {
+    (void)frame;
+    Cpu* cpu = this_cpu();
+    Task* task = cpu->current;
+
+    clts();
+    if (!task->fpu_state && !alloc_state(task)) {
+        log_error(LOG_TASK, "Error: Out of memory for %s's FPU state\n", task->name);
+        stts();
+        task_exit();
+    }
+    restore_state(task->fpu_state);
+    task->fpu_cpu = cpu->id;
+    cpu->fpu_owner = task;
+    cpu->fpu_restores++;
+}
+
+// Picks the save format and the state components once, on the BSP
+void fpu_init() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    bool has_avx = ecx & CPUID_ECX_AVX;
+    if (ecx & CPUID_ECX_XSAVE) {
+        uint32_t supported_lo, supported_hi;
+        cpuid(CPUID_XSAVE_LEAF, 0, &supported_lo, &ebx, &ecx, &supported_hi);
+        uint64_t supported = ((uint64_t)supported_hi << 32) | supported_lo;
+
+        xfeatures = XFEATURE_X87 | XFEATURE_SSE;
+        if (has_avx && (supported & XFEATURE_AVX)) {
+            xfeatures |= XFEATURE_AVX;
+            if ((supported & XFEATURE_AVX512) == XFEATURE_AVX512) {
+                xfeatures |= XFEATURE_AVX512;
+            }
+        }
+        cpuid(CPUID_XSAVE_LEAF, 1, &eax, &ebx, &ecx, &edx);
+        save_mode = (eax & CPUID_XSAVEOPT) ? FPU_XSAVEOPT : FPU_XSAVE;
+    }
+    fpu_init_cpu();
+
+    if (save_mode != FPU_FXSAVE) {
+        // With XCR0 set, EBX is the area size for exactly those components
+        cpuid(CPUID_XSAVE_LEAF, 0, &eax, &ebx, &ecx, &edx);
+        state_size = ebx;
+    }
+    register_interrupt_handler(FPU_VECTOR, fpu_trap);
+    log_info(LOG_KERNEL, "FPU: %s, %u-byte state, XCR0 %llx\n",
+             save_mode_names[save_mode], state_size, xfeatures);
+}
+
+// Enables SSE (and XSAVE) on this CPU and arms the #NM trap
+void fpu_init_cpu() {
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT |
+              (save_mode != FPU_FXSAVE ? CR4_OSXSAVE : 0));
+    if (save_mode != FPU_FXSAVE) {
+        xsetbv(0, xfeatures);
+    }
+    write_cr0((read_cr0() & ~(uint64_t)CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+    this_cpu()->fpu_owner = NULL;
+}
+
+// Called by the scheduler with interrupts off, before switching stacks.
+// TS clear means prev has used its registers since it was switched in.
+void fpu_switch(Task* prev, Task* next) {
+    Cpu* cpu = this_cpu();
+    if (!(read_cr0() & CR0_TS) && prev->state != TASK_DEAD) {
+        save_state(prev->fpu_state);
+        cpu->fpu_saves++;
+    }
+
+    // Switching back to the last user of this CPU's registers, with no
+    // other CPU having loaded its state since, needs no restore at all
+    if (cpu->fpu_owner == next && next->fpu_cpu == cpu->id) {
+        clts();
+    } else {
+        stts();
+    }
+}
+
+void fpu_task_free(Task* task) {
+    kfree(task->fpu_block);
+    task->fpu_block = NULL;
+    task->fpu_state = NULL;
+}
+
+void fpu_info(char* buffer, size_t buffer_size) {
+    size_t offset = snprintf(buffer, buffer_size, "FPU: %s, %u-byte state, XCR0 %llx\n"
+                             "CPU    SAVES  RESTORES\n",
+                             save_mode_names[save_mode], state_size, xfeatures);
+    for (int i = 0; i < smp_cpu_count() && offset < buffer_size - 1; i++) {
+        Cpu* cpu = smp_cpu(i);
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-3d %9llu %9llu\n",
+                           cpu->id, cpu->fpu_saves, cpu->fpu_restores);
+    }
+}
@@ -0,0 +1,280 @@
+// Hosted unit tests and microbenchmarks for the allocator, heap, ramfs and
+// string code. Built and run by `make hosted-bench`.
+#include <stdio.h>
+#include <time.h>
+
+#include "memory.h"
+#include "filesystem.h"
+#include "string.h"
+#include "compress.h"
+#include "selftest.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "ring.h"
+
+#define TOTAL_MEMORY_SIZE (1024 * 1024 * 1024)
+
+static uint8_t text_block[MAX_FILE_SIZE];
+static uint8_t random_block[MAX_FILE_SIZE];
+static uint8_t scratch[LZ_COMPRESS_BOUND(MAX_FILE_SIZE)];
+static uint8_t scratch2[MAX_FILE_SIZE];
+static int packed_text_size;
+static void* held_blocks[128];
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char* message) {
+    fputs(message, stdout);
+}
+
+static void bench(const char* name, void (*op)(void), long iterations) {
+    MemoryInfo before, after;
+
+    op(); // Warm up
+    get_memory_info(&before);
+    uint64_t start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        op();
+    }
+    uint64_t elapsed = now_ns() - start;
+    get_memory_info(&after);
+
+    printf("  %-32s %10.1f ns/op %8.2f allocs/op\n", name,
+           (double)elapsed / iterations,
+           (double)(after.heap_allocs - before.heap_allocs) / iterations);
+}
+
+static void op_kmalloc_free_small() {
+    kfree(kmalloc(64));
+}
+
+static void op_kmalloc_free_page() {
+    kfree(kmalloc(PAGE_SIZE));
+}
+
+// Allocation with a fragmented free list in front of the first fit
+static void op_kmalloc_free_fragmented() {
+    kfree(kmalloc(512));
+}
+
+static void op_physical_page() {
+    free_physical_page(allocate_physical_page());
+}
+
+static void op_fs_write_4k() {
+    fs_write("bench.txt", text_block, MAX_FILE_SIZE);
+}
+
+static void op_fs_read_4k() {
+    fs_read("bench.txt", scratch2, MAX_FILE_SIZE);
+}
+
+static void op_fs_read_compressed() {
+    fs_read("bench_cold.txt", scratch2, MAX_FILE_SIZE);
+}
+
+static void op_fs_create_delete() {
+    fs_create("bench_tmp.txt");
+    fs_delete("bench_tmp.txt");
+}
+
+static void op_lz_compress_text() {
+    lz_compress(text_block, MAX_FILE_SIZE, scratch, sizeof(scratch));
+}
+
+static void op_lz_compress_random() {
+    lz_compress(random_block, MAX_FILE_SIZE, scratch, sizeof(scratch));
+}
+
+static void op_lz_decompress_text() {
+    lz_decompress(scratch, packed_text_size, scratch2, sizeof(scratch2));
+}
+
+static void op_memcpy_4k() {
+    memcpy(scratch2, text_block, MAX_FILE_SIZE);
+}
+
+static void op_memset_4k() {
+    memset(scratch2, 0, MAX_FILE_SIZE);
+}
+
+static void op_strlen_64() {
+    static const char s[] = "a string of sixty-four characters used by the strlen benchmark!";
+    volatile size_t n = strlen(s);
+    (void)n;
+}
+
+static void op_strcmp_equal() {
+    volatile int r = strcmp("ramfs/benchmark/file.txt", "ramfs/benchmark/file.txt");
+    (void)r;
+}
+
+static spinlock_t bench_spin = SPINLOCK_INIT("bench");
+static mcs_lock_t bench_mcs = MCS_LOCK_INIT("bench_mcs");
+static rwlock_t bench_rw = RWLOCK_INIT("bench_rw");
+static uint64_t ring_storage[64];
+static uint32_t ring_sequence[64];
+static SpscRing bench_spsc;
+static MpscRing bench_mpsc;
+
+static void op_spin_lock_unlock() {
+    spin_lock(&bench_spin);
+    spin_unlock(&bench_spin);
+}
+
+static void op_mcs_lock_unlock() {
+    McsNode node;
+    mcs_lock(&bench_mcs, &node);
+    mcs_unlock(&bench_mcs, &node);
+}
+
+static void op_read_lock_unlock() {
+    read_lock(&bench_rw);
+    read_unlock(&bench_rw);
+}
+
+static void op_spsc_push_pop() {
+    uint64_t value = 42;
+    spsc_push(&bench_spsc, &value);
+    spsc_pop(&bench_spsc, &value);
+}
+
+static void op_mpsc_push_pop() {
+    uint64_t value = 42;
+    mpsc_push(&bench_mpsc, &value);
+    mpsc_pop(&bench_mpsc, &value);
+}
+
+typedef struct {
+    const char* name;
+    void* (*copy)(void* dest, const void* src, size_t n);
+    void* (*set)(void* s, int c, size_t n);
+    bool available;
+} StringVariant;
+
+static uint8_t sweep_src[1 << 20];
+static uint8_t sweep_dst[1 << 20];
+
+// GB/s for each variant at sizes from 8 B to 1 MiB, each timed over about
+// 64 MiB of traffic
+static void string_sweep() {
+    StringVariant variants[] = {
+        { "bytes", memcpy_bytes, memset_bytes, true },
+        { "words", memcpy_words, memset_words, true },
+        { "erms", memcpy_erms, memset_erms, string_has_erms() },
+        { "sse2", memcpy_sse2, memset_sse2, true },
+        { "avx2", memcpy_avx2, memset_avx2, string_has_avx2() },
+    };
+    static const size_t sizes[] = { 8, 64, 512, 4096, 32768, 262144, 1 << 20 };
+    int count = sizeof(variants) / sizeof(variants[0]);
+
+    for (int op = 0; op < 2; op++) {
+        printf("  %-8s", op == 0 ? "memcpy" : "memset");
+        for (int v = 0; v < count; v++) {
+            printf(" %8s", variants[v].name);
+        }
+        printf("   (GB/s; dispatch: %s)\n", string_variant());
+
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t size = sizes[s];
+            printf("  %-8zu", size);
+            for (int v = 0; v < count; v++) {
+                if (!variants[v].available) {
+                    printf(" %8s", "-");
+                    continue;
+                }
+                long iterations = (64L << 20) / size;
+                uint64_t start = now_ns();
+                for (long i = 0; i < iterations; i++) {
+                    if (op == 0) {
+                        variants[v].copy(sweep_dst, sweep_src, size);
+                    } else {
+                        variants[v].set(sweep_dst, (int)i, size);
+                    }
+                    __asm__ volatile("" : : : "memory");
+                }
+                uint64_t elapsed = now_ns() - start;
+                printf(" %8.2f", (double)size * iterations / elapsed);
+            }
+            printf("\n");
+        }
+    }
+}
+
+static void setup_data() {
+    uint32_t seed = 12345;
+    for (int i = 0; i < MAX_FILE_SIZE; i++) {
+        text_block[i] = "Zernel ramfs benchmark text. "[i % 29];
+        seed = seed * 1103515245 + 12345;
+        random_block[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+int main() {
+    string_init();
+    init_physical_memory(TOTAL_MEMORY_SIZE);
+    init_virtual_memory();
+    init_heap();
+    fs_init();
+    setup_data();
+
+    printf("Unit tests:\n");
+    int failures = run_selftests(report);
+
+    printf("Benchmarks:\n");
+    bench("kmalloc+kfree 64B", op_kmalloc_free_small, 1000000);
+    bench("kmalloc+kfree 4KiB", op_kmalloc_free_page, 1000000);
+
+    // Leave every other block held so the free list has 64 holes to skip
+    for (int i = 0; i < 128; i++) {
+        held_blocks[i] = kmalloc(256);
+    }
+    for (int i = 0; i < 128; i += 2) {
+        kfree(held_blocks[i]);
+    }
+    bench("kmalloc+kfree 512B fragmented", op_kmalloc_free_fragmented, 200000);
+    for (int i = 1; i < 128; i += 2) {
+        kfree(held_blocks[i]);
+    }
+
+    bench("physical page alloc+free", op_physical_page, 1000000);
+
+    fs_create("bench.txt");
+    bench("fs_write 4KiB", op_fs_write_4k, 200000);
+    bench("fs_read 4KiB", op_fs_read_4k, 200000);
+
+    fs_create("bench_cold.txt");
+    fs_write("bench_cold.txt", text_block, MAX_FILE_SIZE);
+    for (int i = 0; i < FS_COLD_AGE; i++) {
+        fs_read("bench.txt", scratch2, 1);
+    }
+    fs_compress_cold(MAX_FILES);
+    bench("fs_read 4KiB compressed (hot)", op_fs_read_compressed, 200000);
+    bench("fs_create+fs_delete", op_fs_create_delete, 200000);
+
+    packed_text_size = lz_compress(text_block, MAX_FILE_SIZE, scratch, sizeof(scratch));
+    bench("lz_decompress 4KiB text", op_lz_decompress_text, 200000);
+    bench("lz_compress 4KiB text", op_lz_compress_text, 100000);
+    bench("lz_compress 4KiB random", op_lz_compress_random, 100000);
+
+    bench("memcpy 4KiB", op_memcpy_4k, 200000);
+    bench("memset 4KiB", op_memset_4k, 200000);
+    bench("strlen 64B", op_strlen_64, 1000000);
+    bench("strcmp 24B equal", op_strcmp_equal, 1000000);
+    string_sweep();
+
+    // Uncontended costs: one process, so these are the single-atomic fast paths
+    spsc_init(&bench_spsc, ring_storage, sizeof(uint64_t), 64);
+    mpsc_init(&bench_mpsc, ring_storage, ring_sequence, sizeof(uint64_t), 64);
+    bench("spin_lock+unlock", op_spin_lock_unlock, 10000000);
+    bench("mcs_lock+unlock", op_mcs_lock_unlock, 10000000);
+    bench("read_lock+unlock", op_read_lock_unlock, 10000000);
+    bench("spsc push+pop 8B", op_spsc_push_pop, 10000000);
+    bench("mpsc push+pop 8B", op_mpsc_push_pop, 10000000);
+
+    return failures ? 1 : 0;
+}
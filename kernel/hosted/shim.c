@@ -0,0 +1,60 @@
+// Host-side stand-ins for the hardware that memory.c, filesystem.c and
+// string.c touch, so they can run as an ordinary process.
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HOSTED_BITMAP_WORDS 32768
+#define HOSTED_HEAP_SIZE 0x400000
+
+uint64_t hosted_phys_bitmap[HOSTED_BITMAP_WORDS];
+uint8_t hosted_heap[HOSTED_HEAP_SIZE] __attribute__((aligned(4096)));
+
+// Console output is dropped unless a test turns it on
+bool hosted_console_enabled = false;
+uint64_t hosted_pages_mapped = 0;
+
+static uint64_t hosted_cr3 = 0x1000;
+
+void vga_write(const char* data) {
+    if (hosted_console_enabled) {
+        fputs(data, stdout);
+    }
+}
+
+void vga_writestring(const char* data) {
+    vga_write(data);
+}
+
+void vga_flush() {
+}
+
+void serial_write(const char* str) {
+    vga_write(str);
+}
+
+uint64_t read_cr3() {
+    return hosted_cr3;
+}
+
+void write_cr3(uint64_t value) {
+    hosted_cr3 = value;
+}
+
+void map_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags) {
+    (void)virtual_addr;
+    (void)physical_addr;
+    (void)flags;
+    hosted_pages_mapped++;
+}
+
+void unmap_page(uint64_t virtual_addr) {
+    (void)virtual_addr;
+}
+
+uint64_t get_physical_address(uint64_t virtual_addr) {
+    return virtual_addr;
+}
+
+void init_virtual_memory() {
+}
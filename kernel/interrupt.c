@@ -0,0 +1,186 @@
+#include "interrupt.h"
+#include "apic.h"
+#include "cpu.h"
+#include "io.h"
+#include "softirq.h"
+#include "string.h"
+#include "task.h"
+#include "timer.h"
+#include "user.h"
+#include "vga.h"
+#include "serial.h"
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+
+#define KERNEL_CODE_SELECTOR 0x08
+#define IDT_INTERRUPT_GATE 0x8E // Present, DPL 0, 64-bit interrupt gate
+
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t type_attr;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t zero;
+} __attribute__((packed)) IdtEntry;
+
+typedef struct {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed)) IdtPointer;
+
+static IdtEntry idt[IDT_ENTRIES];
+static interrupt_handler_t handlers[IDT_ENTRIES];
+static uint16_t pic_mask = 0xFFFF;
+
+extern uint64_t isr_stub_table[IDT_ENTRIES];
+
+static const char* exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow", "Bound range",
+    "Invalid opcode", "Device not available", "Double fault", "Coprocessor overrun",
+    "Invalid TSS", "Segment not present", "Stack fault", "General protection",
+    "Page fault", "Reserved", "x87 FP error", "Alignment check", "Machine check",
+    "SIMD FP error", "Virtualization", "Control protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved", "Hypervisor injection",
+    "VMM communication", "Security", "Reserved"
+};
+
+static void idt_set_gate(uint8_t vector, uint64_t handler) {
+    IdtEntry* entry = &idt[vector];
+    entry->offset_low = handler & 0xFFFF;
+    entry->selector = KERNEL_CODE_SELECTOR;
+    entry->ist = 0;
+    entry->type_attr = IDT_INTERRUPT_GATE;
+    entry->offset_mid = (handler >> 16) & 0xFFFF;
+    entry->offset_high = handler >> 32;
+    entry->zero = 0;
+}
+
+static void pic_write_mask() {
+    outb(PIC1_DATA, pic_mask & 0xFF);
+    outb(PIC2_DATA, pic_mask >> 8);
+}
+
+// Move the PIC's IRQs off the CPU exception vectors and mask them all
+static void pic_remap() {
+    outb(PIC1_COMMAND, 0x11); // ICW1: initialize, expect ICW4
+    io_wait();
+    outb(PIC2_COMMAND, 0x11);
+    io_wait();
+    outb(PIC1_DATA, IRQ_BASE);     // ICW2: vector offsets
+    io_wait();
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    io_wait();
+    outb(PIC1_DATA, 0x04);         // ICW3: slave on IRQ2
+    io_wait();
+    outb(PIC2_DATA, 0x02);
+    io_wait();
+    outb(PIC1_DATA, 0x01);         // ICW4: 8086 mode
+    io_wait();
+    outb(PIC2_DATA, 0x01);
+    io_wait();
+
+    pic_mask = 0xFFFF & ~(1 << 2); // Keep the cascade line open
+    pic_write_mask();
+}
+
+void pic_mask_irq(uint8_t irq) {
+    pic_mask |= 1 << irq;
+    pic_write_mask();
+}
+
+void pic_unmask_irq(uint8_t irq) {
+    pic_mask &= ~(1 << irq);
+    pic_write_mask();
+}
+
+static void pic_send_eoi(uint8_t irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+// Unhandled CPU exceptions are fatal: report them directly, bypassing the
+// log ring, and stop
+static void exception_panic(InterruptFrame* frame) {
+    uint64_t fault_address = 0;
+    if (frame->vector == 14) {
+        __asm__ volatile("mov %%cr2, %0" : "=r"(fault_address));
+    }
+
+    char buffer[200];
+    snprintf(buffer, sizeof(buffer),
+             "\nKERNEL PANIC: %s (vector %u, error %x)\n  rip=%p rsp=%p cr2=%p%s\n",
+             exception_names[frame->vector], (unsigned int)frame->vector,
+             (unsigned int)frame->error_code, (void*)frame->rip, (void*)frame->rsp,
+             (void*)fault_address,
+             task_is_stack_guard(fault_address) ? " (kernel stack overflow)" : "");
+    vga_write_sync(buffer);
+    serial_write_polled(buffer);
+    while (1) {
+        interrupts_disable();
+        cpu_halt();
+    }
+}
+
+void init_interrupts() {
+    memset(idt, 0, sizeof(idt));
+    memset(handlers, 0, sizeof(handlers));
+    for (int vector = 0; vector < IDT_ENTRIES; vector++) {
+        idt_set_gate(vector, isr_stub_table[vector]);
+    }
+
+    // A double fault runs on its own stack: the usual cause is a kernel
+    // stack overflow, which leaves nothing to push the frame onto
+    idt[8].ist = IST_DOUBLE_FAULT;
+
+    pic_remap();
+    idt_load();
+}
+
+// Every CPU shares the one IDT
+void idt_load() {
+    IdtPointer idt_pointer = { sizeof(idt) - 1, (uint64_t)idt };
+    __asm__ volatile("lidt %0" : : "m"(idt_pointer));
+}
+
+void register_interrupt_handler(uint8_t vector, interrupt_handler_t handler) {
+    handlers[vector] = handler;
+}
+
+// Entered from isr_common with interrupts disabled
+void interrupt_dispatch(InterruptFrame* frame) {
+    uint64_t vector = frame->vector;
+
+    if (vector >= IRQ_BASE) {
+        timer_irq_enter();
+    }
+    if (handlers[vector]) {
+        handlers[vector](frame);
+    } else if (vector < 32 && (frame->cs & 3)) {
+        user_fault(frame);
+    } else if (vector < 32) {
+        exception_panic(frame);
+    }
+
+    // Acknowledge before a possible task switch so the controller keeps
+    // delivering interrupts to whichever task runs next
+    if (vector >= IRQ_BASE && vector < IRQ_BASE + IRQ_COUNT) {
+        pic_send_eoi(vector - IRQ_BASE);
+    } else if (vector >= IRQ_BASE + IRQ_COUNT && vector != SPURIOUS_VECTOR && lapic_enabled()) {
+        lapic_eoi();
+    }
+
+    // Bottom halves run after device and IPI interrupts, and only if the
+    // interrupted code had interrupts on, so never inside a critical section
+    if (vector >= IRQ_BASE && (frame->rflags & RFLAGS_IF)) {
+        do_softirq();
+    }
+    preempt_check();
+}
@@ -0,0 +1,84 @@
+global isr_stub_table
+extern interrupt_dispatch
+
+section .text
+bits 64
+
+; Every vector gets a stub that pushes a dummy error code (unless the CPU
+; pushed a real one) and the vector number, then joins isr_common.
+%assign vector 0
+%rep 256
+isr_stub_%+vector:
+%if vector = 8 || vector = 10 || vector = 11 || vector = 12 || vector = 13 || vector = 14 || vector = 17 || vector = 21 || vector = 29 || vector = 30
+    push qword vector
+%else
+    push qword 0
+    push qword vector
+%endif
+    jmp isr_common
+%assign vector vector + 1
+%endrep
+
+; Saves the full register state as an InterruptFrame and calls
+; interrupt_dispatch(frame). The dispatcher may switch tasks, in which case
+; this returns much later on the same stack. Interrupts from user mode
+; (the saved CS at RPL 3) swap in the kernel GS on the way in and back out.
+isr_common:
+    test qword [rsp+24], 3
+    jz .from_kernel
+    swapgs
+.from_kernel:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    cld
+    mov rdi, rsp        ; InterruptFrame*
+    mov rbx, rsp        ; rbx is preserved across the call
+    and rsp, ~0xF       ; SysV requires a 16-byte aligned stack at the call
+    call interrupt_dispatch
+    mov rsp, rbx
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+
+    add rsp, 16         ; Drop vector and error code
+    test qword [rsp+8], 3
+    jz .to_kernel
+    swapgs
+.to_kernel:
+    iretq
+
+section .rodata
+align 8
+isr_stub_table:
+%assign vector 0
+%rep 256
+    dq isr_stub_%+vector
+%assign vector vector + 1
+%endrep
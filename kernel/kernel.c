@@ -1,79 +1,203 @@
 #include "kernel.h"
 #include "vga.h"
+#include "framebuffer.h"
 #include "serial.h"
 #include "keyboard.h"
 #include "string.h"
 #include "task.h"
 #include "memory.h"
 #include "filesystem.h"
+#include "log.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "cpu.h"
+#include "io.h"
+#include "multiboot.h"
+#include "acpi.h"
+#include "smp.h"
+#include "fpu.h"
+#include "lockdep.h"
+#include "wait.h"
+#include "softirq.h"
+#include "workqueue.h"
+#include "clock.h"
+#include "ktimer.h"
+#include "syscall.h"
+#include "vdso.h"
+#include "user.h"
+#include "boottime.h"
 
 #define TOTAL_MEMORY_SIZE (1024 * 1024 * 1024) // Assume 1GB of RAM
+#define QEMU_DEBUG_EXIT_PORT 0xF4 // -device isa-debug-exit,iobase=0xf4
+#define FS_COMPRESS_INTERVAL_MS 100
 
 void log_message(const char *message)
 {
-    vga_write(message);    // Write to VGA console
-    serial_write(message); // Write to serial port
+    log_info(LOG_KERNEL, "%s", message); // Queued; log_work writes it out
 }
 
 void print_memory_info() {
     MemoryInfo info;
     get_memory_info(&info);
-    char buffer[256];
-    snprintf(buffer, sizeof(buffer),
-             "Memory Info:\n"
-             "  Total: %llu bytes\n"
-             "  Free:  %llu bytes\n"
-             "  Used:  %llu bytes\n"
-             "  Reserved: %llu bytes\n",
-             info.total_memory, info.free_memory,
-             info.used_memory, info.reserved_memory);
-    log_message(buffer);
+    log_info(LOG_MEM, "Memory Info:\n");
+    log_info(LOG_MEM, "  Total: %llu bytes\n", info.total_memory);
+    log_info(LOG_MEM, "  Free:  %llu bytes\n", info.free_memory);
+    log_info(LOG_MEM, "  Used:  %llu bytes\n", info.used_memory);
+    log_info(LOG_MEM, "  Reserved: %llu bytes\n", info.reserved_memory);
 }
 
 void task1() {
     while (1) {
-        log_message("Task 1 running\n");
-        for (volatile int i = 0; i < 1000000; i++) {} // Delay
-        yield();
+        log_debug(LOG_TASK, "Task 1 running\n");
+        sleep_ms(1000);
     }
 }
 
 void task2() {
     while (1) {
-        log_message("Task 2 running\n");
-        for (volatile int i = 0; i < 1000000; i++) {} // Delay
-        yield();
+        log_debug(LOG_TASK, "Task 2 running\n");
+        sleep_ms(1000);
     }
 }
 
-void kernel_main()
+// Background compression of files that have gone cold
+void fs_compress_task() {
+    while (1) {
+        fs_compress_cold(4);
+        sleep_ms(FS_COMPRESS_INTERVAL_MS);
+    }
+}
+
+// Logging only schedules a tasklet, since klog may run with run queue or
+// wait queue locks held; the tasklet hands the slow console writes to a
+// worker, and repeated messages before it runs share one flush
+static void log_work_func(Work* work) {
+    (void)work;
+    log_flush();
+}
+
+static Work log_work = WORK_INIT(log_work_func);
+
+static void log_tasklet_func(void* data) {
+    (void)data;
+    queue_work(system_wq, &log_work);
+}
+
+static Tasklet log_tasklet = TASKLET_INIT(log_tasklet_func, NULL);
+
+static void log_notify() {
+    tasklet_schedule(&log_tasklet);
+}
+
+// Console output is drawn into a shadow buffer. Output nobody flushes is
+// copied out by a one-shot timer armed when it is written, so an idle
+// console doesn't keep waking the CPU.
+static void vga_refresh(KTimer* timer) {
+    (void)timer;
+    vga_flush();
+}
+
+static KTimer vga_refresh_timer = KTIMER_INIT(vga_refresh, NULL);
+
+static void vga_notify() {
+    if (!ktimer_pending(&vga_refresh_timer)) {
+        ktimer_add(&vga_refresh_timer, TIMER_HZ / VGA_REFRESH_HZ);
+    }
+}
+
+// Parses a decimal kernel command line value; false if the key is absent
+static bool cmdline_number(const char* key, uint32_t* number) {
+    char value[16];
+    if (!multiboot_cmdline_value(key, value, sizeof(value))) {
+        return false;
+    }
+    *number = 0;
+    for (const char* p = value; *p >= '0' && *p <= '9'; p++) {
+        *number = *number * 10 + (*p - '0');
+    }
+    return true;
+}
+
+// Boot-time benchmark requested with smpbench=<tasks> on the kernel command
+// line: the result goes to serial for tools/smp-bench.sh, then QEMU exits
+static void run_boot_smp_bench() {
+    uint32_t tasks;
+    if (!cmdline_number("smpbench", &tasks)) {
+        return;
+    }
+    uint64_t cycles = tasks > 0 ? smp_bench(tasks) : 0;
+
+    char buffer[96];
+    snprintf(buffer, sizeof(buffer), "SMPBENCH cpus=%d tasks=%u cycles=%llu\n",
+             smp_cpu_count(), tasks, cycles);
+    serial_write(buffer);
+    serial_flush();
+    outb(QEMU_DEBUG_EXIT_PORT, 0);
+}
+
+// Sends the boot timeline to serial once the shell is up
+static void report_boot_timeline() {
+    char buffer[2048];
+    boot_timeline(buffer, sizeof(buffer));
+    serial_write(buffer);
+}
+
+void kernel_main(uint64_t multiboot_info)
 {
+    boot_phase("early console");
+    string_init(); // Picks the memcpy/memset variants before anything big is copied
+    multiboot_init(multiboot_info); // Copy it out before memory is handed out
     vga_init();    // Initialize VGA for CLI output
-    serial_init(); // Initialize serial port for logging
-    keyboard_init(); // Initialize keyboard
+    uint32_t baud = SERIAL_DEFAULT_BAUD;
+    cmdline_number("serial", &baud);
+    serial_init(baud); // Initialize serial port for logging
 
-    log_message("DEBUG: Kernel main started\n");
+    log_debug(LOG_KERNEL, "Kernel main started\n");
+    log_info(LOG_KERNEL, "String ops: %s\n", string_variant());
 
     log_message("Initializing memory management...\n");
+    boot_phase("init_physical_memory");
     init_physical_memory(TOTAL_MEMORY_SIZE);
+    boot_phase("init_virtual_memory");
     init_virtual_memory();
+    boot_phase("init_heap");
     init_heap();
+    boot_phase("framebuffer");
+    framebuffer_init(); // Falls back to VGA text mode without a usable framebuffer
+    boot_phase("interrupts, keyboard");
+    init_interrupts();
+    serial_init_irq(); // Output is buffered from here on
+    keyboard_init(); // Initialize keyboard
+
+    boot_phase("ACPI");
+    acpi_init(multiboot_rsdp());
+    boot_phase("clock calibration");
+    clock_init(); // Calibrates the TSC against the HPET from ACPI, or the PIT
+    boot_phase("per-CPU, FPU, syscalls, vDSO");
+    smp_init_bsp();
+    lockdep_init(); // Tracks held locks per CPU, so needs this_cpu()
+    softirq_init();
+    fpu_init();
+    syscall_init_cpu();
+    vdso_init();
 
     log_message("Initializing file system...\n");
+    boot_phase("fs_init");
     fs_init();
     log_message("File system initialized.\n");
 
     // Test file system
+    boot_phase("file system test");
     log_message("Testing file system...\n");
     if (fs_create("test.txt") >= 0) {
         log_message("Created test.txt\n");
         if (fs_write("test.txt", "Hello, World!", 13) >= 0) {
             log_message("Wrote to test.txt\n");
             char buffer[20];
-            if (fs_read("test.txt", buffer, 20) >= 0) {
-                log_message("Read from test.txt: ");
-                log_message(buffer);
-                log_message("\n");
+            int bytes = fs_read("test.txt", buffer, sizeof(buffer) - 1);
+            if (bytes >= 0) {
+                buffer[bytes] = '\0';
+                log_info(LOG_KERNEL, "Read from test.txt: %s\n", buffer);
             } else {
                 log_message("Failed to read from test.txt\n");
             }
@@ -83,42 +207,54 @@ void kernel_main()
     } else {
         log_message("Failed to create test.txt\n");
     }
+    user_install_programs();
 
+    boot_phase("tasking, workqueues");
     init_tasking(); // Initialize task scheduler
+    workqueue_init();
+    if (system_wq) {
+        log_set_notify(log_notify);
+    }
 
     log_message("Welcome to ML Kernel\n");
     log_message("Type 'help' for a list of commands\n");
 
     // Print initial memory info
+    boot_phase("banner, initial tasks");
     print_memory_info();
 
-    create_task(1, "Task 1", task1);
-    create_task(2, "Task 2", task2);
+    create_task("Task 1", task1);
+    create_task("Task 2", task2);
+
+    // Background housekeeping gets a small share of the CPU
+    task_set_nice(create_task("FS compress", fs_compress_task), 10);
+
+    vga_set_notify(vga_notify);
+
+    // Start the scheduler tick; from here on tasks are preempted. nohz=0
+    // keeps it running on idle CPUs too.
+    uint32_t nohz = 1;
+    cmdline_number("nohz", &nohz);
+    boot_phase("timer");
+    timer_init(TIMER_HZ, nohz != 0);
+    boot_phase("application processors");
+    smp_start_aps();
+    interrupts_enable();
+    boot_phases_done();
+    report_boot_timeline();
 
-    log_message("DEBUG: Entering main loop\n");
+    run_boot_smp_bench();
+
+    log_debug(LOG_KERNEL, "Entering main loop\n");
 
-    int loop_count = 0;
     while (1)
     {
-        char debug_msg[50];
-        snprintf(debug_msg, sizeof(debug_msg), "DEBUG: Loop iteration %d\n", loop_count++);
-        log_message(debug_msg);
-
         char input[128];
-        log_message("> ");
-        log_message("DEBUG: About to read input\n");
+        log_flush(); // Let queued messages out before prompting
+        vga_write("> ");
         read_input(input);
-        log_message("DEBUG: Input read\n");
-        log_message("You entered: ");
-        log_message(input);
-        log_message("\n");
-        log_message("DEBUG: About to handle command\n");
+        log_debug(LOG_SHELL, "You entered: %s\n", input);
         handle_command(input);
-        log_message("DEBUG: Command handled\n");
-
-        schedule(); // Run tasks
-
-        // Add a small delay
-        for (volatile int i = 0; i < 1000000; i++) {}
+        log_debug(LOG_SHELL, "Command handled\n");
     }
 }
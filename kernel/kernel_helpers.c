@@ -3,15 +3,85 @@
 #include "filesystem.h"
 #include "string.h"
 #include "memory.h"
+#include "selftest.h"
+#include "log.h"
+#include "task.h"
+#include "timer.h"
+#include "cpu.h"
+#include "smp.h"
+#include "wait.h"
+#include "fpu.h"
+#include "lockdep.h"
+#include "softirq.h"
+#include "workqueue.h"
+#include "serial.h"
+#include "clock.h"
+#include "ktimer.h"
+#include "user.h"
+#include "uring.h"
+#include "vdso.h"
+#include "elf.h"
+#include "vm.h"
+#include "boottime.h"
+#include "profile.h"
 
 #define MAX_COMMAND_LENGTH 256
 #define MAX_ARGS 10
+#define TOP_DEFAULT_SAMPLE_MS 1000
+
+// Parses an optionally negative decimal number; returns false if str is not one
+static bool parse_int(const char* str, int* value) {
+    int sign = 1;
+    if (*str == '-') {
+        sign = -1;
+        str++;
+    }
+    if (*str == '\0') {
+        return false;
+    }
+
+    int result = 0;
+    for (; *str; str++) {
+        if (*str < '0' || *str > '9') {
+            return false;
+        }
+        result = result * 10 + (*str - '0');
+    }
+    *value = sign * result;
+    return true;
+}
+
+static volatile int spawn_bench_done;
+static WaitQueue spawn_bench_wait = WAIT_QUEUE_INIT;
+
+static void spawn_bench_task() {
+    __atomic_fetch_add(&spawn_bench_done, 1, __ATOMIC_RELAXED);
+    wake_up(&spawn_bench_wait);
+}
+
+// Spawns count tasks that exit immediately and reports the cycles per
+// spawn+run+exit, with the task and stack pools already warm
+static void spawn_bench(int count) {
+    spawn_bench_done = 0;
+    uint64_t start = rdtsc();
+    for (int i = 0; i < count; i++) {
+        if (create_task("spawn", spawn_bench_task) < 0) {
+            count = i;
+            break;
+        }
+    }
+    wait_event(&spawn_bench_wait, spawn_bench_done >= count);
+    uint64_t cycles = rdtsc() - start;
+
+    char buffer[96];
+    snprintf(buffer, sizeof(buffer), "%d tasks: %llu cycles per spawn+exit\n",
+             count, count ? cycles / count : 0);
+    vga_writestring(buffer);
+}
 
 void handle_command(const char* input) {
-    vga_writestring("DEBUG: Entered handle_command\n");
-    vga_writestring("Received command: ");
-    vga_writestring(input);
-    vga_writestring("\n");
+    log_debug(LOG_SHELL, "Entered handle_command\n");
+    log_debug(LOG_SHELL, "Received command: %s\n", input);
 
     char command[MAX_COMMAND_LENGTH];
     char* args[MAX_ARGS];
@@ -26,12 +96,14 @@ void handle_command(const char* input) {
         token = strtok(NULL, " ");
     }
 
-    vga_writestring("Command: ");
-    vga_writestring(args[0]);
-    vga_writestring("\n");
+    if (arg_count == 0) {
+        return;
+    }
+
+    log_debug(LOG_SHELL, "Command: %s\n", args[0]);
 
     if (strcmp(args[0], "help") == 0) {
-        vga_writestring("DEBUG: Executing help command\n");
+        log_debug(LOG_SHELL, "Executing help command\n");
         vga_writestring("Available commands:\n");
         vga_writestring("  help - Display this help message\n");
         vga_writestring("  clear - Clear the screen\n");
@@ -42,25 +114,44 @@ void handle_command(const char* input) {
         vga_writestring("  list - List all files\n");
         vga_writestring("  mkdir <dirname> - Create a new directory\n");
         vga_writestring("  meminfo - Display memory information\n");
+        vga_writestring("  fsstat - Display file compression statistics\n");
+        vga_writestring("  compress <filename> <on|off> - Toggle compression for a file\n");
+        vga_writestring("  ps - List tasks\n");
+        vga_writestring("  top [ms] - Sample CPU use per task and show scheduler latency\n");
+        vga_writestring("  schedstat - Write task accounting and latency histograms to serial\n");
+        vga_writestring("  nice <id> <-20..19> - Set a task's CPU share within its priority\n");
+        vga_writestring("  prio <id> <0-7> - Set a task's priority (0 is most urgent)\n");
+        vga_writestring("  quantum [ms] - Show or set the scheduler time slice\n");
+        vga_writestring("  spawnbench <n> - Time spawning and exiting n tasks\n");
+        vga_writestring("  cpus - List online CPUs and their run queues\n");
+        vga_writestring("  fpu - Show the FPU save format and lazy switch counts\n");
+        vga_writestring("  locks - Show lock acquisitions and contention (LOCK_DEBUG builds)\n");
+        vga_writestring("  softirqs - Show softirqs run per CPU and workqueue activity\n");
+        vga_writestring("  clock - Show the clocksource, TSC rate and pending timers\n");
+        vga_writestring("  boottime - Show how long each boot phase took\n");
+        vga_writestring("  prof [start [ms]|stop|dump] - Sample kernel stacks on the timer tick\n");
+        vga_writestring("  wakeups [ms] - Sample idle wakeups and timer interrupts per second\n");
+        vga_writestring("  smpbench <n> - Time n CPU-bound tasks across all CPUs\n");
+        vga_writestring("  syscallbench [n] - Time n null system calls from user mode\n");
+        vga_writestring("  uringbench [rounds] [poll] - Time batched ramfs writes through a submission ring\n");
+        vga_writestring("  vdsobench [n] - Time reading the clock through the vDSO and by syscall\n");
+        vga_writestring("  exec <file> [arg] - Run an ELF executable from the file system\n");
+        vga_writestring("  dmesg - Display the kernel log\n");
+        vga_writestring("  loglevel <0-3> - Set the log level (error, warn, info, debug)\n");
+        vga_writestring("  logmask <subsystem> <on|off> - Enable or disable a subsystem's log\n");
         vga_writestring("  test - Run a series of tests\n");
     } else if (strcmp(args[0], "clear") == 0) {
-        vga_writestring("DEBUG: Executing clear command\n");
+        log_debug(LOG_SHELL, "Executing clear command\n");
         vga_writestring("Clearing screen...\n");
         vga_clear();
     } else if (strcmp(args[0], "create") == 0) {
-        vga_writestring("DEBUG: Executing create command\n");
+        log_debug(LOG_SHELL, "Executing create command\n");
         if (arg_count < 2) {
             vga_writestring("Usage: create <filename>\n");
         } else {
-            vga_writestring("Attempting to create file: ");
-            vga_writestring(args[1]);
-            vga_writestring("\n");
+            log_debug(LOG_SHELL, "Attempting to create file: %s\n", args[1]);
             int result = fs_create(args[1]);
-            vga_writestring("fs_create result: ");
-            char result_str[20];
-            int_to_string(result, result_str);
-            vga_writestring(result_str);
-            vga_writestring("\n");
+            log_debug(LOG_SHELL, "fs_create result: %d\n", result);
             if (result >= 0) {
                 vga_writestring("File created successfully\n");
             } else if (result == -1) {
@@ -72,19 +163,13 @@ void handle_command(const char* input) {
             }
         }
     } else if (strcmp(args[0], "write") == 0) {
-        vga_writestring("DEBUG: Executing write command\n");
+        log_debug(LOG_SHELL, "Executing write command\n");
         if (arg_count < 3) {
             vga_writestring("Usage: write <filename> <content>\n");
         } else {
-            vga_writestring("Attempting to write to file: ");
-            vga_writestring(args[1]);
-            vga_writestring("\n");
+            log_debug(LOG_SHELL, "Attempting to write to file: %s\n", args[1]);
             int result = fs_write(args[1], args[2], strlen(args[2]));
-            vga_writestring("fs_write result: ");
-            char result_str[20];
-            int_to_string(result, result_str);
-            vga_writestring(result_str);
-            vga_writestring("\n");
+            log_debug(LOG_SHELL, "fs_write result: %d\n", result);
             if (result >= 0) {
                 vga_writestring("Content written to file\n");
             } else {
@@ -92,20 +177,14 @@ void handle_command(const char* input) {
             }
         }
     } else if (strcmp(args[0], "read") == 0) {
-        vga_writestring("DEBUG: Executing read command\n");
+        log_debug(LOG_SHELL, "Executing read command\n");
         if (arg_count < 2) {
             vga_writestring("Usage: read <filename>\n");
         } else {
-            vga_writestring("Attempting to read from file: ");
-            vga_writestring(args[1]);
-            vga_writestring("\n");
+            log_debug(LOG_SHELL, "Attempting to read from file: %s\n", args[1]);
             char buffer[MAX_FILE_SIZE];
             int result = fs_read(args[1], buffer, MAX_FILE_SIZE - 1);
-            vga_writestring("fs_read result: ");
-            char result_str[20];
-            int_to_string(result, result_str);
-            vga_writestring(result_str);
-            vga_writestring("\n");
+            log_debug(LOG_SHELL, "fs_read result: %d\n", result);
             if (result >= 0) {
                 buffer[result] = '\0';
                 vga_writestring("File contents:\n");
@@ -116,19 +195,13 @@ void handle_command(const char* input) {
             }
         }
     } else if (strcmp(args[0], "delete") == 0) {
-        vga_writestring("DEBUG: Executing delete command\n");
+        log_debug(LOG_SHELL, "Executing delete command\n");
         if (arg_count < 2) {
             vga_writestring("Usage: delete <filename>\n");
         } else {
-            vga_writestring("Attempting to delete file: ");
-            vga_writestring(args[1]);
-            vga_writestring("\n");
+            log_debug(LOG_SHELL, "Attempting to delete file: %s\n", args[1]);
             int result = fs_delete(args[1]);
-            vga_writestring("fs_delete result: ");
-            char result_str[20];
-            int_to_string(result, result_str);
-            vga_writestring(result_str);
-            vga_writestring("\n");
+            log_debug(LOG_SHELL, "fs_delete result: %d\n", result);
             if (result == 0) {
                 vga_writestring("File deleted successfully\n");
             } else {
@@ -136,13 +209,13 @@ void handle_command(const char* input) {
             }
         }
     } else if (strcmp(args[0], "list") == 0) {
-        vga_writestring("DEBUG: Executing list command\n");
+        log_debug(LOG_SHELL, "Executing list command\n");
         char buffer[1024];
         fs_list(buffer, sizeof(buffer));
         vga_writestring("Files:\n");
         vga_writestring(buffer);
     } else if (strcmp(args[0], "mkdir") == 0) {
-        vga_writestring("DEBUG: Executing mkdir command\n");
+        log_debug(LOG_SHELL, "Executing mkdir command\n");
         if (arg_count < 2) {
             vga_writestring("Usage: mkdir <dirname>\n");
         } else {
@@ -154,7 +227,7 @@ void handle_command(const char* input) {
             }
         }
     } else if (strcmp(args[0], "meminfo") == 0) {
-        vga_writestring("DEBUG: Executing meminfo command\n");
+        log_debug(LOG_SHELL, "Executing meminfo command\n");
         MemoryInfo info;
         get_memory_info(&info);
         char buffer[256];
@@ -167,14 +240,269 @@ void handle_command(const char* input) {
                  info.total_memory, info.free_memory,
                  info.used_memory, info.reserved_memory);
         vga_writestring(buffer);
+    } else if (strcmp(args[0], "fsstat") == 0) {
+        log_debug(LOG_SHELL, "Executing fsstat command\n");
+        FsCompressionStats stats;
+        fs_get_compression_stats(&stats);
+        uint64_t ratio = stats.stored_bytes ? stats.logical_bytes * 100 / stats.stored_bytes : 0;
+        uint64_t avg_cycles = stats.decompressions ? stats.decompress_cycles_total / stats.decompressions : 0;
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer),
+                 "Compression Stats:\n"
+                 "  Compressed files: %u\n"
+                 "  Logical bytes: %llu\n"
+                 "  Stored bytes:  %llu\n"
+                 "  Ratio: %llu%%\n"
+                 "  Decompressions: %llu (cache hits: %llu)\n"
+                 "  Decompress cycles: avg %llu, max %llu\n",
+                 stats.compressed_files, stats.logical_bytes,
+                 stats.stored_bytes, ratio,
+                 stats.decompressions, stats.cache_hits,
+                 avg_cycles, stats.decompress_cycles_max);
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "compress") == 0) {
+        log_debug(LOG_SHELL, "Executing compress command\n");
+        if (arg_count < 3 || (strcmp(args[2], "on") != 0 && strcmp(args[2], "off") != 0)) {
+            vga_writestring("Usage: compress <filename> <on|off>\n");
+        } else {
+            int result = fs_set_compression(args[1], strcmp(args[2], "on") == 0);
+            if (result == 0) {
+                vga_writestring("Compression setting updated\n");
+            } else {
+                vga_writestring("Error: Failed to update compression setting\n");
+            }
+        }
+    } else if (strcmp(args[0], "ps") == 0) {
+        log_debug(LOG_SHELL, "Executing ps command\n");
+        char buffer[1024];
+        task_list(buffer, sizeof(buffer));
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "top") == 0) {
+        log_debug(LOG_SHELL, "Executing top command\n");
+        int ms = TOP_DEFAULT_SAMPLE_MS;
+        if (arg_count >= 2 && (!parse_int(args[1], &ms) || ms <= 0)) {
+            vga_writestring("Usage: top [ms]\n");
+        } else {
+            char buffer[2048];
+            task_top(buffer, sizeof(buffer), ms);
+            vga_writestring(buffer);
+        }
+    } else if (strcmp(args[0], "schedstat") == 0) {
+        log_debug(LOG_SHELL, "Executing schedstat command\n");
+        sched_stats_dump(serial_write);
+        vga_writestring("Scheduler statistics written to serial\n");
+    } else if (strcmp(args[0], "nice") == 0 || strcmp(args[0], "prio") == 0) {
+        log_debug(LOG_SHELL, "Executing %s command\n", args[0]);
+        int id, value;
+        if (arg_count < 3 || !parse_int(args[1], &id) || !parse_int(args[2], &value)) {
+            vga_writestring("Usage: nice <id> <-20..19> | prio <id> <0-7>\n");
+        } else {
+            int result = args[0][0] == 'n' ? task_set_nice(id, value) : task_set_priority(id, value);
+            vga_writestring(result == 0 ? "Task updated\n" : "Error: No such task or value out of range\n");
+        }
+    } else if (strcmp(args[0], "spawnbench") == 0) {
+        log_debug(LOG_SHELL, "Executing spawnbench command\n");
+        int count;
+        if (arg_count < 2 || !parse_int(args[1], &count) || count <= 0) {
+            vga_writestring("Usage: spawnbench <n>\n");
+        } else {
+            spawn_bench(count);
+        }
+    } else if (strcmp(args[0], "cpus") == 0) {
+        log_debug(LOG_SHELL, "Executing cpus command\n");
+        char buffer[512];
+        smp_list(buffer, sizeof(buffer));
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "fpu") == 0) {
+        log_debug(LOG_SHELL, "Executing fpu command\n");
+        char buffer[512];
+        fpu_info(buffer, sizeof(buffer));
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "locks") == 0) {
+        log_debug(LOG_SHELL, "Executing locks command\n");
+        char buffer[1024];
+        lockdep_stats(buffer, sizeof(buffer));
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "softirqs") == 0) {
+        log_debug(LOG_SHELL, "Executing softirqs command\n");
+        char buffer[1024];
+        softirq_stats(buffer, sizeof(buffer));
+        size_t length = strlen(buffer);
+        workqueue_stats(buffer + length, sizeof(buffer) - length);
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "clock") == 0) {
+        log_debug(LOG_SHELL, "Executing clock command\n");
+        char buffer[256];
+        clock_info(buffer, sizeof(buffer));
+        size_t length = strlen(buffer);
+        snprintf(buffer + length, sizeof(buffer) - length, "Timers pending: %u\n",
+                 __atomic_load_n(&timer_wheel.pending, __ATOMIC_RELAXED));
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "boottime") == 0) {
+        log_debug(LOG_SHELL, "Executing boottime command\n");
+        char buffer[2048];
+        boot_timeline(buffer, sizeof(buffer));
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "prof") == 0) {
+        log_debug(LOG_SHELL, "Executing prof command\n");
+        int interval = 1;
+        if (arg_count >= 2 && strcmp(args[1], "start") == 0 &&
+            (arg_count < 3 || (parse_int(args[2], &interval) && interval > 0))) {
+            if (!profile_start(interval)) {
+                vga_writestring("Error: Could not allocate the sample buffers\n");
+            }
+        } else if (arg_count >= 2 && strcmp(args[1], "stop") == 0) {
+            profile_stop();
+        } else if (arg_count >= 2 && strcmp(args[1], "dump") == 0) {
+            profile_dump();
+            vga_writestring("Samples written to serial; decode them with tools/prof-symbolize.py\n");
+        } else if (arg_count >= 2) {
+            vga_writestring("Usage: prof [start [ms]|stop|dump]\n");
+        }
+        char buffer[512];
+        profile_status(buffer, sizeof(buffer));
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "wakeups") == 0) {
+        log_debug(LOG_SHELL, "Executing wakeups command\n");
+        int ms = TOP_DEFAULT_SAMPLE_MS;
+        if (arg_count >= 2 && (!parse_int(args[1], &ms) || ms <= 0)) {
+            vga_writestring("Usage: wakeups [ms]\n");
+        } else {
+            char buffer[1024];
+            timer_wakeup_stats(buffer, sizeof(buffer), ms);
+            vga_writestring(buffer);
+        }
+    } else if (strcmp(args[0], "smpbench") == 0) {
+        log_debug(LOG_SHELL, "Executing smpbench command\n");
+        int count;
+        if (arg_count < 2 || !parse_int(args[1], &count) || count <= 0) {
+            vga_writestring("Usage: smpbench <n>\n");
+        } else {
+            uint64_t cycles = smp_bench(count);
+            char buffer[96];
+            if (cycles) {
+                snprintf(buffer, sizeof(buffer), "%d tasks on %d CPUs: %llu Mcycles\n",
+                         count, smp_cpu_count(), cycles / 1000000);
+            } else {
+                snprintf(buffer, sizeof(buffer), "Error: Could not spawn %d tasks\n", count);
+            }
+            vga_writestring(buffer);
+        }
+    } else if (strcmp(args[0], "syscallbench") == 0) {
+        log_debug(LOG_SHELL, "Executing syscallbench command\n");
+        int calls = SYSCALL_BENCH_DEFAULT_CALLS;
+        if (arg_count >= 2 && (!parse_int(args[1], &calls) || calls <= 0)) {
+            vga_writestring("Usage: syscallbench [n]\n");
+        } else {
+            uint64_t cycles = syscall_bench(calls);
+            char buffer[96];
+            if (cycles) {
+                snprintf(buffer, sizeof(buffer), "%d null syscalls: %llu cycles per round trip\n",
+                         calls, cycles);
+            } else {
+                snprintf(buffer, sizeof(buffer), "Error: Could not run the benchmark program\n");
+            }
+            vga_writestring(buffer);
+        }
+    } else if (strcmp(args[0], "uringbench") == 0) {
+        log_debug(LOG_SHELL, "Executing uringbench command\n");
+        int rounds = URING_BENCH_DEFAULT_ROUNDS;
+        bool sqpoll = arg_count >= 3 && strcmp(args[2], "poll") == 0;
+        if ((arg_count >= 2 && (!parse_int(args[1], &rounds) || rounds <= 0)) ||
+            (arg_count >= 3 && !sqpoll)) {
+            vga_writestring("Usage: uringbench [rounds] [poll]\n");
+        } else {
+            uint64_t cycles = uring_bench(rounds, sqpoll);
+            char buffer[128];
+            if (cycles) {
+                snprintf(buffer, sizeof(buffer), "%d writes, %d per enter%s: %llu cycles per write\n",
+                         rounds * URING_MAX_ENTRIES, URING_MAX_ENTRIES,
+                         sqpoll ? " (polled)" : "", cycles);
+            } else {
+                snprintf(buffer, sizeof(buffer), "Error: Could not run the benchmark program\n");
+            }
+            vga_writestring(buffer);
+        }
+    } else if (strcmp(args[0], "vdsobench") == 0) {
+        log_debug(LOG_SHELL, "Executing vdsobench command\n");
+        int calls = VDSO_BENCH_DEFAULT_CALLS;
+        if (arg_count >= 2 && (!parse_int(args[1], &calls) || calls <= 0)) {
+            vga_writestring("Usage: vdsobench [n]\n");
+        } else {
+            uint64_t vdso_ns, syscall_ns;
+            vdso_bench(calls, &vdso_ns, &syscall_ns);
+            char buffer[128];
+            if (vdso_ns && syscall_ns) {
+                snprintf(buffer, sizeof(buffer), "%d time reads: vDSO %llu ns, syscall %llu ns per call\n",
+                         calls, vdso_ns, syscall_ns);
+            } else {
+                snprintf(buffer, sizeof(buffer), "Error: Could not run the benchmark program\n");
+            }
+            vga_writestring(buffer);
+        }
+    } else if (strcmp(args[0], "exec") == 0) {
+        log_debug(LOG_SHELL, "Executing exec command\n");
+        int arg = 0;
+        if (arg_count < 2 || (arg_count >= 3 && !parse_int(args[2], &arg))) {
+            vga_writestring("Usage: exec <file> [arg]\n");
+        } else {
+            VmStats before, after;
+            vm_get_stats(&before);
+            int64_t status;
+            int error = user_exec(args[1], arg, &status);
+            vm_get_stats(&after);
+            char buffer[160];
+            if (error < 0) {
+                snprintf(buffer, sizeof(buffer), "Error: %s: %s\n", args[1], elf_strerror(error));
+            } else {
+                snprintf(buffer, sizeof(buffer),
+                         "%s exited with status %lld; pages: %llu from file, %llu zeroed, %llu shared\n",
+                         args[1], status, after.file_faults - before.file_faults,
+                         after.zero_faults - before.zero_faults, after.shared_hits - before.shared_hits);
+            }
+            vga_writestring(buffer);
+        }
+    } else if (strcmp(args[0], "quantum") == 0) {
+        log_debug(LOG_SHELL, "Executing quantum command\n");
+        int ms;
+        if (arg_count >= 2 && parse_int(args[1], &ms) && ms > 0) {
+            sched_set_quantum_ms(ms);
+        }
+        char buffer[96];
+        snprintf(buffer, sizeof(buffer), "Quantum: %u ms (%s timer at %u Hz, %llu ticks)\n",
+                 sched_get_quantum_ms(), timer_using_lapic() ? "LAPIC" : "PIT",
+                 TIMER_HZ, timer_ticks());
+        vga_writestring(buffer);
+    } else if (strcmp(args[0], "dmesg") == 0) {
+        log_debug(LOG_SHELL, "Executing dmesg command\n");
+        log_dump(vga_writestring);
+    } else if (strcmp(args[0], "loglevel") == 0) {
+        log_debug(LOG_SHELL, "Executing loglevel command\n");
+        if (arg_count < 2 || args[1][0] < '0' || args[1][0] > '3') {
+            vga_writestring("Usage: loglevel <0-3>\n");
+        } else {
+            log_set_level(args[1][0] - '0');
+            char buffer[48];
+            snprintf(buffer, sizeof(buffer), "Log level set to %d\n", log_get_level());
+            vga_writestring(buffer);
+        }
+    } else if (strcmp(args[0], "logmask") == 0) {
+        log_debug(LOG_SHELL, "Executing logmask command\n");
+        int subsystem = arg_count < 3 ? -1 : log_subsystem_by_name(args[1]);
+        if (subsystem < 0) {
+            vga_writestring("Usage: logmask <kernel|mem|fs|task|shell|driver> <on|off>\n");
+        } else {
+            log_set_subsystem(subsystem, strcmp(args[2], "on") == 0);
+            vga_writestring("Log mask updated\n");
+        }
     } else if (strcmp(args[0], "test") == 0) {
-        vga_writestring("DEBUG: Executing test command\n");
+        log_debug(LOG_SHELL, "Executing test command\n");
         vga_writestring("Running tests...\n");
-        // Add your test code here
+        run_selftests(vga_writestring);
     } else {
-        vga_writestring("DEBUG: Unknown command\n");
+        log_debug(LOG_SHELL, "Unknown command\n");
         vga_writestring("Unknown command. Type 'help' for a list of commands.\n");
     }
 
-    vga_writestring("DEBUG: Exiting handle_command\n");
+    log_debug(LOG_SHELL, "Exiting handle_command\n");
 }
@@ -0,0 +1,197 @@
+#include "ktimer.h"
+#ifndef HOSTED
+#include "timer.h"
+#endif
+
+#define SLOT_MASK (KTIMER_SLOTS - 1)
+
+TimerWheel timer_wheel = { SPINLOCK_INIT("timer_wheel"), 0, 0, { { NULL } } };
+
+void ktimer_wheel_init(TimerWheel* wheel, uint64_t now) {
+    spin_init(&wheel->lock, "timer_wheel");
+    wheel->now = now;
+    wheel->pending = 0;
+    for (int level = 0; level < KTIMER_LEVELS; level++) {
+        for (int slot = 0; slot < KTIMER_SLOTS; slot++) {
+            wheel->slots[level][slot] = NULL;
+        }
+    }
+}
+
+void ktimer_init(KTimer* timer, void (*func)(KTimer* timer), void* data) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->period = 0;
+    timer->func = func;
+    timer->data = data;
+}
+
+// Files the timer on the lowest level whose span covers its distance from
+// the wheel's current tick. Called with the wheel lock held.
+static void enqueue_timer(TimerWheel* wheel, KTimer* timer) {
+    uint64_t expires = timer->expires;
+    if (expires < wheel->now) {
+        expires = wheel->now; // Overdue: due on the very next tick processed
+    } else if (expires - wheel->now > KTIMER_MAX_DELTA) {
+        expires = wheel->now + KTIMER_MAX_DELTA;
+    }
+
+    uint64_t delta = expires - wheel->now;
+    int level = 0;
+    while (level < KTIMER_LEVELS - 1 && delta >> ((level + 1) * KTIMER_SLOT_BITS)) {
+        level++;
+    }
+    KTimer** slot = &wheel->slots[level][(expires >> (level * KTIMER_SLOT_BITS)) & SLOT_MASK];
+
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->pprev = &timer->next;
+    }
+    *slot = timer;
+    __atomic_store_n(&timer->pprev, slot, __ATOMIC_RELAXED);
+}
+
+// Called with the wheel lock held
+static void dequeue_timer(KTimer* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    __atomic_store_n(&timer->pprev, NULL, __ATOMIC_RELAXED);
+}
+
+// Re-arms the timer if it is already queued
+void ktimer_add_to(TimerWheel* wheel, KTimer* timer, uint64_t expires) {
+    uint64_t flags = spin_lock_irqsave(&wheel->lock);
+    if (timer->pprev) {
+        dequeue_timer(timer);
+    } else {
+        wheel->pending++;
+    }
+    timer->expires = expires;
+    enqueue_timer(wheel, timer);
+    spin_unlock_irqrestore(&wheel->lock, flags);
+}
+
+// Returns false if the timer wasn't queued. A callback already under way
+// on another CPU isn't waited for.
+bool ktimer_cancel_from(TimerWheel* wheel, KTimer* timer) {
+    if (!ktimer_pending(timer)) {
+        return false;
+    }
+    uint64_t flags = spin_lock_irqsave(&wheel->lock);
+    bool queued = timer->pprev != NULL;
+    if (queued) {
+        dequeue_timer(timer);
+        timer->period = 0;
+        wheel->pending--;
+    }
+    spin_unlock_irqrestore(&wheel->lock, flags);
+    return queued;
+}
+
+// Moves every timer in a higher-level slot down to where it now belongs
+static void cascade(TimerWheel* wheel, int level) {
+    int index = (wheel->now >> (level * KTIMER_SLOT_BITS)) & SLOT_MASK;
+    KTimer* timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (timer) {
+        KTimer* next = timer->next;
+        enqueue_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+// Processes every tick up to and including now. Callbacks run without the
+// wheel lock, so they may add or cancel timers, and must not touch a
+// one-shot timer after it fires unless they own it.
+void ktimer_run_wheel(TimerWheel* wheel, uint64_t now) {
+    uint64_t flags = spin_lock_irqsave(&wheel->lock);
+    while (wheel->now <= now) {
+        int index = wheel->now & SLOT_MASK;
+        for (int level = 1; index == 0 && level < KTIMER_LEVELS; level++) {
+            cascade(wheel, level);
+            index = (wheel->now >> (level * KTIMER_SLOT_BITS)) & SLOT_MASK;
+        }
+        index = wheel->now & SLOT_MASK;
+        wheel->now++;
+
+        while (wheel->slots[0][index]) {
+            KTimer* timer = wheel->slots[0][index];
+            dequeue_timer(timer);
+            void (*func)(KTimer*) = timer->func;
+            if (timer->period) {
+                timer->expires += timer->period;
+                enqueue_timer(wheel, timer);
+            } else {
+                wheel->pending--;
+            }
+            spin_unlock_irqrestore(&wheel->lock, flags);
+            func(timer);
+            flags = spin_lock_irqsave(&wheel->lock);
+        }
+    }
+    spin_unlock_irqrestore(&wheel->lock, flags);
+}
+
+// Earliest tick any queued timer can fire on; false if none are queued.
+// Timers on the upper levels count from the start of their slot, so this
+// may come early but never late.
+bool ktimer_wheel_next(TimerWheel* wheel, uint64_t* tick) {
+    uint64_t flags = spin_lock_irqsave(&wheel->lock);
+    bool found = false;
+    if (wheel->pending) {
+        for (int level = 0; level < KTIMER_LEVELS; level++) {
+            int shift = level * KTIMER_SLOT_BITS;
+            uint64_t base = (wheel->now >> shift) << shift;
+            int index = (wheel->now >> shift) & SLOT_MASK;
+            // Level 0 starts at the current slot; higher ones have already
+            // cascaded theirs
+            for (int offset = level ? 1 : 0; offset <= KTIMER_SLOTS; offset++) {
+                if (wheel->slots[level][(index + offset) & SLOT_MASK]) {
+                    uint64_t start = level ? base + ((uint64_t)offset << shift) : wheel->now + offset;
+                    if (!found || start < *tick) {
+                        *tick = start;
+                        found = true;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    spin_unlock_irqrestore(&wheel->lock, flags);
+    return found;
+}
+
+#ifndef HOSTED
+// The current tick is already partly over, so a delay of n ticks may last
+// anything from n - 1 to n ticks
+void ktimer_add(KTimer* timer, uint64_t delay_ticks) {
+    timer->period = 0;
+    uint64_t expires = timer_ticks() + delay_ticks;
+    ktimer_add_to(&timer_wheel, timer, expires);
+    timer_added(expires);
+}
+
+void ktimer_add_periodic(KTimer* timer, uint64_t period_ticks) {
+    timer->period = period_ticks ? period_ticks : 1;
+    uint64_t expires = timer_ticks() + timer->period;
+    ktimer_add_to(&timer_wheel, timer, expires);
+    timer_added(expires);
+}
+
+bool ktimer_cancel(KTimer* timer) {
+    return ktimer_cancel_from(&timer_wheel, timer);
+}
+
+bool ktimer_next_expiry(uint64_t* tick) {
+    return ktimer_wheel_next(&timer_wheel, tick);
+}
+
+// Called from the timer softirq on the BSP
+void ktimer_run(uint64_t now) {
+    ktimer_run_wheel(&timer_wheel, now);
+}
+#endif // HOSTED
@@ -0,0 +1,174 @@
+#include "lockdep.h"
+#include "string.h"
+
+#ifdef LOCK_DEBUG
+#include "log.h"
+
+#ifdef HOSTED
+#define LOCKDEP_CPUS 1
+#define lockdep_cpu() 0
+#else
+#include "smp.h"
+#define LOCKDEP_CPUS MAX_CPUS
+#define lockdep_cpu() (this_cpu()->id)
+#endif
+
+typedef struct {
+    const char* name;
+    uint64_t acquisitions;
+    uint64_t contentions;
+    uint32_t after;     // Bit n: class n+1 was taken while this one was held
+    uint32_t reported;  // Bit n: an ordering problem with class n+1 was logged
+} LockClass;
+
+// Locks currently held by one CPU. Every lock is held with interrupts off,
+// so the CPU rather than the task is the holder.
+typedef struct {
+    int count;
+    uint8_t classes[LOCKDEP_MAX_HELD];
+} HeldLocks;
+
+static LockClass classes[LOCKDEP_MAX_CLASSES];
+static int class_count = 0;
+static HeldLocks held[LOCKDEP_CPUS];
+
+// Guards the class table and order graph. A bare flag, since lockdep can't
+// use the locks it is checking.
+static volatile uint32_t graph_busy = 0;
+
+#ifdef HOSTED
+static bool ready = true;
+#else
+static bool ready = false; // this_cpu() is meaningless until smp_init_bsp
+#endif
+
+static void graph_lock() {
+    while (__atomic_exchange_n(&graph_busy, 1, __ATOMIC_ACQUIRE)) {
+        __asm__ volatile("pause" ::: "memory");
+    }
+}
+
+static void graph_unlock() {
+    __atomic_store_n(&graph_busy, 0, __ATOMIC_RELEASE);
+}
+
+// Returns the lock's class, registering its name on first use, or 0 once
+// the table is full and the lock goes untracked
+static int lock_class(LockDep* dep) {
+    int class = dep->class;
+    if (class) {
+        return class;
+    }
+
+    const char* name = dep->name ? dep->name : "unnamed";
+    graph_lock();
+    for (int i = 0; i < class_count && !class; i++) {
+        if (strcmp(classes[i].name, name) == 0) {
+            class = i + 1;
+        }
+    }
+    if (!class && class_count < LOCKDEP_MAX_CLASSES) {
+        classes[class_count].name = name;
+        class = ++class_count;
+    }
+    graph_unlock();
+    dep->class = class;
+    return class;
+}
+
+void lockdep_init() {
+    ready = true;
+}
+
+// Called with the lock held. Records that every lock this CPU already holds
+// comes before this one, and reports the first time two classes have been
+// taken in both orders or a class is taken twice. Trylocks can't deadlock,
+// so they are tracked as held but add no ordering.
+void lockdep_acquired(LockDep* dep, bool trylock) {
+    int class = lock_class(dep);
+    if (!class) {
+        return;
+    }
+    LockClass* taken = &classes[class - 1];
+    __atomic_fetch_add(&taken->acquisitions, 1, __ATOMIC_RELAXED);
+    if (!ready) {
+        return;
+    }
+
+    HeldLocks* locks = &held[lockdep_cpu()];
+    if (!trylock) {
+        graph_lock();
+        for (int i = 0; i < locks->count && i < LOCKDEP_MAX_HELD; i++) {
+            int held_class = locks->classes[i];
+            LockClass* holding = &classes[held_class - 1];
+            uint32_t held_bit = 1u << (held_class - 1);
+            uint32_t taken_bit = 1u << (class - 1);
+            if (held_class == class) {
+                if (!(taken->reported & taken_bit)) {
+                    taken->reported |= taken_bit;
+                    log_warn(LOG_KERNEL, "lockdep: %s taken while already held\n", taken->name);
+                }
+            } else if ((taken->after & held_bit) && !(taken->reported & held_bit)) {
+                taken->reported |= held_bit;
+                holding->reported |= taken_bit;
+                log_warn(LOG_KERNEL, "lockdep: %s taken while holding %s, but elsewhere %s is taken inside %s\n",
+                         taken->name, holding->name, holding->name, taken->name);
+            }
+            holding->after |= taken_bit;
+        }
+        graph_unlock();
+    }
+
+    if (locks->count < LOCKDEP_MAX_HELD) {
+        locks->classes[locks->count] = class;
+    }
+    locks->count++;
+}
+
+// Called just before the lock is dropped. Locks need not be released in
+// the order they were taken, so the latest entry of the class is removed.
+void lockdep_released(LockDep* dep) {
+    int class = dep->class;
+    if (!class || !ready) {
+        return;
+    }
+
+    HeldLocks* locks = &held[lockdep_cpu()];
+    int tracked = locks->count < LOCKDEP_MAX_HELD ? locks->count : LOCKDEP_MAX_HELD;
+    for (int i = tracked - 1; i >= 0; i--) {
+        if (locks->classes[i] == class) {
+            for (int j = i; j < tracked - 1; j++) {
+                locks->classes[j] = locks->classes[j + 1];
+            }
+            locks->count--;
+            return;
+        }
+    }
+    // Taken before lockdep_init, or beyond the tracked depth
+    if (locks->count > tracked) {
+        locks->count--;
+    }
+}
+
+void lockdep_contended(LockDep* dep) {
+    int class = lock_class(dep);
+    if (class) {
+        __atomic_fetch_add(&classes[class - 1].contentions, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void lockdep_stats(char* buffer, size_t buffer_size) {
+    size_t offset = snprintf(buffer, buffer_size, "CLASS             ACQUIRED  CONTENDED\n");
+    for (int i = 0; i < class_count && offset < buffer_size - 1; i++) {
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-14s %11llu %10llu\n",
+                           classes[i].name, classes[i].acquisitions, classes[i].contentions);
+    }
+}
+
+#else
+
+void lockdep_stats(char* buffer, size_t buffer_size) {
+    snprintf(buffer, buffer_size, "Lock statistics need a build with DEBUG_FLAGS=-DLOCK_DEBUG\n");
+}
+
+#endif // LOCK_DEBUG
@@ -0,0 +1,150 @@
+#include "log.h"
+#include "string.h"
+#include "vga.h"
+#include "serial.h"
+
+typedef struct {
+    uint32_t seq;       // Sequence number + 1 once the record is complete, 0 while being written
+    uint8_t level;
+    uint8_t subsystem;
+    char message[LOG_MESSAGE_MAX];
+} LogRecord;
+
+static LogRecord log_ring[LOG_RING_SIZE];
+static uint32_t log_head = 0;         // Next sequence number to hand out
+static uint32_t log_console_seq = 0;  // Next sequence number log_flush will print
+static uint32_t log_flushing = 0;
+static int log_level = LOG_BUILD_LEVEL;
+static uint32_t log_mask = (1u << LOG_SUBSYSTEM_COUNT) - 1;
+static void (*log_notify)(void) = NULL;
+
+static const char* level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+static const char* subsystem_names[LOG_SUBSYSTEM_COUNT] = {
+    "kernel", "mem", "fs", "task", "shell", "driver"
+};
+
+// Producers reserve a slot with a single atomic add and publish it by
+// storing its sequence number, so any context can log without a lock.
+void klog(int level, int subsystem, const char* format, ...) {
+    if (level > log_level || !(log_mask & (1u << subsystem))) {
+        return;
+    }
+
+    uint32_t seq = __atomic_fetch_add(&log_head, 1, __ATOMIC_RELAXED);
+    LogRecord* record = &log_ring[seq & (LOG_RING_SIZE - 1)];
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+
+    record->level = level;
+    record->subsystem = subsystem;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record->message, sizeof(record->message), format, args);
+    va_end(args);
+
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELEASE);
+
+    void (*notify)(void) = __atomic_load_n(&log_notify, __ATOMIC_ACQUIRE);
+    if (notify) {
+        notify();
+    }
+}
+
+// Called after every record is published, from whatever context logged it,
+// so the hook must not block or take locks
+void log_set_notify(void (*notify)(void)) {
+    __atomic_store_n(&log_notify, notify, __ATOMIC_RELEASE);
+}
+
+void log_set_level(int level) {
+    log_level = level > LOG_BUILD_LEVEL ? LOG_BUILD_LEVEL : level;
+}
+
+int log_get_level() {
+    return log_level;
+}
+
+void log_set_subsystem(int subsystem, bool enabled) {
+    if (subsystem < 0 || subsystem >= LOG_SUBSYSTEM_COUNT) {
+        return;
+    }
+    if (enabled) {
+        log_mask |= 1u << subsystem;
+    } else {
+        log_mask &= ~(1u << subsystem);
+    }
+}
+
+int log_subsystem_by_name(const char* name) {
+    for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++) {
+        if (strcmp(subsystem_names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Copies a committed record out of the ring. Returns false if it has not
+// been published yet or was overwritten while being copied.
+static bool log_read_record(uint32_t seq, LogRecord* out) {
+    LogRecord* record = &log_ring[seq & (LOG_RING_SIZE - 1)];
+    if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+        return false;
+    }
+    *out = *record;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&record->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+// Drains records logged since the last flush to the VGA console and the
+// serial port. Called from a worker task once something is logged and
+// before the shell prompts, never from the code doing the logging.
+void log_flush() {
+    if (__atomic_exchange_n(&log_flushing, 1, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    uint32_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+    if (head - log_console_seq > LOG_RING_SIZE) {
+        char notice[48];
+        snprintf(notice, sizeof(notice), "[log: %u messages dropped]\n",
+                 head - log_console_seq - LOG_RING_SIZE);
+        vga_write(notice);
+        serial_write(notice);
+        log_console_seq = head - LOG_RING_SIZE;
+    }
+
+    LogRecord record;
+    while (log_console_seq != head) {
+        if (!log_read_record(log_console_seq, &record)) {
+            // Either still being written, or lapped while we copied it
+            if (head - log_console_seq >= LOG_RING_SIZE) {
+                log_console_seq++;
+                continue;
+            }
+            break;
+        }
+        vga_write(record.message);
+        serial_write(record.message);
+        log_console_seq++;
+    }
+    vga_flush();
+
+    __atomic_store_n(&log_flushing, 0, __ATOMIC_RELEASE);
+}
+
+// Writes every record still held in the ring, oldest first
+void log_dump(void (*write)(const char* message)) {
+    uint32_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+    uint32_t seq = head > LOG_RING_SIZE ? head - LOG_RING_SIZE : 0;
+
+    LogRecord record;
+    char line[LOG_MESSAGE_MAX + 32];
+    for (; seq != head; seq++) {
+        if (!log_read_record(seq, &record)) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "[%u] %s %s: %s", seq, level_names[record.level],
+                 subsystem_names[record.subsystem], record.message);
+        write(line);
+    }
+}
@@ -1,5 +1,6 @@
 global long_mode_start
 extern kernel_main
+extern boot_asm_tsc
 
 section .text
 bits 64
@@ -12,7 +13,14 @@ long_mode_start:
     mov fs, ax
     mov gs, ax
 
-    ; call the kernel main function
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov [boot_asm_tsc + 16], rax   ; boot_asm_tsc[BOOT_TSC_LONG_MODE]
+
+    ; call the kernel main function with the multiboot info pointer boot.asm
+    ; saved in edi; the upper half of rdi is undefined after the mode switch
+    mov edi, edi
     call kernel_main
 
     ; print `OKAY` to screen
@@ -1,30 +1,48 @@
 #include "memory.h"
-#include "vga.h"
+#include "log.h"
+#include "spinlock.h"
+#include "string.h"
 
 #define BITMAP_SIZE 32768 // 32768 * 64 = 2097152 pages = 8GB of RAM
 
+#ifdef HOSTED
+// The hosted build supplies ordinary arrays in place of the fixed kernel addresses
+extern uint64_t hosted_phys_bitmap[];
+extern uint8_t hosted_heap[];
+#define PHYS_BITMAP_ADDR ((uint64_t)hosted_phys_bitmap)
+#define HEAP_START ((uint64_t)hosted_heap)
+#else
+#define PHYS_BITMAP_ADDR 0xffffffff80200000
+#define HEAP_START 0xffffffff80400000
+#endif
+
 static uint64_t* physical_bitmap;
 static uint64_t total_pages;
 static uint64_t free_pages;
+static spinlock_t physical_lock = SPINLOCK_INIT("physical");
 
 // Heap
-#define HEAP_START 0xffffffff80400000
 #define HEAP_SIZE  0x400000 // 4MB initial heap
 
 typedef struct HeapBlock {
     size_t size;
     bool is_free;
     struct HeapBlock* next;
-} HeapBlock;
+} __attribute__((aligned(16))) HeapBlock; // Keeps payloads 16-byte aligned
 
 static HeapBlock* heap_start;
+static uint64_t heap_allocs;
+static uint64_t heap_frees;
+// Any CPU may allocate, so waiters queue MCS-style instead of all spinning
+// on the lock word
+static mcs_lock_t heap_lock = MCS_LOCK_INIT("heap");
 
 void init_physical_memory(uint64_t mem_size) {
     total_pages = mem_size / PAGE_SIZE;
     free_pages = total_pages;
 
     // Allocate bitmap at a fixed address
-    physical_bitmap = (uint64_t*)0xffffffff80200000;
+    physical_bitmap = (uint64_t*)PHYS_BITMAP_ADDR;
     
     // Clear bitmap
     for (uint64_t i = 0; i < BITMAP_SIZE; i++) {
@@ -42,17 +60,20 @@ void init_physical_memory(uint64_t mem_size) {
 }
 
 void* allocate_physical_page() {
+    uint64_t flags = spin_lock_irqsave(&physical_lock);
     for (uint64_t i = 0; i < BITMAP_SIZE; i++) {
         if (physical_bitmap[i] != 0xFFFFFFFFFFFFFFFF) {
             for (int j = 0; j < 64; j++) {
                 if ((physical_bitmap[i] & (1ULL << j)) == 0) {
                     physical_bitmap[i] |= (1ULL << j);
                     free_pages--;
+                    spin_unlock_irqrestore(&physical_lock, flags);
                     return (void*)((i * 64 + j) * PAGE_SIZE);
                 }
             }
         }
     }
+    spin_unlock_irqrestore(&physical_lock, flags);
     return NULL;
 }
 
@@ -60,20 +81,34 @@ void free_physical_page(void* page) {
     uint64_t page_num = (uint64_t)page / PAGE_SIZE;
     uint64_t idx = page_num / 64;
     uint64_t bit = page_num % 64;
+    uint64_t flags = spin_lock_irqsave(&physical_lock);
     physical_bitmap[idx] &= ~(1ULL << bit);
     free_pages++;
+    spin_unlock_irqrestore(&physical_lock, flags);
 }
 
-// Page table manipulation functions
-static uint64_t* get_next_level(uint64_t* table, uint64_t index, bool allocate) {
+#ifndef HOSTED
+#define PML4_USER_SLOT (USER_BASE >> 39)
+#define ENTRY_ADDRESS_MASK 0x000FFFFFFFFFF000ULL
+
+static uint64_t kernel_cr3;
+
+// Page table manipulation functions. New tables are zeroed and linked with
+// table_flags, which must include PAGE_USER for anything user code reaches.
+static uint64_t* get_next_level_flags(uint64_t* table, uint64_t index, bool allocate, uint64_t table_flags) {
     if ((table[index] & 1) == 0) {
         if (!allocate) return NULL;
         uint64_t new_table = (uint64_t)allocate_physical_page();
         if (new_table == 0) return NULL;
-        table[index] = new_table | 3; // present + writable
+        memset((void*)(new_table + KERNEL_BASE), 0, PAGE_SIZE);
+        table[index] = new_table | table_flags;
         return (uint64_t*)(new_table + KERNEL_BASE);
     }
-    return (uint64_t*)((table[index] & ~0xFFF) + KERNEL_BASE);
+    return (uint64_t*)((table[index] & ENTRY_ADDRESS_MASK) + KERNEL_BASE);
+}
+
+static uint64_t* get_next_level(uint64_t* table, uint64_t index, bool allocate) {
+    return get_next_level_flags(table, index, allocate, PAGE_PRESENT | PAGE_WRITABLE);
 }
 
 void map_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags) {
@@ -124,17 +159,106 @@ uint64_t get_physical_address(uint64_t virtual_addr) {
     return (pt[pt_index] & ~0xFFF) | (virtual_addr & 0xFFF);
 }
 
+uint64_t kernel_address_space() {
+    return kernel_cr3;
+}
+
+// A new PML4 sharing every kernel slot, with an empty user slot. Returns 0
+// when out of memory.
+uint64_t address_space_create() {
+    uint64_t cr3 = (uint64_t)allocate_physical_page();
+    if (!cr3) {
+        return 0;
+    }
+    uint64_t* pml4 = (uint64_t*)(cr3 + KERNEL_BASE);
+    memcpy(pml4, (uint64_t*)(kernel_cr3 + KERNEL_BASE), PAGE_SIZE);
+    pml4[PML4_USER_SLOT] = 0;
+    return cr3;
+}
+
+// Frees the user slot's tables and every page mapped through them without
+// PAGE_SHARED. The address space must not be loaded on any CPU.
+void address_space_destroy(uint64_t cr3) {
+    uint64_t* pml4 = (uint64_t*)(cr3 + KERNEL_BASE);
+    uint64_t* pdpt = get_next_level(pml4, PML4_USER_SLOT, false);
+    for (int i = 0; pdpt && i < 512; i++) {
+        uint64_t* pd = get_next_level(pdpt, i, false);
+        for (int j = 0; pd && j < 512; j++) {
+            uint64_t* pt = get_next_level(pd, j, false);
+            for (int k = 0; pt && k < 512; k++) {
+                if ((pt[k] & PAGE_PRESENT) && !(pt[k] & PAGE_SHARED)) {
+                    free_physical_page((void*)(pt[k] & ENTRY_ADDRESS_MASK));
+                }
+            }
+            if (pt) {
+                free_physical_page((void*)(pd[j] & ENTRY_ADDRESS_MASK));
+            }
+        }
+        if (pd) {
+            free_physical_page((void*)(pdpt[i] & ENTRY_ADDRESS_MASK));
+        }
+    }
+    if (pdpt) {
+        free_physical_page((void*)(pml4[PML4_USER_SLOT] & ENTRY_ADDRESS_MASK));
+    }
+    free_physical_page((void*)cr3);
+}
+
+// Maps one page into the user slot of the address space; flags should
+// include PAGE_USER. False if the address is outside the user slot or
+// memory runs out.
+bool map_user_page(uint64_t cr3, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags) {
+    if (virtual_addr < USER_BASE || virtual_addr >= USER_TOP) {
+        return false;
+    }
+    uint64_t table_flags = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    uint64_t* pml4 = (uint64_t*)(cr3 + KERNEL_BASE);
+    uint64_t* pdpt = get_next_level_flags(pml4, (virtual_addr >> 39) & 0x1FF, true, table_flags);
+    uint64_t* pd = pdpt ? get_next_level_flags(pdpt, (virtual_addr >> 30) & 0x1FF, true, table_flags) : NULL;
+    uint64_t* pt = pd ? get_next_level_flags(pd, (virtual_addr >> 21) & 0x1FF, true, table_flags) : NULL;
+    if (!pt) {
+        return false;
+    }
+    pt[(virtual_addr >> 12) & 0x1FF] = physical_addr | flags;
+    return true;
+}
+
+// Whether [addr, addr + size) lies in the user slot and every page of it is
+// mapped for user access in the current address space, writable if asked.
+// Syscalls check this before touching user buffers, since a fault in the
+// kernel is fatal.
+bool user_access_ok(const void* addr, size_t size, bool write) {
+    uint64_t start = (uint64_t)addr;
+    if (start < USER_BASE || size > USER_TOP - start) {
+        return false;
+    }
+    uint64_t need = PAGE_PRESENT | PAGE_USER | (write ? PAGE_WRITABLE : 0);
+    uint64_t* pml4 = (uint64_t*)(read_cr3() + KERNEL_BASE);
+    for (uint64_t page = start & ~(uint64_t)(PAGE_SIZE - 1); page < start + size; page += PAGE_SIZE) {
+        uint64_t* pdpt = get_next_level(pml4, (page >> 39) & 0x1FF, false);
+        uint64_t* pd = pdpt ? get_next_level(pdpt, (page >> 30) & 0x1FF, false) : NULL;
+        uint64_t* pt = pd ? get_next_level(pd, (page >> 21) & 0x1FF, false) : NULL;
+        if (!pt || (pt[(page >> 12) & 0x1FF] & need) != need) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif // HOSTED
+
 void init_heap() {
     heap_start = (HeapBlock*)HEAP_START;
     heap_start->size = HEAP_SIZE - sizeof(HeapBlock);
     heap_start->is_free = true;
     heap_start->next = NULL;
+    heap_allocs = 0;
+    heap_frees = 0;
 
     // Map heap pages
     for (uint64_t addr = HEAP_START; addr < HEAP_START + HEAP_SIZE; addr += PAGE_SIZE) {
         void* page = allocate_physical_page();
         if (page == NULL) {
-            vga_writestring("Failed to allocate heap pages\n");
+            log_error(LOG_MEM, "Failed to allocate heap pages\n");
             return;
         }
         map_page(addr, (uint64_t)page, 3); // present + writable
@@ -144,6 +268,8 @@ void init_heap() {
 void* kmalloc(size_t size) {
     size = (size + 15) & ~15; // Align to 16 bytes
 
+    McsNode node;
+    uint64_t flags = mcs_lock_irqsave(&heap_lock, &node);
     HeapBlock* current = heap_start;
     while (current) {
         if (current->is_free && current->size >= size + sizeof(HeapBlock)) {
@@ -158,10 +284,13 @@ void* kmalloc(size_t size) {
                 current->next = new_block;
             }
             current->is_free = false;
+            heap_allocs++;
+            mcs_unlock_irqrestore(&heap_lock, &node, flags);
             return (void*)((char*)current + sizeof(HeapBlock));
         }
         current = current->next;
     }
+    mcs_unlock_irqrestore(&heap_lock, &node, flags);
     return NULL; // Out of memory
 }
 
@@ -169,7 +298,10 @@ void kfree(void* ptr) {
     if (!ptr) return;
 
     HeapBlock* block = (HeapBlock*)((char*)ptr - sizeof(HeapBlock));
+    McsNode node;
+    uint64_t flags = mcs_lock_irqsave(&heap_lock, &node);
     block->is_free = true;
+    heap_frees++;
 
     // Coalesce with next block if it's free
     if (block->next && block->next->is_free) {
@@ -186,8 +318,10 @@ void kfree(void* ptr) {
         prev->size += sizeof(HeapBlock) + block->size;
         prev->next = block->next;
     }
+    mcs_unlock_irqrestore(&heap_lock, &node, flags);
 }
 
+#ifndef HOSTED
 uint64_t read_cr3() {
     uint64_t cr3;
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
@@ -197,14 +331,18 @@ uint64_t read_cr3() {
 void write_cr3(uint64_t value) {
     asm volatile("mov %0, %%cr3" : : "r"(value));
 }
+#endif // HOSTED
 
 void get_memory_info(MemoryInfo* info) {
     info->total_memory = total_pages * PAGE_SIZE;
     info->free_memory = free_pages * PAGE_SIZE;
     info->used_memory = (total_pages - free_pages) * PAGE_SIZE;
     info->reserved_memory = 1024 * 1024; // 1MB reserved
+    info->heap_allocs = heap_allocs;
+    info->heap_frees = heap_frees;
 }
 
+#ifndef HOSTED
 void init_virtual_memory() {
     // Identity map the first 1GB
     for (uint64_t addr = 0; addr < 0x40000000; addr += PAGE_SIZE) {
@@ -218,4 +356,6 @@ void init_virtual_memory() {
 
     // Load new page table
     write_cr3(read_cr3());
+    kernel_cr3 = read_cr3();
 }
+#endif // HOSTED
@@ -0,0 +1,89 @@
+#include "multiboot.h"
+#include "string.h"
+
+typedef struct {
+    uint32_t total_size;
+    uint32_t reserved;
+} __attribute__((packed)) MultibootInfo;
+
+#define MULTIBOOT_INFO_MAX 8192
+
+// GRUB leaves the info block in memory the page allocator does not know is
+// taken, so it is copied out before anything is allocated
+static uint8_t info_copy[MULTIBOOT_INFO_MAX] __attribute__((aligned(8)));
+static const MultibootInfo* boot_info = NULL;
+
+void multiboot_init(uint64_t info_address) {
+    if (!info_address) {
+        return;
+    }
+    const MultibootInfo* info = (const MultibootInfo*)info_address;
+    uint32_t size = info->total_size;
+    if (size > MULTIBOOT_INFO_MAX) {
+        size = MULTIBOOT_INFO_MAX; // Later tags are dropped
+    }
+    memcpy(info_copy, info, size);
+    boot_info = (const MultibootInfo*)info_copy;
+    ((MultibootInfo*)info_copy)->total_size = size;
+}
+
+const MultibootTag* multiboot_find_tag(uint32_t type) {
+    if (!boot_info) {
+        return NULL;
+    }
+
+    const uint8_t* end = (const uint8_t*)boot_info + boot_info->total_size;
+    const uint8_t* p = (const uint8_t*)boot_info + sizeof(MultibootInfo);
+    while (p + sizeof(MultibootTag) <= end) {
+        const MultibootTag* tag = (const MultibootTag*)p;
+        if (tag->type == MULTIBOOT_TAG_END) {
+            break;
+        }
+        if (tag->type == type) {
+            return tag;
+        }
+        p += (tag->size + 7) & ~7u; // Tags are 8-byte aligned
+    }
+    return NULL;
+}
+
+const char* multiboot_cmdline() {
+    const MultibootTag* tag = multiboot_find_tag(MULTIBOOT_TAG_CMDLINE);
+    return tag ? (const char*)(tag + 1) : "";
+}
+
+// Finds "key=value" among the space-separated words of the command line
+bool multiboot_cmdline_value(const char* key, char* value, size_t value_size) {
+    const char* p = multiboot_cmdline();
+    size_t key_length = strlen(key);
+
+    while (*p) {
+        while (*p == ' ') {
+            p++;
+        }
+        const char* word = p;
+        while (*p && *p != ' ') {
+            p++;
+        }
+        if ((size_t)(p - word) > key_length && word[key_length] == '=' &&
+            memcmp(word, key, key_length) == 0) {
+            size_t length = p - word - key_length - 1;
+            if (length >= value_size) {
+                length = value_size - 1;
+            }
+            memcpy(value, word + key_length + 1, length);
+            value[length] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+// GRUB copies the RSDP into the boot information; returns its address there
+uint64_t multiboot_rsdp() {
+    const MultibootTag* tag = multiboot_find_tag(MULTIBOOT_TAG_ACPI_NEW);
+    if (!tag) {
+        tag = multiboot_find_tag(MULTIBOOT_TAG_ACPI_OLD);
+    }
+    return tag ? (uint64_t)(tag + 1) : 0;
+}
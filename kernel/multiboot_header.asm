@@ -0,0 +1,24 @@
+; Multiboot2 header GRUB looks for in the first 32KiB of the image
+section .multiboot_header
+header_start:
+    dd 0xe85250d6                ; magic number (multiboot 2)
+    dd 0                         ; architecture 0 (protected mode i386)
+    dd header_end - header_start ; header length
+    ; checksum
+    dd 0x100000000 - (0xe85250d6 + 0 + (header_end - header_start))
+
+    ; framebuffer tag: ask for a linear 32bpp framebuffer; optional, so
+    ; GRUB may still leave us in VGA text mode
+    dw 5    ; type
+    dw 1    ; flags (optional)
+    dd 20   ; size
+    dd 1024 ; width
+    dd 768  ; height
+    dd 32   ; depth
+    align 8, db 0 ; tags are 8-byte aligned
+
+    ; end tag
+    dw 0    ; type
+    dw 0    ; flags
+    dd 8    ; size
+header_end:
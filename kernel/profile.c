@@ -0,0 +1,199 @@
+#include "profile.h"
+#include "cpu.h"
+#include "log.h"
+#include "memory.h"
+#include "serial.h"
+#include "smp.h"
+#include "string.h"
+#include "task.h"
+#include "timer.h"
+
+#define PROF_FORMAT_VERSION 1
+#define PROF_MAX_TASK_NAMES 64
+#define PROF_FLAG_USER 0x1
+
+// Samples are written only by their own CPU, in its timer interrupt; count
+// is published after the sample so a reader never sees a partial one
+typedef struct {
+    ProfSample* samples;
+    volatile uint32_t count;
+    uint32_t dropped;       // Ticks that found the buffer full
+    uint32_t ticks;         // Since the last sample
+} ProfBuffer;
+
+static ProfBuffer buffers[MAX_CPUS];
+static volatile bool running = false;
+static uint32_t interval_ticks = 1;
+static uint32_t interval_ms = 1;
+
+static const char base64_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Clears every CPU's buffer and starts sampling each interval_ms. Buffers
+// are allocated on first use and kept; false if there is no memory for them.
+bool profile_start(uint32_t interval) {
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    for (int i = 0; i < smp_cpu_count(); i++) {
+        if (!buffers[i].samples) {
+            buffers[i].samples = kmalloc(PROF_SAMPLES_PER_CPU * sizeof(ProfSample));
+            if (!buffers[i].samples) {
+                log_error(LOG_KERNEL, "Error: Out of memory for CPU %d's profile buffer\n", i);
+                return false;
+            }
+        }
+        __atomic_store_n(&buffers[i].count, 0, __ATOMIC_RELAXED);
+        buffers[i].dropped = 0;
+        buffers[i].ticks = 0;
+    }
+    interval_ms = interval ? interval : 1;
+    interval_ticks = interval_ms * TIMER_HZ / 1000;
+    if (interval_ticks == 0) {
+        interval_ticks = 1;
+    }
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+void profile_stop() {
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+}
+
+// Follows the rbp chain of the interrupted kernel code. Every frame must lie
+// above the last and inside the stack the code was running on, so a missing
+// or corrupt frame pointer ends the walk instead of faulting.
+static int walk_stack(Task* task, InterruptFrame* frame, uint64_t* stack) {
+    uint64_t low = frame->rsp;
+    uint64_t high;
+    if (task && task->stack_base) {
+        if (low < task->stack_base || low >= task->stack_base + STACK_SIZE) {
+            return 0;
+        }
+        high = task->stack_base + STACK_SIZE;
+    } else {
+        high = low + STACK_SIZE; // The boot stack, in identity-mapped memory
+    }
+
+    uint64_t rbp = frame->rbp;
+    int depth = 0;
+    while (depth < PROF_MAX_DEPTH && rbp >= low && rbp + 16 <= high && !(rbp & 7)) {
+        uint64_t* words = (uint64_t*)rbp;
+        if (!words[1]) {
+            break; // The zero return address task stacks start with
+        }
+        stack[depth++] = words[1];
+        low = rbp + 16;
+        rbp = words[0];
+    }
+    return depth;
+}
+
+// Called from every CPU's timer interrupt
+void profile_tick(InterruptFrame* frame) {
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    ProfBuffer* buffer = &buffers[this_cpu()->id];
+    if (!buffer->samples || ++buffer->ticks < interval_ticks) {
+        return; // No buffer: the CPU came online after profile_start
+    }
+    buffer->ticks = 0;
+    uint32_t count = buffer->count;
+    if (count == PROF_SAMPLES_PER_CPU) {
+        buffer->dropped++;
+        return;
+    }
+
+    Task* task = current_task();
+    ProfSample* sample = &buffer->samples[count];
+    sample->rip = frame->rip;
+    sample->task_id = task ? task->id : -1;
+    sample->user = (frame->cs & 3) != 0;
+    sample->depth = sample->user ? 0 : walk_stack(task, frame, sample->stack);
+    __atomic_store_n(&buffer->count, count + 1, __ATOMIC_RELEASE);
+}
+
+static size_t base64_encode(const uint8_t* data, size_t size, char* out) {
+    size_t length = 0;
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t chunk = (uint32_t)data[i] << 16;
+        if (i + 1 < size) {
+            chunk |= (uint32_t)data[i + 1] << 8;
+        }
+        if (i + 2 < size) {
+            chunk |= data[i + 2];
+        }
+        out[length++] = base64_digits[(chunk >> 18) & 63];
+        out[length++] = base64_digits[(chunk >> 12) & 63];
+        out[length++] = i + 1 < size ? base64_digits[(chunk >> 6) & 63] : '=';
+        out[length++] = i + 2 < size ? base64_digits[chunk & 63] : '=';
+    }
+    out[length] = '\0';
+    return length;
+}
+
+// Streams the samples to serial, stopping the profiler first. Each is one
+// "PROF:S" line holding a base64 record, so log output interleaved with
+// the dump does no harm:
+//   u8 cpu, u8 flags (PROF_FLAG_USER), u8 depth, u8 0, i32 task id,
+//   u64 rip, then depth u64 return addresses, innermost first
+// "PROF:TASK" lines name the tasks that were seen, where still alive.
+void profile_dump() {
+    profile_stop();
+    char line[160];
+    int cpus = smp_cpu_count();
+    snprintf(line, sizeof(line), "PROF:BEGIN %d %d %u\n", PROF_FORMAT_VERSION, cpus, interval_ms);
+    serial_write(line);
+
+    int task_ids[PROF_MAX_TASK_NAMES];
+    int task_count = 0;
+    uint32_t total = 0;
+    uint32_t dropped = 0;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        ProfBuffer* buffer = &buffers[cpu];
+        uint32_t count = __atomic_load_n(&buffer->count, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < count; i++) {
+            ProfSample* sample = &buffer->samples[i];
+            uint8_t record[16 + PROF_MAX_DEPTH * 8];
+            record[0] = cpu;
+            record[1] = sample->user ? PROF_FLAG_USER : 0;
+            record[2] = sample->depth;
+            record[3] = 0;
+            memcpy(record + 4, &sample->task_id, 4);
+            memcpy(record + 8, &sample->rip, 8);
+            memcpy(record + 16, sample->stack, sample->depth * 8);
+            memcpy(line, "PROF:S ", 7);
+            size_t length = 7 + base64_encode(record, 16 + sample->depth * 8, line + 7);
+            line[length] = '\n';
+            line[length + 1] = '\0';
+            serial_write(line);
+
+            int seen = 0;
+            while (seen < task_count && task_ids[seen] != sample->task_id) {
+                seen++;
+            }
+            if (seen == task_count && task_count < PROF_MAX_TASK_NAMES) {
+                task_ids[task_count++] = sample->task_id;
+            }
+        }
+        total += count;
+        dropped += buffer->dropped;
+    }
+
+    for (int i = 0; i < task_count; i++) {
+        char name[32];
+        if (task_get_name(task_ids[i], name, sizeof(name))) {
+            snprintf(line, sizeof(line), "PROF:TASK %d %s\n", task_ids[i], name);
+            serial_write(line);
+        }
+    }
+    snprintf(line, sizeof(line), "PROF:END %u %u\n", total, dropped);
+    serial_write(line);
+}
+
+void profile_status(char* buffer, size_t buffer_size) {
+    size_t offset = snprintf(buffer, buffer_size, "Profiler: %s, every %u ms\nCPU  SAMPLES  DROPPED\n",
+                             running ? "running" : "stopped", interval_ms);
+    for (int i = 0; i < smp_cpu_count() && offset < buffer_size - 1; i++) {
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-3d %8u %8u\n", i,
+                           __atomic_load_n(&buffers[i].count, __ATOMIC_RELAXED), buffers[i].dropped);
+    }
+}
@@ -0,0 +1,87 @@
+#include "ring.h"
+#include "string.h"
+
+void spsc_init(SpscRing* ring, void* buffer, uint32_t entry_size, uint32_t capacity) {
+    ring->buffer = buffer;
+    ring->entry_size = entry_size;
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+// Producer side; false if the ring is full
+bool spsc_push(SpscRing* ring, const void* entry) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        return false;
+    }
+    memcpy(ring->buffer + (head & ring->mask) * ring->entry_size, entry, ring->entry_size);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Consumer side; false if the ring is empty
+bool spsc_pop(SpscRing* ring, void* entry) {
+    uint32_t tail = ring->tail;
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+    memcpy(entry, ring->buffer + (tail & ring->mask) * ring->entry_size, ring->entry_size);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t spsc_count(const SpscRing* ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+// A slot's sequence equals the position that may be written into it next,
+// and that position plus one once the entry is ready to read
+void mpsc_init(MpscRing* ring, void* buffer, uint32_t* sequence, uint32_t entry_size,
+               uint32_t capacity) {
+    ring->buffer = buffer;
+    ring->sequence = sequence;
+    ring->entry_size = entry_size;
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        sequence[i] = i;
+    }
+}
+
+bool mpsc_push(MpscRing* ring, const void* entry) {
+    uint32_t position = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    while (1) {
+        uint32_t sequence = __atomic_load_n(&ring->sequence[position & ring->mask], __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(sequence - position);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->head, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // The consumer has not freed this slot yet
+        } else {
+            position = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    uint32_t slot = position & ring->mask;
+    memcpy(ring->buffer + slot * ring->entry_size, entry, ring->entry_size);
+    __atomic_store_n(&ring->sequence[slot], position + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool mpsc_pop(MpscRing* ring, void* entry) {
+    uint32_t position = ring->tail;
+    uint32_t slot = position & ring->mask;
+    if (__atomic_load_n(&ring->sequence[slot], __ATOMIC_ACQUIRE) != position + 1) {
+        return false;
+    }
+    memcpy(entry, ring->buffer + slot * ring->entry_size, ring->entry_size);
+    __atomic_store_n(&ring->sequence[slot], position + ring->mask + 1, __ATOMIC_RELEASE);
+    ring->tail = position + 1;
+    return true;
+}
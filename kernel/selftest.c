@@ -0,0 +1,486 @@
+#include "selftest.h"
+#include "string.h"
+#include "memory.h"
+#include "filesystem.h"
+#include "compress.h"
+#include "elf.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "seqlock.h"
+#include "ring.h"
+#include "ktimer.h"
+
+static void (*report_fn)(const char* message);
+static int failures;
+static int checks;
+
+#define CHECK(cond) check((cond), #cond, __func__)
+
+static void check(bool ok, const char* expr, const char* test) {
+    checks++;
+    if (ok) return;
+    failures++;
+    char buffer[160];
+    snprintf(buffer, sizeof(buffer), "FAIL %s: %s\n", test, expr);
+    report_fn(buffer);
+}
+
+static void test_string() {
+    char buffer[32];
+
+    CHECK(strlen("") == 0);
+    CHECK(strlen("zernel") == 6);
+    CHECK(strcmp("abc", "abc") == 0);
+    CHECK(strcmp("abc", "abd") < 0);
+    CHECK(strcmp("b", "a") > 0);
+
+    memset(buffer, 'x', sizeof(buffer));
+    CHECK(buffer[0] == 'x' && buffer[31] == 'x');
+
+    memcpy(buffer, "hello", 6);
+    CHECK(strcmp(buffer, "hello") == 0);
+
+    strncpy(buffer, "abc", 8);
+    CHECK(buffer[3] == '\0' && buffer[7] == '\0');
+
+    CHECK(strchr("kernel", 'n') != NULL);
+    CHECK(strchr("kernel", 'z') == NULL);
+
+    snprintf(buffer, sizeof(buffer), "%s=%d", "x", -42);
+    CHECK(strcmp(buffer, "x=-42") == 0);
+
+    snprintf(buffer, sizeof(buffer), "%u %x %llu %%", 7u, 0xbeefu, 12345678901ULL);
+    CHECK(strcmp(buffer, "7 beef 12345678901 %") == 0);
+
+    snprintf(buffer, sizeof(buffer), "[%5d|%-4s|%04x]", 42, "ab", 0x1f);
+    CHECK(strcmp(buffer, "[   42|ab  |001f]") == 0);
+
+    snprintf(buffer, 6, "%s", "truncated");
+    CHECK(strcmp(buffer, "trunc") == 0);
+
+    int_to_string(1234, buffer);
+    CHECK(strcmp(buffer, "1234") == 0);
+}
+
+typedef void* (*memcpy_fn)(void* dest, const void* src, size_t n);
+typedef void* (*memset_fn)(void* s, int c, size_t n);
+
+// Every variant against the byte loops, across alignments and sizes that
+// straddle the word, unroll and rep thresholds
+static void test_string_variants() {
+    static uint8_t src[600];
+    static uint8_t dst[608];
+    static uint8_t expect[608];
+    memcpy_fn copies[] = { memcpy_words, memcpy_erms };
+    memset_fn sets[] = { memset_words, memset_erms };
+    int variants = string_has_erms() ? 2 : 1;
+    static const size_t sizes[] = { 0, 1, 7, 8, 9, 31, 33, 255, 256, 257, 520 };
+    bool copy_ok = true, set_ok = true, move_ok = true;
+
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = (uint8_t)(i * 7 + 3);
+    }
+    for (int v = 0; v < variants; v++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            for (size_t offset = 0; offset < 8; offset++) {
+                size_t n = sizes[s];
+                memset_bytes(dst, 0xAA, sizeof(dst));
+                memset_bytes(expect, 0xAA, sizeof(expect));
+                memcpy_bytes(expect + offset, src + 7 - offset, n);
+                copies[v](dst + offset, src + 7 - offset, n);
+                copy_ok &= memcmp(dst, expect, sizeof(dst)) == 0;
+
+                memset_bytes(expect + offset, 0x5C, n);
+                sets[v](dst + offset, 0x5C, n);
+                set_ok &= memcmp(dst, expect, sizeof(dst)) == 0;
+            }
+        }
+    }
+    CHECK(copy_ok);
+    CHECK(set_ok);
+
+    // Overlapping moves in both directions
+    for (size_t shift = 1; shift < 12; shift++) {
+        memcpy_bytes(dst, src, 300);
+        memmove(dst + shift, dst, 280);
+        move_ok &= memcmp(dst + shift, src, 280) == 0;
+        memcpy_bytes(dst, src, 300);
+        memmove(dst, dst + shift, 280);
+        move_ok &= memcmp(dst, src + shift, 280) == 0;
+    }
+    CHECK(move_ok);
+
+    // Word-at-a-time strlen and strcmp from every starting alignment
+    bool str_ok = true;
+    for (size_t offset = 0; offset < 8; offset++) {
+        char* a = (char*)dst + offset;
+        char* b = (char*)expect + offset;
+        for (size_t len = 0; len < 20; len++) {
+            memset_bytes(a, 'k', len);
+            a[len] = '\0';
+            memcpy_bytes(b, a, len + 1);
+            str_ok &= strlen(a) == len && strcmp(a, b) == 0;
+            if (len > 0) {
+                b[len - 1] = 'm';
+                str_ok &= strcmp(a, b) < 0 && strcmp(b, a) > 0;
+            }
+        }
+    }
+    CHECK(str_ok);
+    CHECK(strcmp("abc", "abcd") < 0 && strcmp("abcdefghij", "abcdefgh") > 0);
+}
+
+static void test_heap() {
+    MemoryInfo before;
+    get_memory_info(&before);
+
+    uint8_t* a = kmalloc(24);
+    uint8_t* b = kmalloc(100);
+    uint8_t* c = kmalloc(3000);
+    CHECK(a && b && c);
+    CHECK(((uint64_t)a & 15) == 0 && ((uint64_t)b & 15) == 0 && ((uint64_t)c & 15) == 0);
+
+    memset(a, 0xAA, 24);
+    memset(c, 0xCC, 3000);
+    memset(b, 0xBB, 100);
+    CHECK(a[23] == 0xAA && b[0] == 0xBB && b[99] == 0xBB && c[0] == 0xCC);
+
+    kfree(b);
+    uint8_t* d = kmalloc(64);
+    CHECK(d != NULL);
+    memset(d, 0xDD, 64);
+    CHECK(a[23] == 0xAA && c[0] == 0xCC && c[2999] == 0xCC);
+
+    kfree(a);
+    kfree(d);
+    kfree(c);
+
+    MemoryInfo after;
+    get_memory_info(&after);
+    CHECK(after.heap_allocs - before.heap_allocs == 4);
+    CHECK(after.heap_frees - before.heap_frees == 4);
+
+    // Everything freed should have coalesced back into one large block
+    void* big = kmalloc(64 * 1024);
+    CHECK(big != NULL);
+    kfree(big);
+}
+
+static void test_physical_pages() {
+    MemoryInfo before;
+    get_memory_info(&before);
+
+    void* p1 = allocate_physical_page();
+    void* p2 = allocate_physical_page();
+    CHECK(p1 != NULL && p2 != NULL && p1 != p2);
+    CHECK(((uint64_t)p1 % PAGE_SIZE) == 0);
+    CHECK((uint64_t)p1 >= 1024 * 1024); // Low 1MB is reserved
+
+    MemoryInfo during;
+    get_memory_info(&during);
+    CHECK(before.free_memory - during.free_memory == 2 * PAGE_SIZE);
+
+    free_physical_page(p2);
+    free_physical_page(p1);
+    get_memory_info(&during);
+    CHECK(during.free_memory == before.free_memory);
+}
+
+static void test_compress() {
+    static uint8_t input[MAX_FILE_SIZE];
+    static uint8_t packed[LZ_COMPRESS_BOUND(MAX_FILE_SIZE)];
+    static uint8_t output[MAX_FILE_SIZE];
+
+    for (int i = 0; i < MAX_FILE_SIZE; i++) {
+        input[i] = "the quick brown fox "[i % 20];
+    }
+    int packed_size = lz_compress(input, sizeof(input), packed, sizeof(packed));
+    CHECK(packed_size > 0 && packed_size < MAX_FILE_SIZE / 8);
+    CHECK(lz_decompress(packed, packed_size, output, sizeof(output)) == MAX_FILE_SIZE);
+    CHECK(memcmp(input, output, MAX_FILE_SIZE) == 0);
+
+    // Tiny inputs are stored as literals
+    packed_size = lz_compress((const uint8_t*)"abc", 3, packed, sizeof(packed));
+    CHECK(lz_decompress(packed, packed_size, output, sizeof(output)) == 3);
+    CHECK(output[0] == 'a' && output[2] == 'c');
+
+    // Output that does not fit must be rejected rather than overrun
+    packed_size = lz_compress(input, sizeof(input), packed, sizeof(packed));
+    CHECK(lz_decompress(packed, packed_size, output, 100) == -1);
+}
+
+static void test_filesystem() {
+    static char data[MAX_FILE_SIZE];
+    static char buffer[MAX_FILE_SIZE];
+
+    CHECK(fs_create("st_a.txt") >= 0);
+    CHECK(fs_create("st_a.txt") == -2);
+    CHECK(fs_write("st_a.txt", "Hello", 5) == 5);
+    CHECK(fs_read("st_a.txt", buffer, sizeof(buffer)) == 5);
+    CHECK(buffer[0] == 'H' && buffer[4] == 'o');
+    CHECK(fs_read("st_missing.txt", buffer, sizeof(buffer)) == -1);
+
+    // Positional writes keep the rest of the file and zero-fill any gap
+    CHECK(fs_pwrite("st_a.txt", "XY", 2, 3) == 2);
+    CHECK(fs_pread("st_a.txt", buffer, 2, 3) == 2);
+    CHECK(buffer[0] == 'X' && buffer[1] == 'Y');
+    CHECK(fs_pwrite("st_a.txt", "!", 1, 8) == 1);
+    CHECK(fs_pread("st_a.txt", buffer, sizeof(buffer), 4) == 5);
+    CHECK(buffer[0] == 'Y' && buffer[1] == 0 && buffer[4] == '!');
+    CHECK(fs_pread("st_a.txt", buffer, 1, 9) == 0);
+    CHECK(fs_pwrite("st_a.txt", "x", 1, MAX_FILE_SIZE + 1) == -1);
+
+    // A cold, compressible file is compressed and reads back unchanged
+    for (int i = 0; i < MAX_FILE_SIZE; i++) {
+        data[i] = "0123456789abcdef"[(i / 7) % 16];
+    }
+    CHECK(fs_create("st_cold.txt") >= 0);
+    CHECK(fs_write("st_cold.txt", data, sizeof(data)) == MAX_FILE_SIZE);
+    for (int i = 0; i < FS_COLD_AGE; i++) {
+        fs_read("st_a.txt", buffer, 1);
+    }
+    // Only the test's own file, so running the tests leaves the rest alone
+    FsStat stat;
+    CHECK(fs_compress_if_cold("st_cold.txt") == 1);
+    CHECK(fs_stat("st_cold.txt", &stat) == 0 && stat.compressed);
+
+    FsCompressionStats stats;
+    fs_get_compression_stats(&stats);
+    CHECK(stats.compressed_files >= 1 && stats.stored_bytes < stats.logical_bytes);
+
+    CHECK(fs_read("st_cold.txt", buffer, sizeof(buffer)) == MAX_FILE_SIZE);
+    CHECK(memcmp(buffer, data, MAX_FILE_SIZE) == 0);
+
+    // A positional write into a compressed file keeps the rest of it
+    CHECK(fs_pwrite("st_cold.txt", "XY", 2, 100) == 2);
+    data[100] = 'X';
+    data[101] = 'Y';
+    CHECK(fs_read("st_cold.txt", buffer, sizeof(buffer)) == MAX_FILE_SIZE);
+    CHECK(memcmp(buffer, data, MAX_FILE_SIZE) == 0);
+
+    // Writing replaces the compressed copy
+    for (int i = 0; i < FS_COLD_AGE; i++) {
+        fs_read("st_a.txt", buffer, 1);
+    }
+    CHECK(fs_compress_if_cold("st_cold.txt") == 1);
+    CHECK(fs_write("st_cold.txt", "new", 3) == 3);
+    CHECK(fs_stat("st_cold.txt", &stat) == 0 && !stat.compressed);
+    CHECK(fs_read("st_cold.txt", buffer, sizeof(buffer)) == 3);
+    CHECK(buffer[0] == 'n');
+
+    CHECK(fs_delete("st_a.txt") == 0);
+    CHECK(fs_delete("st_cold.txt") == 0);
+    CHECK(fs_delete("st_a.txt") == -1);
+    CHECK(fs_open("st_cold.txt") == NULL);
+}
+
+// elf_parse on a two-segment executable written to the ramfs; loading it
+// needs a user address space, so that half is left to the exec command
+static void test_elf() {
+    struct {
+        Elf64Header header;
+        Elf64Phdr phdrs[2];
+        uint8_t code[16];
+    } __attribute__((packed)) image;
+    memset(&image, 0, sizeof(image));
+    image.header.magic = ELF_MAGIC;
+    image.header.elf_class = ELFCLASS64;
+    image.header.data = ELFDATA2LSB;
+    image.header.version = 1;
+    image.header.type = ET_EXEC;
+    image.header.machine = EM_X86_64;
+    image.header.entry = ELF_LOAD_BASE + sizeof(image) - sizeof(image.code);
+    image.header.phoff = sizeof(image.header);
+    image.header.ehsize = sizeof(image.header);
+    image.header.phentsize = sizeof(Elf64Phdr);
+    image.header.phnum = 2;
+    Elf64Phdr* bss = &image.phdrs[0];
+    bss->type = PT_LOAD;
+    bss->flags = PF_R | PF_W;
+    bss->vaddr = ELF_LOAD_BASE + 2 * PAGE_SIZE;
+    bss->memsz = 100;
+    Elf64Phdr* text = &image.phdrs[1];
+    text->type = PT_LOAD;
+    text->flags = PF_R | PF_X;
+    text->vaddr = ELF_LOAD_BASE;
+    text->filesz = text->memsz = sizeof(image);
+
+    ElfInfo info;
+    CHECK(fs_create("st_prog") >= 0 && fs_write("st_prog", &image, sizeof(image)) == sizeof(image));
+    CHECK(elf_parse("st_prog", &info) == 0);
+    CHECK(info.entry == image.header.entry && info.segment_count == 2);
+    CHECK(info.segments[0].vaddr == ELF_LOAD_BASE && (info.segments[1].flags & PF_W));
+
+    // The generation is what lazily loaded pages are checked against
+    FsStat stat;
+    CHECK(fs_stat("st_prog", &stat) == 0 && stat.size == sizeof(image) && stat.generation == info.generation);
+    fs_write("st_prog", &image, sizeof(image));
+    CHECK(fs_stat("st_prog", &stat) == 0 && stat.generation != info.generation);
+
+    // Segments sharing a page, or outside the load area, are refused
+    bss->vaddr = ELF_LOAD_BASE + sizeof(image);
+    fs_write("st_prog", &image, sizeof(image));
+    CHECK(elf_parse("st_prog", &info) == ELF_ELAYOUT);
+    bss->vaddr = ELF_LOAD_TOP - 50;
+    fs_write("st_prog", &image, sizeof(image));
+    CHECK(elf_parse("st_prog", &info) == ELF_ELAYOUT);
+
+    bss->vaddr = ELF_LOAD_BASE + 2 * PAGE_SIZE;
+    image.header.entry = bss->vaddr;
+    fs_write("st_prog", &image, sizeof(image));
+    CHECK(elf_parse("st_prog", &info) == ELF_EFORMAT); // Entry not in executable memory
+    image.header.entry = ELF_LOAD_BASE;
+    image.header.machine = 3;
+    fs_write("st_prog", &image, sizeof(image));
+    CHECK(elf_parse("st_prog", &info) == ELF_EFORMAT);
+
+    CHECK(fs_delete("st_prog") == 0);
+    CHECK(elf_parse("st_prog", &info) == ELF_ENOENT);
+}
+
+static void test_locks() {
+    static spinlock_t spin = SPINLOCK_INIT("selftest");
+    spin_lock(&spin);
+    CHECK(spin_is_locked(&spin));
+    CHECK(!spin_trylock(&spin));
+    spin_unlock(&spin);
+    CHECK(spin_trylock(&spin));
+    spin_unlock(&spin);
+    CHECK(!spin_is_locked(&spin));
+
+    static mcs_lock_t mcs = MCS_LOCK_INIT("selftest_mcs");
+    McsNode node;
+    mcs_lock(&mcs, &node);
+    CHECK(mcs.tail == &node);
+    mcs_unlock(&mcs, &node);
+    CHECK(mcs.tail == NULL);
+
+    // Readers share the lock and keep writers out, and a writer excludes both
+    static rwlock_t rw = RWLOCK_INIT("selftest_rw");
+    read_lock(&rw);
+    CHECK(read_trylock(&rw));
+    CHECK(!write_trylock(&rw));
+    read_unlock(&rw);
+    read_unlock(&rw);
+    CHECK(write_trylock(&rw));
+    CHECK(!read_trylock(&rw));
+    write_unlock(&rw);
+    CHECK(rw.state == 0);
+
+    // A read that overlaps a write must be retried
+    static seqlock_t seq = SEQLOCK_INIT("selftest_seq");
+    uint32_t start = read_seqbegin(&seq);
+    CHECK(!read_seqretry(&seq, start));
+    uint64_t flags = write_seqlock_irqsave(&seq);
+    write_sequnlock_irqrestore(&seq, flags);
+    CHECK(read_seqretry(&seq, start));
+}
+
+static void test_rings() {
+    uint32_t storage[4];
+    uint32_t value;
+    bool ok = true;
+
+    // Wrap the positions several times round a four-entry ring
+    SpscRing spsc;
+    spsc_init(&spsc, storage, sizeof(uint32_t), 4);
+    CHECK(!spsc_pop(&spsc, &value));
+    for (uint32_t round = 0; round < 3; round++) {
+        for (uint32_t i = 0; i < 4; i++) {
+            value = round * 10 + i;
+            ok &= spsc_push(&spsc, &value);
+        }
+        CHECK(!spsc_push(&spsc, &value));
+        CHECK(spsc_count(&spsc) == 4);
+        for (uint32_t i = 0; i < 4; i++) {
+            ok &= spsc_pop(&spsc, &value) && value == round * 10 + i;
+        }
+    }
+    CHECK(ok);
+    CHECK(spsc_count(&spsc) == 0);
+
+    uint32_t sequence[4];
+    MpscRing mpsc;
+    mpsc_init(&mpsc, storage, sequence, sizeof(uint32_t), 4);
+    CHECK(!mpsc_pop(&mpsc, &value));
+    ok = true;
+    for (uint32_t round = 0; round < 3; round++) {
+        for (uint32_t i = 0; i < 4; i++) {
+            value = round * 10 + i;
+            ok &= mpsc_push(&mpsc, &value);
+        }
+        CHECK(!mpsc_push(&mpsc, &value));
+        for (uint32_t i = 0; i < 4; i++) {
+            ok &= mpsc_pop(&mpsc, &value) && value == round * 10 + i;
+        }
+    }
+    CHECK(ok);
+    CHECK(!mpsc_pop(&mpsc, &value));
+}
+
+static int fired[3];
+
+static void count_fired(KTimer* timer) {
+    fired[(int)(uintptr_t)timer->data]++;
+}
+
+// Drives a private wheel by hand, far enough that timers cascade down from
+// the upper levels
+static void test_timer_wheel() {
+    static TimerWheel wheel;
+    static KTimer timers[3];
+    uint64_t next;
+    ktimer_wheel_init(&wheel, 100);
+    for (int i = 0; i < 3; i++) {
+        ktimer_init(&timers[i], count_fired, (void*)(uintptr_t)i);
+        fired[i] = 0;
+    }
+
+    CHECK(!ktimer_wheel_next(&wheel, &next));
+    ktimer_add_to(&wheel, &timers[0], 5000);  // Level 2, cascades twice
+    CHECK(ktimer_wheel_next(&wheel, &next) && next == 4096);
+    timers[1].period = 30;
+    ktimer_add_to(&wheel, &timers[1], 130);
+    ktimer_add_to(&wheel, &timers[2], 200);
+    CHECK(wheel.pending == 3);
+    CHECK(ktimer_wheel_next(&wheel, &next) && next == 130);
+    CHECK(ktimer_cancel_from(&wheel, &timers[2]));
+    CHECK(!ktimer_cancel_from(&wheel, &timers[2]));
+
+    ktimer_run_wheel(&wheel, 4999);
+    CHECK(fired[0] == 0);
+    CHECK(fired[1] == (4999 - 130) / 30 + 1);
+    ktimer_run_wheel(&wheel, 5000);
+    CHECK(fired[0] == 1 && !ktimer_pending(&timers[0]));
+    CHECK(fired[2] == 0);
+
+    // An overdue timer fires on the next tick processed
+    ktimer_add_to(&wheel, &timers[2], 10);
+    ktimer_run_wheel(&wheel, 5001);
+    CHECK(fired[2] == 1);
+    CHECK(ktimer_cancel_from(&wheel, &timers[1]));
+    CHECK(wheel.pending == 0);
+    CHECK(!ktimer_wheel_next(&wheel, &next));
+}
+
+int run_selftests(void (*report)(const char* message)) {
+    report_fn = report;
+    failures = 0;
+    checks = 0;
+
+    test_string();
+    test_string_variants();
+    test_heap();
+    test_physical_pages();
+    test_compress();
+    test_filesystem();
+    test_elf();
+    test_locks();
+    test_rings();
+    test_timer_wheel();
+
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "Selftests: %d checks, %d failed\n", checks, failures);
+    report(buffer);
+    return failures;
+}
@@ -0,0 +1,225 @@
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "interrupt.h"
+#include "log.h"
+#include "memory.h"
+#include "string.h"
+#include "syscall.h"
+#include "vdso.h"
+#include "clock.h"
+#include "timer.h"
+#include "wait.h"
+
+#define IA32_GS_BASE_MSR 0xC0000101
+#define IA32_KERNEL_GS_BASE_MSR 0xC0000102 // Swapped in by swapgs on entry from ring 3
+
+#define GDT_CODE_64 0x00AF9A000000FFFFULL // Present, ring 0, long mode code
+#define GDT_DATA    0x00CF92000000FFFFULL // Present, ring 0, writable data
+#define GDT_USER_CODE_64 0x00AFFA000000FFFFULL // The same at ring 3
+#define GDT_USER_DATA_64 0x00CFF2000000FFFFULL
+#define TSS_AVAILABLE_64 0x89
+
+#define AP_INIT_DELAY_MS 10
+#define AP_SIPI_DELAY_US 200
+#define AP_STARTUP_TIMEOUT_MS 100
+#define SMP_BENCH_ITERATIONS 20000000
+
+typedef struct {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed)) GdtPointer;
+
+// Filled in for each AP before its startup IPI; layout matches ap_boot_data
+// in smp_boot.asm
+typedef struct {
+    uint64_t cr3;
+    uint64_t stack;
+    uint64_t entry;
+    uint64_t arg;
+} ApBootData;
+
+static Cpu cpus[MAX_CPUS];
+static volatile int cpu_count = 0; // CPUs 0..cpu_count-1 are online
+
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_boot_data[];
+extern void gdt_flush(GdtPointer* pointer);
+
+static void gdt_set_tss(uint64_t* gdt, int index, Tss* tss) {
+    uint64_t base = (uint64_t)tss;
+    uint64_t limit = sizeof(Tss) - 1;
+    gdt[index] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+                 ((uint64_t)TSS_AVAILABLE_64 << 40) | (((limit >> 16) & 0xF) << 48) |
+                 (((base >> 24) & 0xFF) << 56);
+    gdt[index + 1] = base >> 32;
+}
+
+// Load this CPU's own GDT and TSS and point GS at its Cpu structure
+static void cpu_setup(Cpu* cpu) {
+    cpu->self = cpu;
+
+    memset(&cpu->tss, 0, sizeof(cpu->tss));
+    cpu->tss.ist[IST_DOUBLE_FAULT - 1] = (uint64_t)cpu->double_fault_stack +
+                                         sizeof(cpu->double_fault_stack);
+    cpu->tss.iomap_base = sizeof(Tss); // No I/O permission bitmap
+
+    cpu->gdt[0] = 0;
+    cpu->gdt[GDT_KERNEL_CODE / 8] = GDT_CODE_64;
+    cpu->gdt[GDT_KERNEL_DATA / 8] = GDT_DATA;
+    cpu->gdt[GDT_USER_DATA / 8] = GDT_USER_DATA_64;
+    cpu->gdt[GDT_USER_CODE / 8] = GDT_USER_CODE_64;
+    gdt_set_tss(cpu->gdt, GDT_TSS / 8, &cpu->tss);
+
+    GdtPointer pointer = { sizeof(cpu->gdt) - 1, (uint64_t)cpu->gdt };
+    gdt_flush(&pointer);
+    __asm__ volatile("ltr %0" : : "r"((uint16_t)GDT_TSS));
+    wrmsr(IA32_GS_BASE_MSR, (uint64_t)cpu);
+    wrmsr(IA32_KERNEL_GS_BASE_MSR, 0);
+}
+
+// Must run before init_tasking: the scheduler reaches its state via GS
+void smp_init_bsp() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+    Cpu* cpu = &cpus[0];
+    memset(cpu, 0, sizeof(Cpu));
+    cpu->id = 0;
+    cpu->apic_id = ebx >> 24; // Initial APIC ID; the LAPIC is not mapped yet
+    cpu->online = true;
+    cpu_setup(cpu);
+    cpu_count = 1;
+}
+
+// First C code on an application processor, entered from the trampoline
+// with interrupts off on the stack start_ap gave it. That context becomes
+// the CPU's idle task.
+static void ap_main(Cpu* cpu) {
+    cpu_setup(cpu);
+    fpu_init_cpu();
+    syscall_init_cpu();
+    vdso_init_cpu();
+    idt_load();
+    lapic_init();
+    sched_init_cpu(&cpu->idle_task);
+    timer_init_ap();
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+    sched_idle();
+}
+
+// INIT, then the startup IPI twice as the MP specification describes. A
+// CPU that is already running ignores the second one.
+static bool start_ap(Cpu* cpu) {
+    uint8_t* stack = kmalloc(STACK_SIZE);
+    if (!stack) {
+        return false;
+    }
+
+    volatile ApBootData* boot = (volatile ApBootData*)(AP_TRAMPOLINE_ADDR +
+                                                       (ap_boot_data - ap_trampoline_start));
+    boot->cr3 = read_cr3();
+    boot->stack = (uint64_t)stack + STACK_SIZE;
+    boot->entry = (uint64_t)ap_main;
+    boot->arg = (uint64_t)cpu;
+
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL_ASSERT);
+    pit_wait_ms(AP_INIT_DELAY_MS);
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (AP_TRAMPOLINE_ADDR >> 12));
+        udelay(AP_SIPI_DELAY_US);
+    }
+    for (int ms = 0; ms < AP_STARTUP_TIMEOUT_MS && !cpu->online; ms++) {
+        pit_wait_ms(1);
+    }
+    // On failure the stack is leaked: a slow AP might still be using it
+    return cpu->online;
+}
+
+// Starts every enabled processor in the MADT, one at a time since they share
+// the trampoline. Needs the LAPIC timer calibrated by timer_init.
+void smp_start_aps() {
+    const MadtInfo* madt = acpi_madt();
+    if (!madt || !lapic_enabled()) {
+        log_info(LOG_KERNEL, "SMP: no MADT or LAPIC, running on one CPU\n");
+        return;
+    }
+
+    memcpy((void*)AP_TRAMPOLINE_ADDR, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+
+    for (uint32_t i = 0; i < madt->cpu_count && cpu_count < MAX_CPUS; i++) {
+        uint32_t apic_id = madt->cpu_apic_ids[i];
+        if (apic_id == cpus[0].apic_id) {
+            continue;
+        }
+
+        Cpu* cpu = &cpus[cpu_count];
+        memset(cpu, 0, sizeof(Cpu));
+        cpu->id = cpu_count;
+        cpu->apic_id = apic_id;
+        if (!start_ap(cpu)) {
+            // Its slot can't be reused while it might still come up late
+            log_warn(LOG_KERNEL, "SMP: CPU with APIC ID %u did not start\n", apic_id);
+            break;
+        }
+        __atomic_store_n(&cpu_count, cpu_count + 1, __ATOMIC_RELEASE);
+    }
+    log_info(LOG_KERNEL, "SMP: %d CPUs online\n", cpu_count);
+}
+
+int smp_cpu_count() {
+    return __atomic_load_n(&cpu_count, __ATOMIC_ACQUIRE);
+}
+
+Cpu* smp_cpu(int id) {
+    return &cpus[id];
+}
+
+// The vector needs no handler: interrupt_dispatch acknowledges it and
+// preempt_check then switches to the task that was queued
+void smp_send_reschedule(Cpu* cpu) {
+    if (cpu->online && lapic_enabled()) {
+        lapic_send_ipi(cpu->apic_id, RESCHEDULE_VECTOR);
+    }
+}
+
+void smp_list(char* buffer, size_t buffer_size) {
+    size_t offset = snprintf(buffer, buffer_size, "CPU APIC READY RUNNING\n");
+    for (int i = 0; i < smp_cpu_count() && offset < buffer_size - 1; i++) {
+        Cpu* cpu = &cpus[i];
+        Task* current = cpu->current; // Racy snapshot; only the name is read
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-3d %4u %5u %s\n",
+                           cpu->id, cpu->apic_id, cpu->rq.nr_ready,
+                           current ? current->name : "-");
+    }
+}
+
+static volatile int bench_done;
+static WaitQueue bench_wait = WAIT_QUEUE_INIT;
+
+// Register-only work, so the tasks compete for CPUs rather than memory
+static void smp_bench_task() {
+    uint64_t x = 0;
+    for (uint64_t i = 0; i < SMP_BENCH_ITERATIONS; i++) {
+        x = x * 6364136223846793005ULL + i;
+        __asm__ volatile("" : "+r"(x));
+    }
+    __atomic_fetch_add(&bench_done, 1, __ATOMIC_RELEASE);
+    wake_up(&bench_wait);
+}
+
+// Runs `tasks` copies of a fixed CPU-bound loop and returns the TSC cycles
+// until the last one finishes, or 0 if they could not all be spawned
+uint64_t smp_bench(int tasks) {
+    bench_done = 0;
+    uint64_t start = rdtsc();
+    int spawned = 0;
+    while (spawned < tasks && create_task("smpbench", smp_bench_task) >= 0) {
+        spawned++;
+    }
+    wait_event(&bench_wait, __atomic_load_n(&bench_done, __ATOMIC_ACQUIRE) >= spawned);
+    return spawned == tasks ? rdtsc() - start : 0;
+}
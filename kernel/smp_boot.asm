@@ -0,0 +1,102 @@
+; Application processor startup and per-CPU GDT loading, used by smp.c
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_boot_data
+global gdt_flush
+
+AP_TRAMPOLINE_ADDR equ 0x8000     ; Must match smp.h
+
+; Address of a trampoline label once smp_start_aps has copied it into place
+%define TRAMPOLINE(label) (AP_TRAMPOLINE_ADDR + (label) - ap_trampoline_start)
+
+section .text
+bits 64
+; Loads the GDT described by rdi and reloads every segment register except
+; GS, whose base holds the per-CPU pointer. CS is reloaded with a far return.
+gdt_flush:
+    lgdt [rdi]
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor ax, ax
+    mov fs, ax
+    pop rax
+    push qword 0x08
+    push rax
+    retfq
+
+; The startup IPI starts an AP here in real mode with CS = 0x0800. The same
+; steps as boot.asm then take it to long mode on the BSP's page tables, and
+; it calls the entry point in ap_boot_data with the argument in rdi.
+bits 16
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [TRAMPOLINE(ap_gdt.pointer)]
+
+    mov eax, cr0
+    or eax, 1                      ; protected mode
+    mov cr0, eax
+    jmp dword 0x08:TRAMPOLINE(ap_protected_mode)
+
+bits 32
+ap_protected_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; enable PAE-flag in cr4
+    mov eax, cr4
+    or eax, 1 << 5
+    mov cr4, eax
+
+    ; the BSP's P4 table; boot.asm placed it below 4GiB
+    mov eax, [TRAMPOLINE(ap_boot_data)]
+    mov cr3, eax
+
+    ; set the long mode bit in the EFER MSR
+    mov ecx, 0xC0000080
+    rdmsr
+    or eax, 1 << 8
+    wrmsr
+
+    ; enable paging in the cr0 register
+    mov eax, cr0
+    or eax, 1 << 31
+    mov cr0, eax
+
+    jmp 0x18:TRAMPOLINE(ap_long_mode)
+
+bits 64
+ap_long_mode:
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov rsp, [TRAMPOLINE(ap_boot_data) + 8]
+    mov rdi, [TRAMPOLINE(ap_boot_data) + 24]
+    mov rax, [TRAMPOLINE(ap_boot_data) + 16]
+    call rax
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+align 16
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF          ; 0x08: 32-bit code
+    dq 0x00CF92000000FFFF          ; 0x10: data
+    dq 0x00AF9A000000FFFF          ; 0x18: 64-bit code
+.pointer:
+    dw .pointer - ap_gdt - 1
+    dd TRAMPOLINE(ap_gdt)
+
+align 8
+ap_boot_data:                      ; cr3, stack top, entry, argument
+    dq 0, 0, 0, 0
+ap_trampoline_end:
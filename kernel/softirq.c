@@ -0,0 +1,128 @@
+#include "softirq.h"
+#include "cpu.h"
+#include "smp.h"
+#include "string.h"
+
+// Softirqs raised while handlers run are picked up this many more times
+// before the rest waits for the next interrupt exit
+#define SOFTIRQ_MAX_RESTART 10
+
+static softirq_handler_t handlers[SOFTIRQ_COUNT];
+static const char* softirq_names[SOFTIRQ_COUNT] = { "timer", "tasklet" };
+
+void open_softirq(int nr, softirq_handler_t handler) {
+    handlers[nr] = handler;
+}
+
+// Only marks the softirq pending on this CPU, so it is safe anywhere,
+// including with locks held
+void raise_softirq(int nr) {
+    uint64_t flags = irq_save();
+    this_cpu()->softirq_pending |= 1u << nr;
+    irq_restore(flags);
+}
+
+// Runs this CPU's pending softirqs with interrupts enabled. An interrupt
+// arriving meanwhile doesn't recurse into them, and won't switch tasks
+// until they finish, so they stay on this CPU throughout.
+void do_softirq() {
+    uint64_t flags = irq_save();
+    Cpu* cpu = this_cpu();
+    if (cpu->in_softirq || !cpu->softirq_pending) {
+        irq_restore(flags);
+        return;
+    }
+
+    cpu->in_softirq = 1;
+    for (int restart = 0; restart <= SOFTIRQ_MAX_RESTART && cpu->softirq_pending; restart++) {
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+        interrupts_enable();
+        while (pending) {
+            int nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            if (handlers[nr]) {
+                handlers[nr]();
+            }
+            cpu->softirq_counts[nr]++;
+        }
+        interrupts_disable();
+    }
+    cpu->in_softirq = 0;
+    irq_restore(flags);
+}
+
+void tasklet_init(Tasklet* tasklet, void (*func)(void* data), void* data) {
+    tasklet->next = NULL;
+    tasklet->func = func;
+    tasklet->data = data;
+    tasklet->state = 0;
+}
+
+// Called with interrupts off
+static void tasklet_enqueue(Cpu* cpu, Tasklet* tasklet) {
+    tasklet->next = NULL;
+    if (cpu->tasklets) {
+        cpu->tasklet_tail->next = tasklet;
+    } else {
+        cpu->tasklets = tasklet;
+    }
+    cpu->tasklet_tail = tasklet;
+    cpu->softirq_pending |= 1u << SOFTIRQ_TASKLET;
+}
+
+// Queues the tasklet on this CPU unless it is already queued somewhere
+void tasklet_schedule(Tasklet* tasklet) {
+    if (__atomic_fetch_or(&tasklet->state, TASKLET_SCHEDULED, __ATOMIC_ACQ_REL) & TASKLET_SCHEDULED) {
+        return;
+    }
+    uint64_t flags = irq_save();
+    tasklet_enqueue(this_cpu(), tasklet);
+    irq_restore(flags);
+}
+
+// SCHEDULED is cleared before the call, so a tasklet may reschedule itself
+static void tasklet_action() {
+    interrupts_disable();
+    Cpu* cpu = this_cpu();
+    Tasklet* list = cpu->tasklets;
+    cpu->tasklets = NULL;
+    cpu->tasklet_tail = NULL;
+    interrupts_enable();
+
+    while (list) {
+        Tasklet* tasklet = list;
+        list = tasklet->next;
+
+        if (__atomic_fetch_or(&tasklet->state, TASKLET_RUNNING, __ATOMIC_ACQUIRE) & TASKLET_RUNNING) {
+            // Still running on another CPU; try again on the next pass
+            interrupts_disable();
+            tasklet_enqueue(cpu, tasklet);
+            interrupts_enable();
+            continue;
+        }
+        __atomic_fetch_and(&tasklet->state, ~TASKLET_SCHEDULED, __ATOMIC_ACQ_REL);
+        tasklet->func(tasklet->data);
+        __atomic_fetch_and(&tasklet->state, ~TASKLET_RUNNING, __ATOMIC_RELEASE);
+    }
+}
+
+void softirq_init() {
+    open_softirq(SOFTIRQ_TASKLET, tasklet_action);
+}
+
+void softirq_stats(char* buffer, size_t buffer_size) {
+    size_t offset = snprintf(buffer, buffer_size, "CPU");
+    for (int nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+        offset += snprintf(buffer + offset, buffer_size - offset, " %10s", softirq_names[nr]);
+    }
+    offset += snprintf(buffer + offset, buffer_size - offset, "\n");
+    for (int i = 0; i < smp_cpu_count() && offset < buffer_size - 1; i++) {
+        Cpu* cpu = smp_cpu(i);
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-3d", cpu->id);
+        for (int nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            offset += snprintf(buffer + offset, buffer_size - offset, " %10llu", cpu->softirq_counts[nr]);
+        }
+        offset += snprintf(buffer + offset, buffer_size - offset, "\n");
+    }
+}
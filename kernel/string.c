@@ -1,6 +1,26 @@
 #include "string.h"
+#include "cpu.h"
 
-void* memcpy(void* dest, const void* src, size_t n) {
+#define CPUID_EBX_ERMS (1 << 9) // Leaf 7: enhanced rep movsb/stosb
+#define ERMS_THRESHOLD 256      // Below this rep's startup cost outweighs it
+#define BYTES_REPEAT 0x0101010101010101ULL
+
+// Word loads may be unaligned and may alias anything
+typedef uint64_t __attribute__((may_alias, aligned(1))) word_t;
+
+// Nonzero exactly when some byte of w is zero
+static inline uint64_t has_zero_byte(uint64_t w) {
+    return (w - BYTES_REPEAT) & ~w & (BYTES_REPEAT << 7);
+}
+
+// memcpy and memset go through these, picked by string_init. The word
+// loops are safe on every x86-64 CPU, so they are the default until then.
+static void* (*memcpy_impl)(void* dest, const void* src, size_t n) = memcpy_words;
+static void* (*memset_impl)(void* s, int c, size_t n) = memset_words;
+static const char* impl_name = "words";
+
+// The byte loops are the reference the tuned versions are checked against
+void* memcpy_bytes(void* dest, const void* src, size_t n) {
     char* d = dest;
     const char* s = src;
     while (n--) {
@@ -9,7 +29,7 @@ void* memcpy(void* dest, const void* src, size_t n) {
     return dest;
 }
 
-void* memset(void* s, int c, size_t n) {
+void* memset_bytes(void* s, int c, size_t n) {
     unsigned char* p = s;
     while (n--) {
         *p++ = (unsigned char)c;
@@ -17,6 +37,249 @@ void* memset(void* s, int c, size_t n) {
     return s;
 }
 
+// Aligns the destination, then moves 32 bytes per iteration in 8-byte words
+void* memcpy_words(void* dest, const void* src, size_t n) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    if (n >= 8) {
+        while ((uintptr_t)d & 7) {
+            *d++ = *s++;
+            n--;
+        }
+        for (; n >= 32; n -= 32, d += 32, s += 32) {
+            word_t w0 = ((const word_t*)s)[0];
+            word_t w1 = ((const word_t*)s)[1];
+            word_t w2 = ((const word_t*)s)[2];
+            word_t w3 = ((const word_t*)s)[3];
+            ((word_t*)d)[0] = w0;
+            ((word_t*)d)[1] = w1;
+            ((word_t*)d)[2] = w2;
+            ((word_t*)d)[3] = w3;
+        }
+        for (; n >= 8; n -= 8, d += 8, s += 8) {
+            *(word_t*)d = *(const word_t*)s;
+        }
+    }
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+void* memset_words(void* s, int c, size_t n) {
+    uint8_t* p = s;
+    if (n >= 8) {
+        uint64_t pattern = (uint8_t)c * BYTES_REPEAT;
+        while ((uintptr_t)p & 7) {
+            *p++ = (uint8_t)c;
+            n--;
+        }
+        for (; n >= 32; n -= 32, p += 32) {
+            ((word_t*)p)[0] = pattern;
+            ((word_t*)p)[1] = pattern;
+            ((word_t*)p)[2] = pattern;
+            ((word_t*)p)[3] = pattern;
+        }
+        for (; n >= 8; n -= 8, p += 8) {
+            *(word_t*)p = pattern;
+        }
+    }
+    while (n--) {
+        *p++ = (uint8_t)c;
+    }
+    return s;
+}
+
+// With ERMS the microcode moves whole cache lines, which beats any loop we
+// can write without SIMD registers; small sizes still use the word loop
+void* memcpy_erms(void* dest, const void* src, size_t n) {
+    if (n < ERMS_THRESHOLD) {
+        return memcpy_words(dest, src, n);
+    }
+    void* d = dest;
+    __asm__ volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+    return dest;
+}
+
+void* memset_erms(void* s, int c, size_t n) {
+    if (n < ERMS_THRESHOLD) {
+        return memset_words(s, c, n);
+    }
+    void* p = s;
+    __asm__ volatile("rep stosb" : "+D"(p), "+c"(n) : "a"(c) : "memory");
+    return s;
+}
+
+#ifdef HOSTED
+// SIMD copies for the benchmark to compare against. The kernel doesn't use
+// them: it runs with SSE off for its own code, and tasks' vector registers
+// are switched lazily, so borrowing them would mean saving the owner's
+// state on every large copy, interrupts included.
+void* memcpy_sse2(void* dest, const void* src, size_t n) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __asm__ volatile("movdqu (%1), %%xmm0\n\t"
+                         "movdqu 16(%1), %%xmm1\n\t"
+                         "movdqu 32(%1), %%xmm2\n\t"
+                         "movdqu 48(%1), %%xmm3\n\t"
+                         "movdqu %%xmm0, (%0)\n\t"
+                         "movdqu %%xmm1, 16(%0)\n\t"
+                         "movdqu %%xmm2, 32(%0)\n\t"
+                         "movdqu %%xmm3, 48(%0)"
+                         : : "r"(d), "r"(s) : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+    }
+    memcpy_words(d, s, n);
+    return dest;
+}
+
+void* memset_sse2(void* s, int c, size_t n) {
+    uint8_t* p = s;
+    if (n >= 64) {
+        // One asm block, since xmm0 need not survive between two
+        uint64_t pattern = (uint8_t)c * BYTES_REPEAT;
+        size_t blocks = n / 64;
+        __asm__ volatile("movq %2, %%xmm0\n\t"
+                         "punpcklqdq %%xmm0, %%xmm0\n"
+                         "1:\n\t"
+                         "movdqu %%xmm0, (%0)\n\t"
+                         "movdqu %%xmm0, 16(%0)\n\t"
+                         "movdqu %%xmm0, 32(%0)\n\t"
+                         "movdqu %%xmm0, 48(%0)\n\t"
+                         "add $64, %0\n\t"
+                         "dec %1\n\t"
+                         "jnz 1b"
+                         : "+r"(p), "+r"(blocks) : "r"(pattern) : "xmm0", "cc", "memory");
+        n %= 64;
+    }
+    memset_words(p, c, n);
+    return s;
+}
+
+// Only call these if string_has_avx2()
+void* memcpy_avx2(void* dest, const void* src, size_t n) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+        __asm__ volatile("vmovdqu (%1), %%ymm0\n\t"
+                         "vmovdqu 32(%1), %%ymm1\n\t"
+                         "vmovdqu 64(%1), %%ymm2\n\t"
+                         "vmovdqu 96(%1), %%ymm3\n\t"
+                         "vmovdqu %%ymm0, (%0)\n\t"
+                         "vmovdqu %%ymm1, 32(%0)\n\t"
+                         "vmovdqu %%ymm2, 64(%0)\n\t"
+                         "vmovdqu %%ymm3, 96(%0)"
+                         : : "r"(d), "r"(s) : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+    }
+    __asm__ volatile("vzeroupper");
+    memcpy_words(d, s, n);
+    return dest;
+}
+
+void* memset_avx2(void* s, int c, size_t n) {
+    uint8_t* p = s;
+    if (n >= 128) {
+        uint64_t pattern = (uint8_t)c * BYTES_REPEAT;
+        size_t blocks = n / 128;
+        __asm__ volatile("vmovq %2, %%xmm0\n\t"
+                         "vpbroadcastq %%xmm0, %%ymm0\n"
+                         "1:\n\t"
+                         "vmovdqu %%ymm0, (%0)\n\t"
+                         "vmovdqu %%ymm0, 32(%0)\n\t"
+                         "vmovdqu %%ymm0, 64(%0)\n\t"
+                         "vmovdqu %%ymm0, 96(%0)\n\t"
+                         "add $128, %0\n\t"
+                         "dec %1\n\t"
+                         "jnz 1b\n\t"
+                         "vzeroupper"
+                         : "+r"(p), "+r"(blocks) : "r"(pattern) : "xmm0", "cc", "memory");
+        n %= 128;
+    }
+    memset_words(p, c, n);
+    return s;
+}
+
+// AVX2 needs both the CPU feature and the OS saving YMM state (XCR0 bits 1-2)
+bool string_has_avx2() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & (1 << 27))) { // OSXSAVE
+        return false;
+    }
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6) {
+        return false;
+    }
+    cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    return (ebx & (1 << 5)) != 0;
+}
+#endif // HOSTED
+
+bool string_has_erms() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 7) {
+        return false;
+    }
+    cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    return (ebx & CPUID_EBX_ERMS) != 0;
+}
+
+// Picks the memcpy and memset variants once at boot
+void string_init() {
+    if (string_has_erms()) {
+        memcpy_impl = memcpy_erms;
+        memset_impl = memset_erms;
+        impl_name = "erms";
+    }
+}
+
+const char* string_variant() {
+    return impl_name;
+}
+
+void* memcpy(void* dest, const void* src, size_t n) {
+    return memcpy_impl(dest, src, n);
+}
+
+void* memset(void* s, int c, size_t n) {
+    return memset_impl(s, c, n);
+}
+
+// Copies forwards unless dest overlaps the end of src
+void* memmove(void* dest, const void* src, size_t n) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    if (d <= s || d >= s + n) {
+        return memcpy_words(dest, src, n);
+    }
+    d += n;
+    s += n;
+    for (; n >= 8; n -= 8) {
+        d -= 8;
+        s -= 8;
+        *(word_t*)d = *(const word_t*)s;
+    }
+    while (n--) {
+        *--d = *--s;
+    }
+    return dest;
+}
+
+int memcmp(const void* s1, const void* s2, size_t n) {
+    const unsigned char* a = s1;
+    const unsigned char* b = s2;
+    while (n--) {
+        if (*a != *b) {
+            return *a - *b;
+        }
+        a++;
+        b++;
+    }
+    return 0;
+}
+
 char* strncpy(char* dest, const char* src, size_t n) {
     size_t i;
     for (i = 0; i < n && src[i] != '\0'; i++) {
@@ -29,6 +292,24 @@ char* strncpy(char* dest, const char* src, size_t n) {
 }
 
 int strcmp(const char* s1, const char* s2) {
+    // With matching alignment both strings can be read a word at a time
+    // until the words differ or hold the terminator
+    if ((((uintptr_t)s1 ^ (uintptr_t)s2) & 7) == 0) {
+        while (((uintptr_t)s1 & 7) && *s1 && *s1 == *s2) {
+            s1++;
+            s2++;
+        }
+        if (!((uintptr_t)s1 & 7)) {
+            const word_t* a = (const word_t*)s1;
+            const word_t* b = (const word_t*)s2;
+            while (*a == *b && !has_zero_byte(*a)) {
+                a++;
+                b++;
+            }
+            s1 = (const char*)a;
+            s2 = (const char*)b;
+        }
+    }
     while (*s1 && (*s1 == *s2)) {
         s1++;
         s2++;
@@ -36,12 +317,25 @@ int strcmp(const char* s1, const char* s2) {
     return *(const unsigned char*)s1 - *(const unsigned char*)s2;
 }
 
+// Checks a word at a time once aligned. An aligned word never crosses a
+// page, so reading past the terminator can't fault.
 size_t strlen(const char* s) {
-    size_t len = 0;
-    while (s[len]) {
-        len++;
+    const char* p = s;
+    while ((uintptr_t)p & 7) {
+        if (!*p) {
+            return p - s;
+        }
+        p++;
+    }
+    const word_t* w = (const word_t*)p;
+    while (!has_zero_byte(*w)) {
+        w++;
+    }
+    p = (const char*)w;
+    while (*p) {
+        p++;
     }
-    return len;
+    return p - s;
 }
 
 char* strchr(const char* s, int c) {
@@ -69,37 +363,127 @@ char* strtok(char* str, const char* delim) {
     return tok;
 }
 
-int snprintf(char* str, size_t size, const char* format, ...) {
-    // This is a very basic implementation that only supports %s and %d
-    // You may want to expand this for more format specifiers
-    va_list args;
-    va_start(args, format);
-    
+// Writes value in the given base into str, most significant digit first
+static void format_unsigned(unsigned long long value, unsigned base, char* str) {
+    char digits[24];
+    int i = 0;
+    do {
+        digits[i++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value != 0);
+    while (i > 0) {
+        *str++ = digits[--i];
+    }
+    *str = '\0';
+}
+
+// Supports %s, %c, %d, %u, %x, %p and %% with optional '-'/'0' flags, a
+// field width and 'l'/'ll' length modifiers
+int vsnprintf(char* str, size_t size, const char* format, va_list args) {
+    if (size == 0) {
+        return 0;
+    }
+
     size_t written = 0;
     while (*format != '\0' && written < size - 1) {
-        if (*format == '%') {
+        if (*format != '%') {
+            str[written++] = *format++;
+            continue;
+        }
+        format++;
+
+        bool left_align = false;
+        char pad = ' ';
+        while (*format == '-' || *format == '0') {
+            if (*format == '-') {
+                left_align = true;
+            } else {
+                pad = '0';
+            }
             format++;
-            if (*format == 's') {
-                char* s = va_arg(args, char*);
-                while (*s != '\0' && written < size - 1) {
-                    str[written++] = *s++;
+        }
+        size_t width = 0;
+        while (*format >= '0' && *format <= '9') {
+            width = width * 10 + (*format++ - '0');
+        }
+        int longs = 0;
+        while (*format == 'l') {
+            longs++;
+            format++;
+        }
+
+        char num[24];
+        const char* s = num;
+        switch (*format) {
+            case 's':
+                s = va_arg(args, const char*);
+                if (!s) {
+                    s = "(null)";
                 }
-            } else if (*format == 'd') {
-                int d = va_arg(args, int);
-                char num[20];
-                int_to_string(d, num);
-                char* s = num;
-                while (*s != '\0' && written < size - 1) {
-                    str[written++] = *s++;
+                break;
+            case 'c':
+                num[0] = (char)va_arg(args, int);
+                num[1] = '\0';
+                break;
+            case 'd': {
+                long long value = longs == 0 ? va_arg(args, int)
+                                : longs == 1 ? va_arg(args, long)
+                                : va_arg(args, long long);
+                if (value < 0) {
+                    num[0] = '-';
+                    format_unsigned(-(unsigned long long)value, 10, num + 1);
+                } else {
+                    format_unsigned(value, 10, num);
                 }
+                break;
+            }
+            case 'u':
+            case 'x': {
+                unsigned long long value = longs == 0 ? va_arg(args, unsigned int)
+                                         : longs == 1 ? va_arg(args, unsigned long)
+                                         : va_arg(args, unsigned long long);
+                format_unsigned(value, *format == 'x' ? 16 : 10, num);
+                break;
             }
-        } else {
-            str[written++] = *format;
+            case 'p':
+                num[0] = '0';
+                num[1] = 'x';
+                format_unsigned((unsigned long long)(uintptr_t)va_arg(args, void*), 16, num + 2);
+                break;
+            case '%':
+                s = "%";
+                break;
+            case '\0':
+                continue;
+            default:
+                num[0] = '%';
+                num[1] = *format;
+                num[2] = '\0';
+                break;
         }
         format++;
+
+        size_t length = strlen(s);
+        if (!left_align) {
+            for (; length < width && written < size - 1; width--) {
+                str[written++] = pad;
+            }
+        }
+        while (*s != '\0' && written < size - 1) {
+            str[written++] = *s++;
+        }
+        for (; length < width && written < size - 1; width--) {
+            str[written++] = ' ';
+        }
     }
     str[written] = '\0';
-    
+    return written;
+}
+
+int snprintf(char* str, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(str, size, format, args);
     va_end(args);
     return written;
 }
@@ -0,0 +1,187 @@
+#include "syscall.h"
+#include "clock.h"
+#include "cpu.h"
+#include "filesystem.h"
+#include "memory.h"
+#include "smp.h"
+#include "string.h"
+#include "task.h"
+#include "uring.h"
+#include "user.h"
+#include "vga.h"
+#include "vm.h"
+#include "wait.h"
+
+#define MSR_EFER   0xC0000080
+#define MSR_STAR   0xC0000081
+#define MSR_LSTAR  0xC0000082
+#define MSR_SFMASK 0xC0000084
+#define EFER_SCE   (1 << 0)
+
+// Cleared on entry: IF, so syscall_entry runs with interrupts off until it
+// is on the kernel stack, DF for the C code, and TF
+#define SYSCALL_RFLAGS_MASK 0x700
+
+// SYS_WRITE has no length limit; the user bytes go to vga_write, which
+// takes C strings, through a stack buffer this many at a time
+#define SYSCALL_WRITE_CHUNK 256
+
+// syscall_entry reaches these through %gs
+_Static_assert(offsetof(Cpu, kernel_rsp) == 8, "syscall_entry expects kernel_rsp at %gs:8");
+_Static_assert(offsetof(Cpu, user_rsp) == 16, "syscall_entry expects user_rsp at %gs:16");
+
+extern void syscall_entry(void);
+
+static int64_t sys_null(SyscallFrame* frame) {
+    (void)frame;
+    return 0;
+}
+
+static int64_t sys_exit(SyscallFrame* frame) {
+    user_exit(frame->arg0);
+    return 0; // Not reached
+}
+
+static int64_t sys_yield(SyscallFrame* frame) {
+    (void)frame;
+    yield();
+    return 0;
+}
+
+static int64_t sys_sleep(SyscallFrame* frame) {
+    sleep_ms(frame->arg0);
+    return 0;
+}
+
+static int64_t sys_getpid(SyscallFrame* frame) {
+    (void)frame;
+    return current_task()->id;
+}
+
+static int64_t sys_write(SyscallFrame* frame) {
+    const char* data = (const char*)frame->arg0;
+    size_t length = frame->arg1;
+    if (!vm_user_access(data, length, false)) {
+        return SYSCALL_EFAULT;
+    }
+    char chunk[SYSCALL_WRITE_CHUNK + 1];
+    for (size_t done = 0; done < length; ) {
+        size_t n = length - done < SYSCALL_WRITE_CHUNK ? length - done : SYSCALL_WRITE_CHUNK;
+        memcpy(chunk, data + done, n);
+        chunk[n] = '\0';
+        vga_write(chunk);
+        done += n;
+    }
+    return length;
+}
+
+static int64_t sys_getcpu(SyscallFrame* frame) {
+    (void)frame;
+    uint64_t flags = irq_save();
+    int id = this_cpu()->id;
+    irq_restore(flags);
+    return id;
+}
+
+static int64_t sys_time_ns(SyscallFrame* frame) {
+    (void)frame;
+    return ktime_ns();
+}
+
+static int64_t sys_fs_create(SyscallFrame* frame) {
+    char name[MAX_FILENAME_LENGTH];
+    if (!user_copy_string(name, (const char*)frame->arg0, sizeof(name))) {
+        return SYSCALL_EFAULT;
+    }
+    return fs_create(name);
+}
+
+static int64_t sys_fs_delete(SyscallFrame* frame) {
+    char name[MAX_FILENAME_LENGTH];
+    if (!user_copy_string(name, (const char*)frame->arg0, sizeof(name))) {
+        return SYSCALL_EFAULT;
+    }
+    return fs_delete(name);
+}
+
+// The ramfs copies straight to and from the user buffer once it is checked
+static int64_t sys_fs_read(SyscallFrame* frame) {
+    char name[MAX_FILENAME_LENGTH];
+    void* buffer = (void*)frame->arg1;
+    size_t size = frame->arg2;
+    if (!user_copy_string(name, (const char*)frame->arg0, sizeof(name)) ||
+        !vm_user_access(buffer, size, true)) {
+        return SYSCALL_EFAULT;
+    }
+    return fs_read(name, buffer, size);
+}
+
+static int64_t sys_fs_write(SyscallFrame* frame) {
+    char name[MAX_FILENAME_LENGTH];
+    const void* data = (const void*)frame->arg1;
+    size_t size = frame->arg2;
+    if (!user_copy_string(name, (const char*)frame->arg0, sizeof(name)) ||
+        !vm_user_access(data, size, false)) {
+        return SYSCALL_EFAULT;
+    }
+    return fs_write(name, data, size);
+}
+
+static int64_t sys_fs_list(SyscallFrame* frame) {
+    char* buffer = (char*)frame->arg0;
+    size_t size = frame->arg1;
+    if (size == 0) {
+        return SYSCALL_EINVAL;
+    }
+    if (!vm_user_access(buffer, size, true)) {
+        return SYSCALL_EFAULT;
+    }
+    fs_list(buffer, size);
+    return strlen(buffer);
+}
+
+static int64_t sys_uring_setup(SyscallFrame* frame) {
+    return uring_setup(frame->arg0, frame->arg1);
+}
+
+static int64_t sys_uring_enter(SyscallFrame* frame) {
+    return uring_enter(frame->arg0, frame->arg1, frame->arg2);
+}
+
+static const syscall_handler_t syscall_table[SYS_COUNT] = {
+    [SYS_NULL] = sys_null,
+    [SYS_EXIT] = sys_exit,
+    [SYS_YIELD] = sys_yield,
+    [SYS_SLEEP] = sys_sleep,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_WRITE] = sys_write,
+    [SYS_TIME_NS] = sys_time_ns,
+    [SYS_FS_CREATE] = sys_fs_create,
+    [SYS_FS_DELETE] = sys_fs_delete,
+    [SYS_FS_READ] = sys_fs_read,
+    [SYS_FS_WRITE] = sys_fs_write,
+    [SYS_FS_LIST] = sys_fs_list,
+    [SYS_URING_SETUP] = sys_uring_setup,
+    [SYS_URING_ENTER] = sys_uring_enter,
+    [SYS_GETCPU] = sys_getcpu,
+};
+
+// Called by syscall_entry on the task's kernel stack with interrupts on;
+// the result goes back to user mode in rax
+int64_t syscall_dispatch(SyscallFrame* frame) {
+    if (frame->number >= SYS_COUNT || !syscall_table[frame->number]) {
+        return SYSCALL_ENOSYS;
+    }
+    return syscall_table[frame->number](frame);
+}
+
+// The MSRs are per CPU, so the BSP and each application processor call
+// this for themselves. SYSCALL loads CS from STAR[47:32] and SS 8 above
+// it. SYSRET loads CS from STAR[63:48] + 16 and SS from STAR[63:48] + 8,
+// both at RPL 3.
+void syscall_init_cpu() {
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    wrmsr(MSR_STAR, ((uint64_t)(GDT_USER_DATA - 8) << 48) | ((uint64_t)GDT_KERNEL_CODE << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+    wrmsr(MSR_SFMASK, SYSCALL_RFLAGS_MASK);
+}
@@ -0,0 +1,85 @@
+global syscall_entry
+global enter_user
+extern syscall_dispatch
+
+; Offsets into Cpu, checked against the struct in syscall.c
+%define CPU_KERNEL_RSP 8
+%define CPU_USER_RSP 16
+
+%define USER_DATA_SELECTOR 0x1B
+%define USER_CODE_SELECTOR 0x23
+%define USER_RFLAGS 0x202       ; IF set
+
+section .text
+bits 64
+
+; SYSCALL leaves the user rip in rcx and rflags in r11, clears IF through
+; SFMASK and leaves rsp alone. swapgs brings in this CPU's Cpu, which holds
+; the current task's kernel stack; the user registers are saved there as a
+; SyscallFrame and syscall_dispatch runs with interrupts back on, so it may
+; block or be preempted like any other kernel code.
+syscall_entry:
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_KERNEL_RSP]
+    push qword [gs:CPU_USER_RSP]
+    push r11
+    push rcx
+    push rax
+    push rdi
+    push rsi
+    push rdx
+    push r10
+    push r8
+    push r9
+
+    sti
+    cld
+    mov rdi, rsp        ; SyscallFrame*; ten pushes keep the stack aligned
+    call syscall_dispatch
+
+    ; The task may have moved CPUs while blocked. With interrupts off again
+    ; nothing uses the kernel stack or GS until the next entry.
+    cli
+    pop r9
+    pop r8
+    pop r10
+    pop rdx
+    pop rsi
+    pop rdi
+    add rsp, 8          ; The number; rax carries the result back
+    pop rcx
+    pop r11
+    pop rsp
+    swapgs
+    o64 sysret
+
+; enter_user(rip, rsp, arg): drops to ring 3 at rip with arg in rdi and
+; never returns. The kernel stack is abandoned; the TSS and Cpu.kernel_rsp
+; already point at its top for the next entry.
+enter_user:
+    cli
+    push qword USER_DATA_SELECTOR
+    push rsi
+    push qword USER_RFLAGS
+    push qword USER_CODE_SELECTOR
+    push rdi
+    mov rdi, rdx
+
+    ; Leave nothing from the kernel in the registers
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor ebp, ebp
+    xor r8, r8
+    xor r9, r9
+    xor r10, r10
+    xor r11, r11
+    xor r12, r12
+    xor r13, r13
+    xor r14, r14
+    xor r15, r15
+    swapgs
+    iretq
@@ -1,60 +1,931 @@
 #include "task.h"
+#include "smp.h"
 #include "memory.h"
 #include "string.h"
-#include "vga.h"
+#include "log.h"
+#include "cpu.h"
+#include "timer.h"
+#include "fpu.h"
+#include "rwlock.h"
+#include "vm.h"
+#include "wait.h"
 
-static Task tasks[MAX_TASKS];
+#define NICE_0_WEIGHT 1024
+
+static Task boot_task;
+static Task* all_tasks = NULL;
 static int num_tasks = 0;
-static int current_task = -1;
+static int next_task_id = 0;
+
+// Exited tasks and their stacks are recycled through free lists, so
+// spawning only reaches the heap when the Task pool needs another chunk
+static Task* free_tasks = NULL;
+static Task* dead_tasks = NULL;
+static uint64_t free_stacks = 0;    // Stack bases; each holds the next free base
+static uint64_t stack_slots_used = 0;
+
+// Guards the task list, the pools and the dead list. Lookups and listing
+// only read it. It may be held while taking a run queue lock, never the
+// other way round.
+static rwlock_t task_lock = RWLOCK_INIT("task");
+
+static uint32_t quantum_ticks = SCHED_DEFAULT_QUANTUM_MS * TIMER_HZ / 1000;
+
+// CPU share weight for nice -20..19; each step is about 10% of CPU time
+static const uint32_t nice_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+
+static const char* state_names[] = { "ready", "running", "blocked", "dead" };
 
 extern void switch_task(uint64_t* old_sp, uint64_t new_sp);
+extern void task_trampoline(void);
+
+static void enqueue_task(RunQueue* rq, Task* task) {
+    int priority = task->priority;
+
+    // A task that slept must not bank credit from the time it was away
+    if (task->vruntime < rq->min_vruntime[priority]) {
+        task->vruntime = rq->min_vruntime[priority];
+    }
+
+    Task** link = &rq->queues[priority];
+    while (*link && (*link)->vruntime <= task->vruntime) {
+        link = &(*link)->next;
+    }
+    task->next = *link;
+    *link = task;
+    task->state = TASK_READY;
+    if (!task->ready_since) {
+        task->ready_since = rdtsc(); // Kept when only moving between queues
+    }
+    rq->ready_bitmap |= 1u << priority;
+    rq->nr_ready++;
+}
+
+static void dequeue_task(RunQueue* rq, Task* task) {
+    int priority = task->priority;
+    Task** link = &rq->queues[priority];
+    while (*link && *link != task) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = task->next;
+        rq->nr_ready--;
+    }
+    task->next = NULL;
+    if (!rq->queues[priority]) {
+        rq->ready_bitmap &= ~(1u << priority);
+    }
+}
+
+static Task* pick_next_task(RunQueue* rq) {
+    if (!rq->ready_bitmap) {
+        return NULL;
+    }
+    int priority = __builtin_ctz(rq->ready_bitmap);
+    Task* task = rq->queues[priority];
+    dequeue_task(rq, task);
+    rq->min_vruntime[priority] = task->vruntime;
+    return task;
+}
+
+// Charge a running task for the cycles since it was switched in
+static void update_runtime(Task* task) {
+    uint64_t now = rdtsc();
+    uint64_t delta = now - task->exec_start;
+    task->sum_exec += delta;
+    task->vruntime += delta * NICE_0_WEIGHT / task->weight;
+    task->exec_start = now;
+}
+
+static void hist_record(LatencyHist* hist, uint64_t cycles) {
+    int bucket = cycles > 1 ? 63 - __builtin_clzll(cycles) : 0;
+    if (bucket >= SCHED_HIST_BUCKETS) {
+        bucket = SCHED_HIST_BUCKETS - 1;
+    }
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->total += cycles;
+    if (cycles > hist->max) {
+        hist->max = cycles;
+    }
+}
+
+// Lock the run queue a task belongs to. A ready task can be stolen while we
+// wait, and task->cpu only changes under the old queue's lock, so recheck.
+static Cpu* lock_task_cpu(Task* task) {
+    while (1) {
+        Cpu* cpu = smp_cpu(task->cpu);
+        spin_lock(&cpu->rq.lock);
+        if (task->cpu == cpu->id) {
+            return cpu;
+        }
+        spin_unlock(&cpu->rq.lock);
+    }
+}
+
+// Called with cpu->rq.lock held after queueing task; true if cpu should
+// switch to it. The caller kicks a remote CPU once the lock is dropped.
+static bool check_preempt(Cpu* cpu, Task* task) {
+    Task* running = cpu->current;
+    bool preempt = task->priority < running->priority;
+    if (!preempt && task->priority == running->priority) {
+        update_runtime(running);
+        preempt = task->vruntime + SCHED_WAKEUP_GRANULARITY < running->vruntime;
+    }
+    if (preempt) {
+        cpu->need_resched = 1;
+    }
+    return preempt;
+}
+
+static void kick_cpu(Cpu* cpu) {
+    if (cpu != this_cpu()) {
+        smp_send_reschedule(cpu);
+    }
+}
+
+static uint32_t cpu_load(Cpu* cpu) {
+    return cpu->rq.nr_ready + (cpu->current != cpu->idle);
+}
+
+static Cpu* least_loaded_cpu() {
+    Cpu* best = this_cpu();
+    uint32_t best_load = cpu_load(best);
+    for (int i = 0; i < smp_cpu_count(); i++) {
+        Cpu* cpu = smp_cpu(i);
+        uint32_t load = cpu_load(cpu);
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// Take the ready task that would wait longest on the busiest other CPU, if
+// that CPU has at least min_imbalance more tasks queued than self. Called
+// with self's queue locked; the victim is only try-locked, so two CPUs
+// stealing from each other cannot deadlock.
+static Task* steal_task(Cpu* self, uint32_t min_imbalance) {
+    Cpu* busiest = NULL;
+    uint32_t most = 0;
+    for (int i = 0; i < smp_cpu_count(); i++) {
+        Cpu* cpu = smp_cpu(i);
+        if (cpu != self && cpu->rq.nr_ready > most) {
+            busiest = cpu;
+            most = cpu->rq.nr_ready;
+        }
+    }
+    if (!busiest || most < self->rq.nr_ready + min_imbalance) {
+        return NULL;
+    }
+    if (!spin_trylock(&busiest->rq.lock)) {
+        return NULL;
+    }
+
+    Task* task = NULL;
+    RunQueue* rq = &busiest->rq;
+    if (rq->ready_bitmap) {
+        int priority = __builtin_ctz(rq->ready_bitmap);
+        task = rq->queues[priority];
+        while (task->next) {
+            task = task->next;
+        }
+        dequeue_task(rq, task);
+
+        // Carry the task's lead over the old queue into the new one
+        uint64_t lag = task->vruntime > rq->min_vruntime[priority]
+                       ? task->vruntime - rq->min_vruntime[priority] : 0;
+        task->vruntime = self->rq.min_vruntime[priority] + lag;
+        task->cpu = self->id;
+    }
+    spin_unlock(&rq->lock);
+    return task;
+}
+
+static Task* find_task(int id) {
+    for (Task* task = all_tasks; task; task = task->all_next) {
+        if (task->id == id) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static Task* alloc_task() {
+    if (!free_tasks) {
+        Task* chunk = kmalloc(sizeof(Task) * TASK_POOL_CHUNK);
+        if (!chunk) {
+            return NULL;
+        }
+        for (int i = 0; i < TASK_POOL_CHUNK; i++) {
+            chunk[i].next = free_tasks;
+            free_tasks = &chunk[i];
+        }
+    }
+    Task* task = free_tasks;
+    free_tasks = task->next;
+    memset(task, 0, sizeof(Task));
+    return task;
+}
+
+// Returns the base of a stack slot, mapping a fresh one if the pool is empty
+static uint64_t alloc_stack() {
+    if (free_stacks) {
+        uint64_t base = free_stacks;
+        free_stacks = *(uint64_t*)base;
+        return base;
+    }
+
+    if (stack_slots_used >= STACK_REGION_SLOTS) {
+        return 0;
+    }
+    uint64_t base = STACK_REGION_BASE + stack_slots_used * STACK_SLOT_SIZE + PAGE_SIZE;
+    for (uint64_t addr = base; addr < base + STACK_SIZE; addr += PAGE_SIZE) {
+        void* page = allocate_physical_page();
+        if (!page) {
+            // Undo the partial slot; the next attempt maps it afresh
+            while (addr > base) {
+                addr -= PAGE_SIZE;
+                free_physical_page((void*)get_physical_address(addr));
+                unmap_page(addr);
+            }
+            return 0;
+        }
+        map_page(addr, (uint64_t)page, 3); // present + writable; the guard below stays unmapped
+    }
+    stack_slots_used++;
+    return base;
+}
+
+static void free_stack(uint64_t base) {
+    *(uint64_t*)base = free_stacks;
+    free_stacks = base;
+}
+
+static void link_task(Task* task) {
+    task->all_prev = NULL;
+    task->all_next = all_tasks;
+    if (all_tasks) {
+        all_tasks->all_prev = task;
+    }
+    all_tasks = task;
+    num_tasks++;
+}
+
+static void unlink_task(Task* task) {
+    if (task->all_prev) {
+        task->all_prev->all_next = task->all_next;
+    } else {
+        all_tasks = task->all_next;
+    }
+    if (task->all_next) {
+        task->all_next->all_prev = task->all_prev;
+    }
+    num_tasks--;
+}
+
+// Return exited tasks' stacks and structs to the pools. A task whose CPU
+// has not finished switching away from it is left for a later call.
+static void reap_dead_tasks() {
+    if (!__atomic_load_n(&dead_tasks, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    uint64_t flags = write_lock_irqsave(&task_lock);
+    Task** link = &dead_tasks;
+    while (*link) {
+        Task* task = *link;
+        if (__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE)) {
+            link = &task->next;
+            continue;
+        }
+        *link = task->next;
+        if (task->cr3 != kernel_address_space()) {
+            address_space_destroy(task->cr3);
+        }
+        if (task->vm) {
+            vm_destroy(task->vm);
+        }
+        free_stack(task->stack_base);
+        fpu_task_free(task);
+        task->next = free_tasks;
+        free_tasks = task;
+    }
+    write_unlock_irqrestore(&task_lock, flags);
+}
+
+static void init_task_sched(Task* task) {
+    task->priority = SCHED_PRIORITY_NORMAL;
+    task->nice = 0;
+    task->weight = NICE_0_WEIGHT;
+    task->vruntime = 0;
+    task->next = NULL;
+    task->fpu_cpu = -1;
+}
+
+// Make task, which is already running on this CPU, the CPU's current task
+static void init_cpu_sched(Cpu* cpu, Task* task) {
+    memset(&cpu->rq, 0, sizeof(cpu->rq));
+    spin_init(&cpu->rq.lock, "rq");
+
+    task->cr3 = kernel_address_space();
+    task->state = TASK_RUNNING;
+    task->cpu = cpu->id;
+    task->on_cpu = 1;
+    task->exec_start = rdtsc();
+
+    cpu->current = task;
+    cpu->prev = NULL;
+    cpu->ticks_left = quantum_ticks;
+    cpu->need_resched = 0;
+    cpu->balance_ticks = 0;
+}
+
+// Set up the frame switch_task pops: six callee-saved registers (rbx
+// carries the entry point) and a return into task_trampoline
+static void init_task_stack(Task* task, uint64_t stack, void (*entry)(void)) {
+    uint64_t* sp = (uint64_t*)(stack + STACK_SIZE);
+    *--sp = 0;
+    *--sp = (uint64_t)task_trampoline;
+    *--sp = (uint64_t)entry; // rbx
+    *--sp = 0;               // rbp
+    *--sp = 0;               // r12
+    *--sp = 0;               // r13
+    *--sp = 0;               // r14
+    *--sp = 0;               // r15
+    task->rsp = (uint64_t)sp;
+    task->entry = entry;
+    task->stack_base = stack;
+}
+
+// Idle tasks sit below every priority and are never queued or listed; a
+// CPU switches to its idle task when nothing else is runnable
+static void init_idle_task(Cpu* cpu, Task* idle) {
+    idle->id = -1;
+    snprintf(idle->name, sizeof(idle->name), "idle/%d", cpu->id);
+    init_task_sched(idle);
+    idle->priority = SCHED_PRIORITIES;
+    idle->cpu = cpu->id;
+}
+
+// The bootstrap processor's boot context is the shell, so its idle task
+// gets a stack of its own
+static Task* create_idle_task(Cpu* cpu) {
+    uint64_t flags = write_lock_irqsave(&task_lock);
+    Task* idle = alloc_task();
+    uint64_t stack = idle ? alloc_stack() : 0;
+    if (!stack && idle) {
+        idle->next = free_tasks;
+        free_tasks = idle;
+    }
+    write_unlock_irqrestore(&task_lock, flags);
+    if (!stack) {
+        log_error(LOG_TASK, "Error: Out of memory creating the idle task\n");
+        return NULL;
+    }
+    init_idle_task(cpu, idle);
+    init_task_stack(idle, stack, sched_idle);
+    idle->cr3 = kernel_address_space();
+    return idle;
+}
 
 void init_tasking() {
-    memset(tasks, 0, sizeof(tasks));
+    all_tasks = NULL;
     num_tasks = 0;
-    current_task = -1;
+    next_task_id = 0;
+
+    // Task 0 is the code already running (kernel_main) on the boot stack;
+    // its stack pointer is filled in the first time it is switched away from
+    Cpu* cpu = this_cpu();
+    memset(&boot_task, 0, sizeof(boot_task));
+    boot_task.id = next_task_id++;
+    strncpy(boot_task.name, "kernel", sizeof(boot_task.name) - 1);
+    init_task_sched(&boot_task);
+    link_task(&boot_task);
+
+    init_cpu_sched(cpu, &boot_task);
+    cpu->idle = create_idle_task(cpu);
 }
 
-void create_task(int id, char* name, void (*entry)(void)) {
-    if (num_tasks >= MAX_TASKS) {
-        vga_writestring("Error: Maximum number of tasks reached\n");
-        return;
+// Called on each application processor with its boot context, which
+// becomes the CPU's idle task
+void sched_init_cpu(Task* idle) {
+    Cpu* cpu = this_cpu();
+    memset(idle, 0, sizeof(Task));
+    init_idle_task(cpu, idle);
+    init_cpu_sched(cpu, idle);
+    cpu->idle = idle;
+}
+
+// Body of an idle task: look for work, run softirqs raised outside an
+// interrupt, and halt until the next interrupt when there is nothing left,
+// with the tick stopped where that is supported
+void sched_idle() {
+    Cpu* cpu = this_cpu();
+    while (1) {
+        schedule();
+        do_softirq();
+        interrupts_disable();
+        if (cpu->rq.nr_ready == 0 && !cpu->need_resched && !cpu->softirq_pending) {
+            timer_idle_enter();
+            cpu_safe_halt();
+            cpu->idle_wakeups++;
+        } else {
+            interrupts_enable();
+        }
     }
+}
+
+int create_task(const char* name, void (*entry)(void)) {
+    return create_task_arg(name, entry, NULL);
+}
+
+// Returns the new task's id, or -1 if no memory is left for it. The task
+// finds arg in current_task()->arg.
+int create_task_arg(const char* name, void (*entry)(void), void* arg) {
+    uint64_t flags = write_lock_irqsave(&task_lock);
+    Task* task = alloc_task();
+    uint64_t stack = task ? alloc_stack() : 0;
+    if (!stack) {
+        if (task) {
+            task->next = free_tasks;
+            free_tasks = task;
+        }
+        write_unlock_irqrestore(&task_lock, flags);
+        log_error(LOG_TASK, "Error: Out of memory creating task %s\n", name);
+        return -1;
+    }
+    int id = next_task_id++;
+    write_unlock_irqrestore(&task_lock, flags);
 
-    Task* task = &tasks[num_tasks];
     task->id = id;
     strncpy(task->name, name, sizeof(task->name) - 1);
     task->name[sizeof(task->name) - 1] = '\0';
-    task->entry = entry;
+    init_task_sched(task);
+    init_task_stack(task, stack, entry);
+    task->arg = arg;
+    task->cr3 = kernel_address_space(); // User tasks switch to their own
+
+    // New tasks go to the least loaded CPU; once queued the task may run,
+    // and even exit, on another CPU, so it is not touched again
+    flags = write_lock_irqsave(&task_lock);
+    link_task(task);
+    Cpu* cpu = least_loaded_cpu();
+    spin_lock(&cpu->rq.lock);
+    task->cpu = cpu->id;
+    enqueue_task(&cpu->rq, task);
+    bool kick = check_preempt(cpu, task);
+    spin_unlock(&cpu->rq.lock);
+    if (kick) {
+        kick_cpu(cpu);
+    }
+    write_unlock_irqrestore(&task_lock, flags);
+    return id;
+}
 
-    // Allocate stack for the task
-    void* stack = kmalloc(STACK_SIZE);
-    task->rsp = (uint64_t)stack + STACK_SIZE;
+// Called with interrupts off and cpu->rq.lock held. The lock is carried
+// across the switch and released by schedule_tail on the other side, so
+// no other CPU can pick up prev before its registers are saved.
+// A preempted prev stays runnable even if it had already marked itself
+// blocked on its way to schedule(): nothing may have been set up to wake
+// it yet, and its own schedule() call will block it again.
+static void __schedule(Cpu* cpu, bool preempted) {
+    RunQueue* rq = &cpu->rq;
+    Task* prev = cpu->current;
 
-    // Set up initial stack frame
-    task->rsp -= sizeof(uint64_t);
-    *(uint64_t*)task->rsp = (uint64_t)entry;
+    cpu->switch_start = rdtsc();
+    cpu->ticks_left = quantum_ticks;
+    cpu->need_resched = 0;
 
-    task->cr3 = read_cr3();
+    update_runtime(prev);
+    if (preempted && prev->state == TASK_BLOCKED) {
+        prev->state = TASK_RUNNING;
+    }
+    if (prev->state == TASK_RUNNING && prev != cpu->idle) {
+        enqueue_task(rq, prev);
+    }
 
-    num_tasks++;
-}
+    if (cpu->balance_ticks >= SCHED_BALANCE_MS * TIMER_HZ / 1000) {
+        cpu->balance_ticks = 0;
+        Task* task = steal_task(cpu, 2);
+        if (task) {
+            enqueue_task(rq, task);
+        }
+    }
 
-void schedule() {
-    if (num_tasks == 0) return;
+    Task* next = pick_next_task(rq);
+    if (!next) {
+        next = steal_task(cpu, 1);
+    }
+    if (!next) {
+        // Nothing runnable anywhere. Without an idle task a blocked caller
+        // sees a spurious wakeup.
+        next = cpu->idle ? cpu->idle : prev;
+    }
+    uint64_t now = rdtsc();
+    if (next->ready_since) {
+        uint64_t waited = now - next->ready_since;
+        next->wait_sum += waited;
+        if (next->woken) {
+            hist_record(&cpu->wakeup_latency, waited);
+        }
+        next->ready_since = 0;
+        next->woken = false;
+    }
+    next->state = TASK_RUNNING;
+    next->cpu = cpu->id;
+    next->on_cpu = 1;
+    next->exec_start = now;
+    cpu->current = next;
 
-    int next_task = (current_task + 1) % num_tasks;
-    if (current_task == -1) {
-        current_task = next_task;
-        tasks[current_task].entry();
+    if (next != prev) {
+        next->switches++;
+        cpu->prev = prev;
+        fpu_switch(prev, next);
+        if (next->stack_base) {
+            // Where interrupts and syscall_entry land when next is in user mode
+            cpu->kernel_rsp = cpu->tss.rsp[0] = next->stack_base + STACK_SIZE;
+        }
+        if (next->cr3 != read_cr3()) {
+            write_cr3(next->cr3);
+        }
+        switch_task(&prev->rsp, next->rsp);
+        schedule_tail();
     } else {
-        Task* old_task = &tasks[current_task];
-        Task* new_task = &tasks[next_task];
-        current_task = next_task;
-        switch_task(&old_task->rsp, new_task->rsp);
+        spin_unlock(&rq->lock);
+    }
+}
+
+// Runs on the incoming task's stack right after switch_task, possibly on a
+// different CPU than the one prev was switched out on
+void schedule_tail() {
+    Cpu* cpu = this_cpu();
+    Task* prev = cpu->prev;
+    cpu->prev = NULL;
+    if (prev) {
+        __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+        hist_record(&cpu->switch_cost, rdtsc() - cpu->switch_start);
     }
+    spin_unlock(&cpu->rq.lock);
+}
+
+static void schedule_from(bool preempted) {
+    reap_dead_tasks();
+
+    uint64_t flags = irq_save();
+    Cpu* cpu = this_cpu();
+    spin_lock(&cpu->rq.lock);
+    __schedule(cpu, preempted);
+    irq_restore(flags);
+}
+
+void schedule() {
+    schedule_from(false);
 }
 
 void yield() {
     schedule();
 }
+
+// Called from the timer interrupt on every CPU
+void scheduler_tick() {
+    Cpu* cpu = this_cpu();
+    if (cpu->ticks_left > 0) {
+        cpu->ticks_left--;
+    }
+    cpu->balance_ticks++;
+
+    // The idle loop looks for work after every interrupt by itself
+    uint32_t ready = cpu->rq.ready_bitmap;
+    if (cpu->current == cpu->idle || !ready) {
+        return;
+    }
+
+    int best = __builtin_ctz(ready);
+    if (best < cpu->current->priority || (best == cpu->current->priority && cpu->ticks_left == 0)) {
+        cpu->need_resched = 1;
+    }
+}
+
+// Called on the way out of every interrupt, still on the interrupted
+// task's stack with interrupts disabled. An interrupt that lands while
+// softirqs run leaves the switch to do_softirq's caller.
+void preempt_check() {
+    Cpu* cpu = this_cpu();
+    if (cpu->need_resched && !cpu->in_softirq) {
+        schedule_from(true);
+    }
+}
+
+void sched_set_quantum_ms(uint32_t ms) {
+    uint32_t ticks = ms * TIMER_HZ / 1000;
+    quantum_ticks = ticks ? ticks : 1;
+}
+
+uint32_t sched_get_quantum_ms() {
+    return quantum_ticks * 1000 / TIMER_HZ;
+}
+
+int task_set_priority(int id, int priority) {
+    if (priority < 0 || priority >= SCHED_PRIORITIES) {
+        return -1;
+    }
+
+    uint64_t flags = read_lock_irqsave(&task_lock);
+    Task* task = find_task(id);
+    if (!task) {
+        read_unlock_irqrestore(&task_lock, flags);
+        return -1;
+    }
+
+    Cpu* cpu = lock_task_cpu(task);
+    RunQueue* rq = &cpu->rq;
+    if (task->state == TASK_READY) {
+        dequeue_task(rq, task);
+        task->priority = priority;
+        enqueue_task(rq, task);
+    } else {
+        task->priority = priority;
+    }
+    bool kick = false;
+    if (rq->ready_bitmap && (int)__builtin_ctz(rq->ready_bitmap) < cpu->current->priority) {
+        cpu->need_resched = 1;
+        kick = true;
+    }
+    spin_unlock(&rq->lock);
+    if (kick) {
+        kick_cpu(cpu);
+    }
+    read_unlock_irqrestore(&task_lock, flags);
+    return 0;
+}
+
+int task_set_nice(int id, int nice) {
+    if (nice < NICE_MIN || nice > NICE_MAX) {
+        return -1;
+    }
+
+    uint64_t flags = read_lock_irqsave(&task_lock);
+    Task* task = find_task(id);
+    if (!task) {
+        read_unlock_irqrestore(&task_lock, flags);
+        return -1;
+    }
+    Cpu* cpu = lock_task_cpu(task);
+    if (task == cpu->current) {
+        update_runtime(task); // Charge time used so far at the old weight
+    }
+    task->nice = nice;
+    task->weight = nice_to_weight[nice - NICE_MIN];
+    spin_unlock(&cpu->rq.lock);
+    read_unlock_irqrestore(&task_lock, flags);
+    return 0;
+}
+
+// Copies a live task's name; false once it has been reaped
+bool task_get_name(int id, char* name, size_t size) {
+    uint64_t flags = read_lock_irqsave(&task_lock);
+    Task* task = find_task(id);
+    if (task) {
+        strncpy(name, task->name, size - 1);
+        name[size - 1] = '\0';
+    }
+    read_unlock_irqrestore(&task_lock, flags);
+    return task != NULL;
+}
+
+Task* current_task() {
+    uint64_t flags = irq_save();
+    Task* task = this_cpu()->current;
+    irq_restore(flags);
+    return task;
+}
+
+// Stop running the current task until task_wake is called on it. Callers
+// waiting for a condition use wait_event instead, which cannot miss a wakeup.
+void task_block() {
+    uint64_t flags = irq_save();
+    Cpu* cpu = this_cpu();
+    spin_lock(&cpu->rq.lock);
+    cpu->current->state = TASK_BLOCKED;
+    __schedule(cpu, false);
+    irq_restore(flags);
+}
+
+// Make a blocked task runnable on the CPU it last ran on; that CPU switches
+// to it at its next interrupt exit if it is more urgent than what is running.
+// A task that marked itself blocked but has not switched away yet simply
+// keeps running.
+void task_wake(Task* task) {
+    uint64_t flags = irq_save();
+    Cpu* cpu = lock_task_cpu(task);
+    bool kick = false;
+    if (task->state == TASK_BLOCKED) {
+        if (cpu->current == task) {
+            task->state = TASK_RUNNING;
+        } else {
+            task->woken = true;
+            enqueue_task(&cpu->rq, task);
+            kick = check_preempt(cpu, task);
+        }
+    }
+    spin_unlock(&cpu->rq.lock);
+    if (kick) {
+        kick_cpu(cpu);
+    }
+    irq_restore(flags);
+}
+
+void task_list(char* buffer, size_t buffer_size) {
+    uint64_t flags = irq_save();
+    Cpu* cpu = this_cpu();
+    spin_lock(&cpu->rq.lock);
+    update_runtime(cpu->current);
+    spin_unlock(&cpu->rq.lock);
+
+    read_lock(&task_lock);
+    size_t offset = snprintf(buffer, buffer_size, "%d tasks on %d CPUs, %llu stack slots\n"
+                             "ID  NAME             CPU PRIO NICE STATE    VRUNTIME\n",
+                             num_tasks, smp_cpu_count(), stack_slots_used);
+    for (Task* task = all_tasks; task && offset < buffer_size - 1; task = task->all_next) {
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-3d %-16s %3d %4d %4d %-8s %llu\n",
+                           task->id, task->name, task->cpu, task->priority, task->nice,
+                           state_names[task->state], task->vruntime);
+    }
+    read_unlock(&task_lock);
+    irq_restore(flags);
+}
+
+// Cycles a task has run, including the slice in progress. Racy for tasks
+// running on other CPUs, which is good enough for a display.
+static uint64_t task_exec_now(Task* task, uint64_t now) {
+    uint64_t exec = task->sum_exec;
+    if (task->state == TASK_RUNNING && task->on_cpu && now > task->exec_start) {
+        exec += now - task->exec_start;
+    }
+    return exec;
+}
+
+static void hist_merge(LatencyHist* into, LatencyHist* from) {
+    for (int i = 0; i < SCHED_HIST_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+    into->count += from->count;
+    into->total += from->total;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+static size_t hist_format(char* buffer, size_t buffer_size, const char* title, LatencyHist* hist) {
+    size_t offset = snprintf(buffer, buffer_size, "%s: %llu samples, avg %llu, max %llu cycles\n",
+                             title, hist->count, hist->count ? hist->total / hist->count : 0, hist->max);
+    int shown = 0;
+    for (int i = 0; i < SCHED_HIST_BUCKETS && offset < buffer_size - 1; i++) {
+        if (hist->buckets[i]) {
+            offset += snprintf(buffer + offset, buffer_size - offset, "  2^%-2d %8llu%s", i,
+                               hist->buckets[i], ++shown % 4 == 0 ? "\n" : "");
+        }
+    }
+    if (shown % 4 && offset < buffer_size - 1) {
+        offset += snprintf(buffer + offset, buffer_size - offset, "\n");
+    }
+    return offset;
+}
+
+// CPU use of every task over a sample_ms window, then each CPU's idle
+// share and the scheduler latency histograms since boot. Sleeps for the
+// window, so only call it from a task.
+void task_top(char* buffer, size_t buffer_size, uint32_t sample_ms) {
+    // top_sample belongs to whoever runs top; the shell is the only caller
+    uint64_t flags = read_lock_irqsave(&task_lock);
+    uint64_t start = rdtsc();
+    for (Task* task = all_tasks; task; task = task->all_next) {
+        task->top_sample = task_exec_now(task, start);
+    }
+    for (int i = 0; i < smp_cpu_count(); i++) {
+        Task* idle = smp_cpu(i)->idle;
+        if (idle) {
+            idle->top_sample = task_exec_now(idle, start);
+        }
+    }
+    read_unlock_irqrestore(&task_lock, flags);
+
+    sleep_ms(sample_ms);
+
+    flags = read_lock_irqsave(&task_lock);
+    uint64_t now = rdtsc();
+    uint64_t elapsed = now - start;
+    size_t offset = snprintf(buffer, buffer_size, "%u ms sample, %llu Mcycles\n"
+                             "ID  NAME             CPU  %%CPU   SWITCHES  WAIT(Mcyc)\n",
+                             sample_ms, elapsed / 1000000);
+    // Tasks created during the window start from a top_sample of zero
+    for (Task* task = all_tasks; task && offset < buffer_size - 1; task = task->all_next) {
+        uint64_t permille = (task_exec_now(task, now) - task->top_sample) * 1000 / elapsed;
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-3d %-16s %3d %3llu.%llu %10llu %11llu\n",
+                           task->id, task->name, task->cpu, permille / 10, permille % 10,
+                           task->switches, task->wait_sum / 1000000);
+    }
+    for (int i = 0; i < smp_cpu_count() && offset < buffer_size - 1; i++) {
+        Task* idle = smp_cpu(i)->idle;
+        if (idle) {
+            uint64_t permille = (task_exec_now(idle, now) - idle->top_sample) * 1000 / elapsed;
+            offset += snprintf(buffer + offset, buffer_size - offset, "CPU %d: %llu.%llu%% idle\n",
+                               i, permille / 10, permille % 10);
+        }
+    }
+    read_unlock_irqrestore(&task_lock, flags);
+
+    LatencyHist wakeup = { 0 };
+    LatencyHist switches = { 0 };
+    for (int i = 0; i < smp_cpu_count(); i++) {
+        hist_merge(&wakeup, &smp_cpu(i)->wakeup_latency);
+        hist_merge(&switches, &smp_cpu(i)->switch_cost);
+    }
+    if (offset < buffer_size - 1) {
+        offset += hist_format(buffer + offset, buffer_size - offset, "Wakeup to run", &wakeup);
+    }
+    if (offset < buffer_size - 1) {
+        hist_format(buffer + offset, buffer_size - offset, "Context switch", &switches);
+    }
+}
+
+static void hist_dump(void (*write)(const char* line), const char* name, int cpu, LatencyHist* hist) {
+    char line[SCHED_HIST_BUCKETS * 21 + 128];
+    size_t offset = snprintf(line, sizeof(line), "SCHEDSTAT hist=%s cpu=%d count=%llu total=%llu max=%llu buckets=",
+                             name, cpu, hist->count, hist->total, hist->max);
+    for (int i = 0; i < SCHED_HIST_BUCKETS; i++) {
+        offset += snprintf(line + offset, sizeof(line) - offset, i ? ",%llu" : "%llu", hist->buckets[i]);
+    }
+    snprintf(line + offset, sizeof(line) - offset, "\n");
+    write(line);
+}
+
+// One key=value record per line, all in TSC cycles, for scripts reading
+// the serial port. The name comes last since it may contain spaces.
+void sched_stats_dump(void (*write)(const char* line)) {
+    char line[128];
+    uint64_t flags = read_lock_irqsave(&task_lock);
+    uint64_t now = rdtsc();
+    for (Task* task = all_tasks; task; task = task->all_next) {
+        snprintf(line, sizeof(line), "SCHEDSTAT task id=%d cpu=%d exec=%llu switches=%llu wait=%llu name=%s\n",
+                 task->id, task->cpu, task_exec_now(task, now), task->switches, task->wait_sum, task->name);
+        write(line);
+    }
+    read_unlock_irqrestore(&task_lock, flags);
+
+    for (int i = 0; i < smp_cpu_count(); i++) {
+        Cpu* cpu = smp_cpu(i);
+        if (cpu->idle) {
+            snprintf(line, sizeof(line), "SCHEDSTAT idle cpu=%d exec=%llu\n", i, task_exec_now(cpu->idle, rdtsc()));
+            write(line);
+        }
+        hist_dump(write, "wakeup", i, &cpu->wakeup_latency);
+        hist_dump(write, "switch", i, &cpu->switch_cost);
+    }
+    write("SCHEDSTAT end\n");
+}
+
+// Ends the current task. Its stack is still in use until the switch away
+// completes, which clears on_cpu and lets a later schedule() reap it.
+void task_exit() {
+    interrupts_disable();
+    Cpu* cpu = this_cpu();
+    Task* task = cpu->current;
+    if (task == &boot_task) {
+        log_error(LOG_TASK, "Error: The kernel task cannot exit\n");
+        while (1) {
+            task_block();
+        }
+    }
+
+    write_lock(&task_lock);
+    unlink_task(task);
+    task->next = dead_tasks;
+    dead_tasks = task;
+    write_unlock(&task_lock);
+
+    spin_lock(&cpu->rq.lock);
+    task->state = TASK_DEAD;
+    __schedule(cpu, false);
+    while (1) {
+        // Not reached: dead tasks are never switched back in
+    }
+}
+
+bool task_is_stack_guard(uint64_t address) {
+    if (address < STACK_REGION_BASE || address >= STACK_REGION_BASE + stack_slots_used * STACK_SLOT_SIZE) {
+        return false;
+    }
+    return (address - STACK_REGION_BASE) % STACK_SLOT_SIZE < PAGE_SIZE;
+}
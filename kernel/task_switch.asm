@@ -1,4 +1,7 @@
 global switch_task
+global task_trampoline
+extern task_exit
+extern schedule_tail
 
 switch_task:
     ; Save current task's state
@@ -25,3 +28,16 @@ switch_task:
 
     ; Return to new task
     ret
+
+; First code a new task runs: create_task leaves the entry point in rbx,
+; and a task whose entry function returns exits.
+; schedule_tail releases the run queue lock the switch was made under.
+; A task can be switched in from an interrupt handler, so interrupts are
+; re-enabled here rather than inherited.
+task_trampoline:
+    xor rbp, rbp
+    and rsp, ~0xF
+    call schedule_tail
+    sti
+    call rbx
+    call task_exit
@@ -0,0 +1,277 @@
+#include "uring.h"
+#include "cpu.h"
+#include "log.h"
+#include "string.h"
+#include "syscall.h"
+#include "task.h"
+#include "timer.h"
+#include "user.h"
+#include "vm.h"
+
+// The user programs in user_programs.asm hard-code this layout
+_Static_assert(sizeof(UringSqe) == 32, "UringSqe layout");
+_Static_assert(sizeof(UringCqe) == 16, "UringCqe layout");
+_Static_assert(offsetof(UringShared, flags) == 24, "UringShared layout");
+_Static_assert(offsetof(UringShared, sqes_offset) == 32, "UringShared layout");
+
+#define URING_SQES_OFFSET 64
+
+// Pollers signal exit here rather than through their ring, which the
+// owner frees as soon as it sees poller_done
+static WaitQueue poller_exit_wait = WAIT_QUEUE_INIT;
+
+extern const uint8_t user_uring_bench_start[];
+extern const uint8_t user_uring_bench_end[];
+
+static const char* ring_file(Uring* ring, int32_t fd) {
+    if (fd < 0 || fd >= URING_MAX_FILES || !ring->files[fd][0]) {
+        return NULL;
+    }
+    return ring->files[fd];
+}
+
+static int32_t uring_open(Uring* ring, const UringSqe* sqe) {
+    char name[MAX_FILENAME_LENGTH];
+    if (!user_copy_string(name, (const char*)sqe->addr, sizeof(name))) {
+        return SYSCALL_EFAULT;
+    }
+    if (!fs_open(name)) {
+        return -1;
+    }
+    for (int fd = 0; fd < URING_MAX_FILES; fd++) {
+        if (!ring->files[fd][0]) {
+            strncpy(ring->files[fd], name, MAX_FILENAME_LENGTH);
+            return fd;
+        }
+    }
+    return SYSCALL_EMFILE;
+}
+
+// Runs in the ring owner's address space, so user buffers are checked
+// against its page tables like any syscall's
+static int32_t uring_execute(Uring* ring, const UringSqe* sqe) {
+    const char* name;
+    switch (sqe->opcode) {
+    case URING_OP_NOP:
+        return 0;
+    case URING_OP_OPEN:
+        return uring_open(ring, sqe);
+    case URING_OP_CLOSE:
+        if (!ring_file(ring, sqe->fd)) {
+            return SYSCALL_EBADF;
+        }
+        ring->files[sqe->fd][0] = '\0';
+        return 0;
+    case URING_OP_READ:
+        if (!(name = ring_file(ring, sqe->fd))) {
+            return SYSCALL_EBADF;
+        }
+        if (!vm_user_access((void*)sqe->addr, sqe->len, true)) {
+            return SYSCALL_EFAULT;
+        }
+        return fs_pread(name, (void*)sqe->addr, sqe->len, sqe->offset);
+    case URING_OP_WRITE:
+        if (!(name = ring_file(ring, sqe->fd))) {
+            return SYSCALL_EBADF;
+        }
+        if (!vm_user_access((void*)sqe->addr, sqe->len, false)) {
+            return SYSCALL_EFAULT;
+        }
+        return fs_pwrite(name, (const void*)sqe->addr, sqe->len, sqe->offset);
+    case URING_OP_FSYNC:
+        // The ramfs has nothing to flush, and entries complete in order
+        if (!(name = ring_file(ring, sqe->fd))) {
+            return SYSCALL_EBADF;
+        }
+        return fs_open(name) ? 0 : -1;
+    default:
+        return SYSCALL_EINVAL;
+    }
+}
+
+static uint32_t sq_pending(Uring* ring) {
+    return __atomic_load_n(&ring->shared->sq_tail, __ATOMIC_ACQUIRE) - ring->sq_head;
+}
+
+static uint32_t cq_ready(Uring* ring) {
+    return ring->cq_tail - __atomic_load_n(&ring->shared->cq_head, __ATOMIC_ACQUIRE);
+}
+
+static bool can_submit(Uring* ring) {
+    return sq_pending(ring) && cq_ready(ring) < ring->cq_entries;
+}
+
+// Executes up to max queued entries, stopping early if the completion ring
+// fills. Each entry is copied out once so the task can't change it midway.
+// Only one context consumes a ring: the poller if there is one, otherwise
+// the owner's enter calls.
+static uint32_t uring_submit(Uring* ring, uint32_t max) {
+    uint32_t done = 0;
+    while (done < max && can_submit(ring)) {
+        UringSqe sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+        ring->sq_head++;
+        UringCqe* cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->result = uring_execute(ring, &sqe);
+        cqe->flags = 0;
+        ring->cq_tail++;
+        done++;
+    }
+    if (done) {
+        __atomic_store_n(&ring->shared->sq_head, ring->sq_head, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->shared->cq_tail, ring->cq_tail, __ATOMIC_RELEASE);
+        ring->submitted += done;
+        ring->batches++;
+        if (wait_queue_active(&ring->cq_wait)) {
+            wake_up(&ring->cq_wait);
+        }
+    }
+    return done;
+}
+
+// Switches the calling task onto cr3 and vm; the reaper frees whatever
+// address space a task holds when it dies, so pollers hand it back first
+static void adopt_address_space(uint64_t cr3, VmSpace* vm) {
+    uint64_t flags = irq_save();
+    Task* task = current_task();
+    task->cr3 = cr3;
+    task->vm = vm;
+    write_cr3(cr3);
+    irq_restore(flags);
+}
+
+// Consumes the ring as entries arrive. After URING_SQPOLL_IDLE_MS without
+// progress it sets URING_SQ_NEED_WAKEUP and sleeps; the flag is set before
+// the last look at the ring, so an entry queued meanwhile is not missed.
+// A full completion ring also counts as no progress until the task reaps.
+static void uring_poller_main() {
+    Uring* ring = current_task()->arg;
+    adopt_address_space(ring->cr3, ring->vm);
+
+    uint64_t idle_ticks = URING_SQPOLL_IDLE_MS * TIMER_HZ / 1000;
+    uint64_t idle_since = timer_ticks();
+    while (!ring->stopping) {
+        if (uring_submit(ring, ring->sq_entries)) {
+            idle_since = timer_ticks();
+        } else if (timer_ticks() - idle_since < idle_ticks) {
+            yield();
+        } else {
+            __atomic_or_fetch(&ring->shared->flags, URING_SQ_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+            wait_event(&ring->poll_wait, ring->stopping || can_submit(ring));
+            __atomic_and_fetch(&ring->shared->flags, ~URING_SQ_NEED_WAKEUP, __ATOMIC_RELAXED);
+            idle_since = timer_ticks();
+        }
+    }
+
+    adopt_address_space(kernel_address_space(), NULL);
+    __atomic_store_n(&ring->poller_done, true, __ATOMIC_RELEASE);
+    wake_up(&poller_exit_wait);
+}
+
+// SYS_URING_SETUP: maps a ring of entries (rounded up to a power of two)
+// at URING_BASE in the caller's address space and returns its address
+int64_t uring_setup(uint32_t entries, uint32_t flags) {
+    Task* task = current_task();
+    if (task->uring) {
+        return SYSCALL_EBUSY;
+    }
+    if (entries == 0 || entries > URING_MAX_ENTRIES || (flags & ~URING_SETUP_SQPOLL)) {
+        return SYSCALL_EINVAL;
+    }
+    uint32_t sq_entries = 1;
+    while (sq_entries < entries) {
+        sq_entries <<= 1;
+    }
+    uint32_t cq_entries = sq_entries * 2;
+    uint32_t cqes_offset = URING_SQES_OFFSET + sq_entries * sizeof(UringSqe);
+    size_t size = cqes_offset + cq_entries * sizeof(UringCqe);
+
+    Uring* ring = kmalloc(sizeof(Uring));
+    if (!ring || !user_map_zeroed(URING_BASE, size)) {
+        kfree(ring);
+        return SYSCALL_ENOMEM;
+    }
+    memset(ring, 0, sizeof(Uring));
+    ring->shared = (UringShared*)URING_BASE;
+    ring->sqes = (UringSqe*)(URING_BASE + URING_SQES_OFFSET);
+    ring->cqes = (UringCqe*)(URING_BASE + cqes_offset);
+    ring->sq_entries = sq_entries;
+    ring->cq_entries = cq_entries;
+    ring->cr3 = task->cr3;
+    ring->vm = task->vm;
+    wait_queue_init(&ring->cq_wait);
+    wait_queue_init(&ring->poll_wait);
+
+    // A ring set up before keeps its pages, so clear them for this one
+    memset(ring->shared, 0, size);
+    ring->shared->sq_entries = sq_entries;
+    ring->shared->cq_entries = cq_entries;
+    ring->shared->setup_flags = flags;
+    ring->shared->sqes_offset = URING_SQES_OFFSET;
+    ring->shared->cqes_offset = cqes_offset;
+
+    if (flags & URING_SETUP_SQPOLL) {
+        char name[32];
+        snprintf(name, sizeof(name), "uring/%d", task->id);
+        if (create_task_arg(name, uring_poller_main, ring) < 0) {
+            kfree(ring);
+            return SYSCALL_ENOMEM;
+        }
+        ring->sqpoll = true;
+    }
+    task->uring = ring;
+    return URING_BASE;
+}
+
+// SYS_URING_ENTER: submits up to to_submit entries, or with a poller wakes
+// it if asked to, then waits for min_complete completions to be ready.
+// Returns the number submitted. Without a poller nothing completes later,
+// so there is nothing to wait for.
+int64_t uring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    Uring* ring = current_task()->uring;
+    if (!ring) {
+        return SYSCALL_EBADF;
+    }
+    if (!ring->sqpoll) {
+        return uring_submit(ring, to_submit < ring->sq_entries ? to_submit : ring->sq_entries);
+    }
+
+    if ((flags & URING_ENTER_SQ_WAKEUP) &&
+        (__atomic_load_n(&ring->shared->flags, __ATOMIC_SEQ_CST) & URING_SQ_NEED_WAKEUP)) {
+        wake_up(&ring->poll_wait);
+    }
+    if (min_complete > ring->cq_entries) {
+        min_complete = ring->cq_entries;
+    }
+    wait_event(&ring->cq_wait, cq_ready(ring) >= min_complete);
+    return to_submit;
+}
+
+// Called as a user task exits, while its address space is still loaded
+void uring_release(Task* task) {
+    Uring* ring = task->uring;
+    if (!ring) {
+        return;
+    }
+    if (ring->sqpoll) {
+        ring->stopping = true;
+        wake_up(&ring->poll_wait);
+        wait_event(&poller_exit_wait, __atomic_load_n(&ring->poller_done, __ATOMIC_ACQUIRE));
+    }
+    task->uring = NULL;
+    kfree(ring);
+}
+
+// Average TSC cycles per ramfs write submitted through a ring, in batches
+// of URING_MAX_ENTRIES with one enter each, or 0 if the program failed
+uint64_t uring_bench(uint32_t rounds, bool sqpoll) {
+    int64_t cycles;
+    uint64_t arg = rounds | (sqpoll ? (uint64_t)URING_SETUP_SQPOLL << 32 : 0);
+    if (rounds == 0 ||
+        !user_run("uringbench", user_uring_bench_start, user_uring_bench_end - user_uring_bench_start,
+                  arg, &cycles) ||
+        cycles < 0) {
+        return 0;
+    }
+    return cycles / ((uint64_t)rounds * URING_MAX_ENTRIES);
+}
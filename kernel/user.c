@@ -0,0 +1,217 @@
+#include "user.h"
+#include "cpu.h"
+#include "elf.h"
+#include "filesystem.h"
+#include "log.h"
+#include "string.h"
+#include "task.h"
+#include "uring.h"
+#include "vdso.h"
+#include "vm.h"
+#include "wait.h"
+
+// What user_run and user_exec hand their task: an image to copy in, or an
+// ELF file to load. It lives on the caller's stack, so the task stops
+// touching it once exited is set.
+typedef struct UserProcess {
+    const char* path;
+    const void* image;
+    size_t size;
+    uint64_t arg;
+    int64_t status;
+    volatile bool exited;
+} UserProcess;
+
+#define PAGE_FAULT_WRITE 0x2 // Error code bit: the access was a write
+
+static WaitQueue exit_wait = WAIT_QUEUE_INIT;
+
+extern void enter_user(uint64_t rip, uint64_t rsp, uint64_t arg) __attribute__((noreturn));
+extern const uint8_t user_null_bench_start[];
+extern const uint8_t user_null_bench_end[];
+extern const uint8_t user_hello_elf_start[];
+extern const uint8_t user_hello_elf_end[];
+
+// Maps a zeroed page at virtual_addr, filled from data if there is any
+static bool map_user_copy(uint64_t cr3, uint64_t virtual_addr, const uint8_t* data, size_t size) {
+    uint64_t page = (uint64_t)allocate_physical_page();
+    if (!page) {
+        return false;
+    }
+    uint8_t* contents = (uint8_t*)(page + KERNEL_BASE);
+    memset(contents, 0, PAGE_SIZE);
+    if (size) {
+        memcpy(contents, data, size);
+    }
+    if (!map_user_page(cr3, virtual_addr, page, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER)) {
+        free_physical_page((void*)page);
+        return false;
+    }
+    return true;
+}
+
+// Copies a NUL-terminated user string of at most size - 1 characters,
+// checking each byte's page before reading it
+bool user_copy_string(char* dest, const char* src, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (!vm_user_access(src + i, 1, false)) {
+            return false;
+        }
+        dest[i] = src[i];
+        if (!dest[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Backs [virtual_addr, virtual_addr + size) in the current task's address
+// space with zeroed, writable user pages, keeping any already there
+bool user_map_zeroed(uint64_t virtual_addr, size_t size) {
+    uint64_t cr3 = current_task()->cr3;
+    uint64_t end = virtual_addr + size;
+    for (uint64_t page = virtual_addr & ~(uint64_t)(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        if (!user_access_ok((void*)page, PAGE_SIZE, true) && !map_user_copy(cr3, page, NULL, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Body of every user task: builds the address space and drops to ring 3.
+// Once task->cr3 is set the scheduler loads it and the reaper frees it,
+// so failing part way only needs to exit.
+static void user_task_main() {
+    Task* task = current_task();
+    UserProcess* process = task->arg;
+    task->user = process;
+
+    uint64_t cr3 = address_space_create();
+    if (!cr3) {
+        log_error(LOG_TASK, "Error: Out of memory for %s's address space\n", task->name);
+        user_exit(-1);
+    }
+    uint64_t flags = irq_save();
+    task->cr3 = cr3;
+    write_cr3(cr3);
+    irq_restore(flags);
+
+    if (!vdso_map(cr3)) {
+        log_error(LOG_TASK, "Error: Out of memory mapping %s's vDSO\n", task->name);
+        user_exit(-1);
+    }
+    uint64_t entry = USER_BASE;
+    if (process->path) {
+        VmSpace* vm;
+        int error = elf_load(process->path, &vm, &entry);
+        if (error < 0) {
+            log_error(LOG_TASK, "Error: Cannot load %s: %s\n", process->path, elf_strerror(error));
+            user_exit(-1);
+        }
+        task->vm = vm;
+    }
+    const uint8_t* image = process->image;
+    for (size_t offset = 0; offset < process->size; offset += PAGE_SIZE) {
+        size_t chunk = process->size - offset < PAGE_SIZE ? process->size - offset : PAGE_SIZE;
+        if (!map_user_copy(cr3, USER_BASE + offset, image + offset, chunk)) {
+            log_error(LOG_TASK, "Error: Out of memory loading %s\n", task->name);
+            user_exit(-1);
+        }
+    }
+    if (!user_map_zeroed(USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE, USER_STACK_PAGES * PAGE_SIZE)) {
+        log_error(LOG_TASK, "Error: Out of memory for %s's stack\n", task->name);
+        user_exit(-1);
+    }
+    enter_user(entry, USER_STACK_TOP, process->arg);
+}
+
+static bool run_process(const char* name, UserProcess* process, int64_t* status) {
+    if (create_task_arg(name, user_task_main, process) < 0) {
+        return false;
+    }
+    wait_event(&exit_wait, __atomic_load_n(&process->exited, __ATOMIC_ACQUIRE));
+    *status = process->status;
+    return true;
+}
+
+// Runs image as a user program in a new task and blocks until it exits.
+// False if the task could not be started.
+bool user_run(const char* name, const void* image, size_t size, uint64_t arg, int64_t* status) {
+    if (size == 0 || size > USER_IMAGE_MAX) {
+        return false;
+    }
+    UserProcess process = { NULL, image, size, arg, 0, false };
+    return run_process(name, &process, status);
+}
+
+// Runs the ELF executable at path with arg in its first argument register,
+// blocking until it exits. Returns an ELF_E* code if the file is no good,
+// or ELF_ENOMEM if the task could not be started.
+int user_exec(const char* path, uint64_t arg, int64_t* status) {
+    ElfInfo info;
+    int error = elf_parse(path, &info);
+    if (error < 0) {
+        return error;
+    }
+    UserProcess process = { path, NULL, 0, arg, 0, false };
+    return run_process(path, &process, status) ? 0 : ELF_ENOMEM;
+}
+
+// Copies the built-in ELF executables into the ramfs for the exec command
+void user_install_programs() {
+    int size = user_hello_elf_end - user_hello_elf_start;
+    if (fs_create("hello") < 0 || fs_write("hello", user_hello_elf_start, size) != size) {
+        log_warn(LOG_TASK, "Warning: Could not install the hello program\n");
+    }
+}
+
+// SYS_EXIT, and the end of any user task that faults
+void user_exit(int64_t status) {
+    Task* task = current_task();
+    uring_release(task);
+    UserProcess* process = task->user;
+    if (process) {
+        process->status = status;
+        __atomic_store_n(&process->exited, true, __ATOMIC_RELEASE);
+        wake_up(&exit_wait);
+    }
+    task_exit();
+    while (1) {
+        // Not reached
+    }
+}
+
+// An exception raised in ring 3 kills the task rather than the kernel,
+// unless it is a page fault the task's regions can satisfy
+void user_fault(InterruptFrame* frame) {
+    uint64_t fault_address = 0;
+    if (frame->vector == 14) {
+        __asm__ volatile("mov %%cr2, %0" : "=r"(fault_address));
+        // User code always runs with interrupts on; they stay on while the
+        // page is read in, which may decompress the whole file
+        interrupts_enable();
+        bool handled = vm_handle_fault(fault_address, frame->error_code & PAGE_FAULT_WRITE);
+        interrupts_disable();
+        if (handled) {
+            return;
+        }
+    }
+    Task* task = current_task();
+    log_error(LOG_TASK, "Task %d (%s) killed: exception %u at rip=%p cr2=%p\n",
+              task->id, task->name, (unsigned int)frame->vector, (void*)frame->rip,
+              (void*)fault_address);
+    user_exit(-1);
+}
+
+// Average TSC cycles for a SYS_NULL round trip from user mode, or 0 if the
+// benchmark program could not run
+uint64_t syscall_bench(uint32_t calls) {
+    int64_t cycles;
+    if (calls == 0 ||
+        !user_run("syscallbench", user_null_bench_start, user_null_bench_end - user_null_bench_start,
+                  calls, &cycles) ||
+        cycles < 0) {
+        return 0;
+    }
+    return cycles / calls;
+}
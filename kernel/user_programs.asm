@@ -0,0 +1,277 @@
+global user_null_bench_start
+global user_null_bench_end
+global user_uring_bench_start
+global user_uring_bench_end
+global user_vdso_bench_start
+global user_vdso_bench_end
+global user_hello_elf_start
+global user_hello_elf_end
+
+; Built-in user programs. The bare images are position independent and
+; copied into a user task's address space by user_run; rdi holds the
+; argument, and the result comes back as the SYS_EXIT status. The numbers
+; and layouts below mirror syscall.h, uring.h and elf.h.
+
+%define SYS_NULL 0
+%define SYS_EXIT 1
+%define SYS_WRITE 5
+%define SYS_FS_CREATE 7
+%define SYS_FS_DELETE 8
+%define SYS_URING_SETUP 12
+%define SYS_URING_ENTER 13
+%define SYS_TIME_NS 6
+
+%define VDSO_DATA 0x8030000000  ; VDSO_BASE
+%define VDSO_ENTRY_TIME_NS 0    ; VdsoData.entries[VDSO_TIME_NS]
+
+%define RING_SQ_TAIL 4          ; UringShared
+%define RING_CQ_HEAD 8
+%define RING_CQ_TAIL 12
+%define RING_SQES_OFFSET 32
+%define RING_CQES_OFFSET 36
+%define SQE_OPCODE 0            ; UringSqe, 32 bytes
+%define SQE_FD 4
+%define SQE_ADDR 8
+%define SQE_LEN 16
+%define SQE_OFFSET 20
+%define SQE_USER_DATA 24
+%define CQE_RESULT 8            ; UringCqe, 16 bytes
+%define URING_OP_OPEN 1
+%define URING_OP_WRITE 4
+%define URING_ENTER_SQ_WAKEUP 1
+
+%define URING_BATCH 256         ; URING_MAX_ENTRIES
+%define URING_RECORD 16
+
+%define HELLO_TEXT 0x8000000000 ; ELF_LOAD_BASE
+%define HELLO_BSS 0x8000001000
+
+section .text
+bits 64
+
+; null_bench(calls): makes that many SYS_NULL calls and exits with the TSC
+; cycles they took. rdtsc isn't serializing, which doesn't matter over many
+; calls.
+user_null_bench_start:
+    mov r12, rdi
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+.loop:
+    test r12, r12
+    jz .done
+    mov eax, SYS_NULL
+    syscall
+    dec r12
+    jmp .loop
+.done:
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    mov rdi, rax
+    mov eax, SYS_EXIT
+    syscall
+    ud2
+user_null_bench_end:
+
+; uring_bench(rounds | setup flags << 32): opens uring.bin through a ring,
+; then writes rounds batches of URING_BATCH records with one enter each,
+; reaping the completions straight from the shared ring. Exits with the TSC
+; cycles the batches took, or -1 if anything failed.
+user_uring_bench_start:
+    mov r12d, edi               ; Rounds
+    mov rsi, rdi
+    shr rsi, 32                 ; Setup flags
+    mov edi, URING_BATCH
+    mov eax, SYS_URING_SETUP
+    syscall
+    test rax, rax
+    js .fail
+    mov r13, rax                ; UringShared*
+    mov r14d, [r13 + RING_SQES_OFFSET]
+    add r14, r13                ; Submission entries
+    mov r15d, [r13 + RING_CQES_OFFSET]
+    add r15, r13                ; Completion entries
+
+    lea rdi, [rel .name]
+    mov eax, SYS_FS_CREATE
+    syscall                     ; Fails harmlessly if the file exists
+
+    ; Open it through the ring as entry 0, completion 0
+    mov byte [r14 + SQE_OPCODE], URING_OP_OPEN
+    lea rax, [rel .name]
+    mov [r14 + SQE_ADDR], rax
+    mov dword [r13 + RING_SQ_TAIL], 1
+    mov edi, 1
+    mov esi, 1
+    mov edx, URING_ENTER_SQ_WAKEUP
+    mov eax, SYS_URING_ENTER
+    syscall
+    cmp dword [r13 + RING_CQ_TAIL], 1
+    jne .fail
+    mov ebx, [r15 + CQE_RESULT] ; fd
+    test ebx, ebx
+    js .fail
+    mov dword [r13 + RING_CQ_HEAD], 1
+
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov rbp, rax
+.round:
+    test r12d, r12d
+    jz .done
+    mov r8d, [r13 + RING_SQ_TAIL]
+    xor ecx, ecx
+.fill:
+    lea eax, [r8 + rcx]
+    and eax, URING_BATCH - 1
+    shl eax, 5
+    lea rdx, [r14 + rax]
+    mov byte [rdx + SQE_OPCODE], URING_OP_WRITE
+    mov [rdx + SQE_FD], ebx
+    lea rax, [rel .record]
+    mov [rdx + SQE_ADDR], rax
+    mov dword [rdx + SQE_LEN], URING_RECORD
+    mov eax, ecx
+    shl eax, 4                  ; Record i at offset i * URING_RECORD
+    mov [rdx + SQE_OFFSET], eax
+    mov [rdx + SQE_USER_DATA], rcx
+    inc ecx
+    cmp ecx, URING_BATCH
+    jb .fill
+    add r8d, URING_BATCH
+    mov [r13 + RING_SQ_TAIL], r8d ; x86 orders the entries' stores before this
+
+    mov edi, URING_BATCH
+    mov esi, URING_BATCH
+    mov edx, URING_ENTER_SQ_WAKEUP
+    mov eax, SYS_URING_ENTER
+    syscall
+    cmp eax, URING_BATCH
+    jne .fail
+
+    mov ecx, [r13 + RING_CQ_HEAD]
+    mov edx, [r13 + RING_CQ_TAIL]
+.reap:
+    cmp ecx, edx
+    je .reaped
+    mov eax, ecx
+    and eax, URING_BATCH * 2 - 1
+    shl eax, 4
+    cmp dword [r15 + rax + CQE_RESULT], URING_RECORD
+    jne .fail
+    inc ecx
+    jmp .reap
+.reaped:
+    mov [r13 + RING_CQ_HEAD], ecx
+    dec r12d
+    jmp .round
+
+.done:
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, rbp
+    mov r12, rax
+    lea rdi, [rel .name]
+    mov eax, SYS_FS_DELETE
+    syscall
+    mov rdi, r12
+    jmp .exit
+.fail:
+    mov rdi, -1
+.exit:
+    mov eax, SYS_EXIT
+    syscall
+    ud2
+.name:
+    db "uring.bin", 0
+.record:
+    db "0123456789abcdef"
+user_uring_bench_end:
+
+; vdso_bench(calls | use_syscall << 32): reads the time that many times,
+; through the vDSO or with SYS_TIME_NS, and exits with the TSC cycles taken
+user_vdso_bench_start:
+    mov r12d, edi
+    mov r14, rdi
+    shr r14, 32
+    mov rbx, VDSO_DATA + VDSO_ENTRY_TIME_NS
+    mov rbx, [rbx]
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+.loop:
+    test r12d, r12d
+    jz .done
+    test r14, r14
+    jnz .syscall
+    call rbx                    ; The stack is still 16-byte aligned here
+    jmp .next
+.syscall:
+    mov eax, SYS_TIME_NS
+    syscall
+.next:
+    dec r12d
+    jmp .loop
+.done:
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    mov rdi, rax
+    mov eax, SYS_EXIT
+    syscall
+    ud2
+user_vdso_bench_end:
+
+; hello(arg): a complete ELF executable rather than a bare image. The kernel
+; copies it into the ramfs at boot for the exec command, which loads its
+; text and a zero-filled bss page on demand. It greets the console, adds
+; arg to the first word of bss and exits with that word, so the status
+; shows the page arrived zeroed.
+section .rodata
+user_hello_elf_start:
+    dd 0x464C457F               ; Elf64Header: "\x7FELF"
+    db 2, 1, 1                  ; 64-bit, little-endian, version 1
+    times 9 db 0
+    dw 2                        ; ET_EXEC
+    dw 62                       ; EM_X86_64
+    dd 1
+    dq HELLO_TEXT + (.entry - user_hello_elf_start)
+    dq .phdrs - user_hello_elf_start
+    dq 0                        ; No section headers
+    dd 0
+    dw 64                       ; Header size
+    dw 56                       ; Program header size
+    dw 2                        ; Program headers
+    dw 0, 0, 0
+.phdrs:
+    dd 1, 5                     ; PT_LOAD, PF_R | PF_X: the whole file
+    dq 0, HELLO_TEXT, HELLO_TEXT
+    dq user_hello_elf_end - user_hello_elf_start
+    dq user_hello_elf_end - user_hello_elf_start
+    dq 0x1000
+    dd 1, 6                     ; PT_LOAD, PF_R | PF_W: one page of bss
+    dq 0, HELLO_BSS, HELLO_BSS
+    dq 0, 0x1000, 0x1000
+.entry:
+    mov rbx, rdi
+    lea rdi, [rel .message]
+    mov esi, .message_end - .message
+    mov eax, SYS_WRITE
+    syscall
+    mov rax, HELLO_BSS
+    add [rax], rbx
+    mov rdi, [rax]
+    mov eax, SYS_EXIT
+    syscall
+    ud2
+.message:
+    db "Hello from an ELF executable", 10
+.message_end:
+user_hello_elf_end:
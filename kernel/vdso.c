@@ -0,0 +1,128 @@
+#include "vdso.h"
+#include "clock.h"
+#include "cpu.h"
+#include "ktimer.h"
+#include "log.h"
+#include "string.h"
+#include "timer.h"
+#include "user.h"
+
+#define MSR_TSC_AUX 0xC0000103
+#define CPUID_RDTSCP (1 << 27) // Leaf 0x80000001, EDX
+
+static VdsoData* vdso_data = NULL; // The data page, through the kernel's mapping
+static uint64_t data_page = 0;
+static uint64_t text_page = 0;
+
+extern const uint8_t __start_vdso_text[];
+extern const uint8_t __stop_vdso_text[];
+extern const uint8_t user_vdso_bench_start[];
+extern const uint8_t user_vdso_bench_end[];
+
+// Where a function in vdso_text lands in user space
+static uint64_t vdso_entry(uint64_t address) {
+    return VDSO_TEXT + (address - (uint64_t)__start_vdso_text);
+}
+
+// Moves the time bases forward. The TSC rate never changes, so this only
+// keeps the cycle counts readers multiply small.
+static void vdso_update(KTimer* timer) {
+    (void)timer;
+    uint64_t flags = write_seqlock_irqsave(&vdso_data->lock);
+    uint64_t tsc = rdtsc();
+    uint64_t mono = clock_source() == CLOCK_SOURCE_TSC ? clock_tsc_ns(tsc) : ktime_ns();
+    vdso_data->tsc_base = tsc;
+    vdso_data->wall_ns = clock_boot_realtime_ns() + mono;
+    vdso_data->mono_ns = mono;
+    write_sequnlock_irqrestore(&vdso_data->lock, flags);
+}
+
+static KTimer vdso_timer = KTIMER_INIT(vdso_update, NULL);
+
+static bool cpu_has_rdtscp() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000001) {
+        return false;
+    }
+    cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_RDTSCP) != 0;
+}
+
+// Run on every CPU as it comes online, after vdso_init on the BSP
+void vdso_init_cpu() {
+    Cpu* cpu = this_cpu();
+    if (vdso_data && vdso_data->has_rdtscp) {
+        wrmsr(MSR_TSC_AUX, cpu->id);
+    }
+    if (vdso_data) {
+        vdso_data->cpus[cpu->id].apic_id = cpu->apic_id;
+        __atomic_store_n(&vdso_data->cpus[cpu->id].online, 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&vdso_data->cpu_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Needs the clock and the timer wheel. Fills both pages; without them user
+// tasks simply get no vDSO.
+void vdso_init() {
+    size_t text_size = __stop_vdso_text - __start_vdso_text;
+    if (text_size > PAGE_SIZE) {
+        log_error(LOG_KERNEL, "Error: vDSO text is %u bytes, over a page\n", (unsigned int)text_size);
+        return;
+    }
+    data_page = (uint64_t)allocate_physical_page();
+    text_page = (uint64_t)allocate_physical_page();
+    if (!data_page || !text_page) {
+        log_error(LOG_KERNEL, "Error: Out of memory for the vDSO\n");
+        return;
+    }
+    memset((void*)(text_page + KERNEL_BASE), 0, PAGE_SIZE);
+    memcpy((void*)(text_page + KERNEL_BASE), __start_vdso_text, text_size);
+
+    VdsoData* data = (VdsoData*)(data_page + KERNEL_BASE);
+    memset(data, 0, PAGE_SIZE);
+    data->entries[VDSO_TIME_NS] = vdso_entry((uint64_t)vdso_time_ns);
+    data->entries[VDSO_WALL_NS] = vdso_entry((uint64_t)vdso_wall_ns);
+    data->entries[VDSO_GETCPU] = vdso_entry((uint64_t)vdso_getcpu);
+    data->clock_source = clock_source();
+    data->has_rdtscp = cpu_has_rdtscp();
+    data->tsc_mult = clock_tsc_mult();
+    seqlock_init(&data->lock, "vdso");
+    vdso_data = data;
+
+    vdso_update(NULL);
+    vdso_init_cpu();
+    ktimer_add_periodic(&vdso_timer, VDSO_UPDATE_MS * TIMER_HZ / 1000);
+    log_info(LOG_KERNEL, "vDSO: %u bytes of text, time from %s, CPU from %s\n",
+             (unsigned int)text_size, data->clock_source == CLOCK_SOURCE_TSC ? "rdtsc" : "syscalls",
+             data->has_rdtscp ? "rdtscp" : "syscalls");
+}
+
+// Maps both pages read-only. PAGE_SHARED keeps address_space_destroy from
+// freeing them.
+bool vdso_map(uint64_t cr3) {
+    if (!vdso_data) {
+        return true;
+    }
+    uint64_t flags = PAGE_PRESENT | PAGE_USER | PAGE_SHARED;
+    return map_user_page(cr3, VDSO_DATA, data_page, flags) &&
+           map_user_page(cr3, VDSO_TEXT, text_page, flags);
+}
+
+// Nanoseconds per call of the vDSO time function and of SYS_TIME_NS, from
+// the same user program; 0 if it could not run
+void vdso_bench(uint32_t calls, uint64_t* vdso_ns, uint64_t* syscall_ns) {
+    size_t size = user_vdso_bench_end - user_vdso_bench_start;
+    int64_t cycles;
+    *vdso_ns = 0;
+    *syscall_ns = 0;
+    if (calls == 0 || !vdso_data) {
+        return;
+    }
+    if (user_run("vdsobench", user_vdso_bench_start, size, calls, &cycles) && cycles >= 0) {
+        *vdso_ns = clock_cycles_to_ns(cycles) / calls;
+    }
+    if (user_run("vdsobench", user_vdso_bench_start, size, calls | 1ULL << 32, &cycles) && cycles >= 0) {
+        *syscall_ns = clock_cycles_to_ns(cycles) / calls;
+    }
+}
@@ -0,0 +1,62 @@
+#include "vdso.h"
+#include "clock.h"
+#include "cpu.h"
+#include "syscall.h"
+
+// The user-side vDSO library. vdso_init copies this section to VDSO_TEXT
+// in every user address space, so nothing here may reference a kernel
+// address: no globals and no calls, only VDSO_DATA. Built at -O2 so the
+// seqlock and rdtsc helpers are inlined.
+#define VDSO_FUNC __attribute__((section("vdso_text"), used))
+
+static inline __attribute__((always_inline)) int64_t vdso_syscall(uint64_t number) {
+    int64_t result;
+    __asm__ volatile("syscall" : "=a"(result) : "a"(number) : "rcx", "r11", "memory");
+    return result;
+}
+
+// Nanoseconds since base; a reading from a CPU whose TSC is a little
+// behind the one that took the base counts as no time
+static inline __attribute__((always_inline)) uint64_t vdso_elapsed_ns(const VdsoData* data, uint64_t base) {
+    uint64_t tsc = rdtsc();
+    uint64_t cycles = tsc > data->tsc_base ? tsc - data->tsc_base : 0;
+    return base + (uint64_t)(((unsigned __int128)cycles * data->tsc_mult) >> 32);
+}
+
+VDSO_FUNC uint64_t vdso_time_ns() {
+    const VdsoData* data = (const VdsoData*)VDSO_DATA;
+    if (data->clock_source != CLOCK_SOURCE_TSC) {
+        return vdso_syscall(SYS_TIME_NS);
+    }
+    uint32_t sequence;
+    uint64_t ns;
+    do {
+        sequence = read_seqbegin(&data->lock);
+        ns = vdso_elapsed_ns(data, data->mono_ns);
+    } while (read_seqretry(&data->lock, sequence));
+    return ns;
+}
+
+VDSO_FUNC uint64_t vdso_wall_ns() {
+    const VdsoData* data = (const VdsoData*)VDSO_DATA;
+    if (data->clock_source != CLOCK_SOURCE_TSC) {
+        return vdso_syscall(SYS_TIME_NS) + (data->wall_ns - data->mono_ns);
+    }
+    uint32_t sequence;
+    uint64_t ns;
+    do {
+        sequence = read_seqbegin(&data->lock);
+        ns = vdso_elapsed_ns(data, data->wall_ns);
+    } while (read_seqretry(&data->lock, sequence));
+    return ns;
+}
+
+VDSO_FUNC int vdso_getcpu() {
+    const VdsoData* data = (const VdsoData*)VDSO_DATA;
+    if (!data->has_rdtscp) {
+        return vdso_syscall(SYS_GETCPU);
+    }
+    uint32_t low, high, aux;
+    __asm__ volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+    return aux;
+}
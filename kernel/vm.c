@@ -0,0 +1,323 @@
+#include "vm.h"
+#include "memory.h"
+#include "string.h"
+#include "task.h"
+
+// Every SharedText whose file is unchanged since it was built, newest first.
+// An entry leaves the list, dropping the list's reference, once its file is
+// written or deleted.
+static SharedText* shared_texts = NULL;
+static spinlock_t shared_lock = SPINLOCK_INIT("shared_text");
+static uint32_t pruning = 0;
+static VmStats stats;
+
+VmSpace* vm_create(const char* file, uint32_t generation) {
+    VmSpace* vm = kmalloc(sizeof(VmSpace));
+    if (!vm) {
+        return NULL;
+    }
+    memset(vm, 0, sizeof(VmSpace));
+    spin_init(&vm->lock, "vm");
+    strncpy(vm->file, file, MAX_FILENAME_LENGTH - 1);
+    vm->generation = generation;
+    return vm;
+}
+
+// Adds [start, end) backed by file_size bytes of the file from file_offset,
+// placed at file_vaddr. Regions may not share a page; false if this one
+// would, or if memory runs out.
+bool vm_add_region(VmSpace* vm, uint64_t start, uint64_t end, uint64_t page_flags,
+                   uint64_t file_vaddr, uint64_t file_offset, uint64_t file_size) {
+    VmRegion* prev = NULL;
+    VmRegion* next = vm->regions;
+    while (next && next->start < start) {
+        prev = next;
+        next = next->next;
+    }
+    if ((prev && prev->end > start) || (next && next->start < end)) {
+        return false;
+    }
+
+    VmRegion* region = kmalloc(sizeof(VmRegion));
+    if (!region) {
+        return false;
+    }
+    region->start = start;
+    region->end = end;
+    region->page_flags = page_flags;
+    region->file_vaddr = file_vaddr;
+    region->file_offset = file_offset;
+    region->file_size = file_size;
+    region->next = next;
+    if (prev) {
+        prev->next = region;
+    } else {
+        vm->regions = region;
+    }
+    return true;
+}
+
+static void shared_text_put(SharedText* shared) {
+    uint64_t flags = spin_lock_irqsave(&shared_lock);
+    bool last = --shared->refs == 0;
+    spin_unlock_irqrestore(&shared_lock, flags);
+    if (!last) {
+        return;
+    }
+    for (uint32_t i = 0; i < shared->page_count; i++) {
+        if (shared->pages[i]) {
+            free_physical_page((void*)shared->pages[i]);
+            __atomic_sub_fetch(&stats.shared_pages, 1, __ATOMIC_RELAXED);
+        }
+    }
+    kfree(shared->pages);
+    kfree(shared);
+}
+
+// Drops cached entries whose file has changed since. fs_stat takes fs_lock
+// and may decompress the file, so shared_lock is only held to unlink an
+// entry. Only one CPU prunes at a time and entries leave the list no other
+// way, so the entries walked here stay put; new ones are only pushed on
+// the front.
+static void prune_stale() {
+    if (__atomic_exchange_n(&pruning, 1, __ATOMIC_ACQUIRE)) {
+        return; // Another exec is already pruning
+    }
+    SharedText* stale = NULL;
+    SharedText** link = &shared_texts;
+    uint64_t flags = spin_lock_irqsave(&shared_lock);
+    SharedText* shared = shared_texts;
+    spin_unlock_irqrestore(&shared_lock, flags);
+
+    while (shared) {
+        FsStat stat;
+        bool fresh = fs_stat(shared->file, &stat) == 0 && stat.generation == shared->generation;
+        flags = spin_lock_irqsave(&shared_lock);
+        SharedText* next = shared->next;
+        if (fresh) {
+            link = &shared->next;
+        } else {
+            while (*link != shared) {
+                link = &(*link)->next; // Pushed in front of it meanwhile
+            }
+            *link = next;
+            shared->next = stale;
+            stale = shared;
+        }
+        spin_unlock_irqrestore(&shared_lock, flags);
+        shared = next;
+    }
+    __atomic_store_n(&pruning, 0, __ATOMIC_RELEASE);
+
+    while (stale) {
+        SharedText* next = stale->next;
+        shared_text_put(stale);
+        stale = next;
+    }
+}
+
+// Backs the space's read-only regions with the SharedText for its file,
+// building one if no other address space has this version loaded
+bool vm_share_text(VmSpace* vm) {
+    uint64_t base = 0;
+    uint64_t end = 0;
+    for (VmRegion* region = vm->regions; region; region = region->next) {
+        if (!(region->page_flags & PAGE_WRITABLE)) {
+            base = base ? base : region->start;
+            end = region->end;
+        }
+    }
+    if (!end) {
+        return true;
+    }
+    if ((end - base) / PAGE_SIZE > VM_MAX_SHARED_PAGES) {
+        return false;
+    }
+
+    prune_stale();
+    uint64_t flags = spin_lock_irqsave(&shared_lock);
+    SharedText* shared = shared_texts;
+    while (shared && (strcmp(shared->file, vm->file) != 0 || shared->generation != vm->generation)) {
+        shared = shared->next;
+    }
+    if (shared) {
+        shared->refs++;
+    }
+    spin_unlock_irqrestore(&shared_lock, flags);
+
+    if (shared) {
+        vm->shared = shared;
+        return true;
+    }
+
+    shared = kmalloc(sizeof(SharedText));
+    uint32_t page_count = (end - base) / PAGE_SIZE;
+    uint64_t* pages = kmalloc(page_count * sizeof(uint64_t));
+    if (!shared || !pages) {
+        kfree(shared);
+        kfree(pages);
+        return false;
+    }
+    memset(pages, 0, page_count * sizeof(uint64_t));
+    strncpy(shared->file, vm->file, MAX_FILENAME_LENGTH);
+    shared->generation = vm->generation;
+    shared->refs = 2;
+    shared->base = base;
+    shared->page_count = page_count;
+    shared->pages = pages;
+
+    // Two tasks loading the same new file at once may both get here; the
+    // second entry is cached too and simply shares less
+    flags = spin_lock_irqsave(&shared_lock);
+    shared->next = shared_texts;
+    shared_texts = shared;
+    spin_unlock_irqrestore(&shared_lock, flags);
+    vm->shared = shared;
+    return true;
+}
+
+// Called by the reaper once the address space itself is gone
+void vm_destroy(VmSpace* vm) {
+    while (vm->regions) {
+        VmRegion* next = vm->regions->next;
+        kfree(vm->regions);
+        vm->regions = next;
+    }
+    if (vm->shared) {
+        shared_text_put(vm->shared);
+    }
+    kfree(vm);
+}
+
+// Zeroes the page at dest, then copies in whatever bytes of the file the
+// region places on it
+static bool fill_page(VmSpace* vm, VmRegion* region, uint64_t page, uint8_t* dest) {
+    memset(dest, 0, PAGE_SIZE);
+    uint64_t from = region->file_vaddr > page ? region->file_vaddr : page;
+    uint64_t to = region->file_vaddr + region->file_size;
+    if (to > page + PAGE_SIZE) {
+        to = page + PAGE_SIZE;
+    }
+    if (from >= to) {
+        __atomic_add_fetch(&stats.zero_faults, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    __atomic_add_fetch(&stats.file_faults, 1, __ATOMIC_RELAXED);
+    int length = to - from;
+    return fs_pread(vm->file, dest + (from - page), length,
+                    region->file_offset + (from - region->file_vaddr)) == length;
+}
+
+static uint64_t new_filled_page(VmSpace* vm, VmRegion* region, uint64_t page) {
+    uint64_t physical = (uint64_t)allocate_physical_page();
+    if (physical && !fill_page(vm, region, page, (uint8_t*)(physical + KERNEL_BASE))) {
+        free_physical_page((void*)physical);
+        physical = 0;
+    }
+    return physical;
+}
+
+// The shared copy of a read-only page, loaded on first use. The page is
+// read with shared_lock dropped, so faults on other CPUs never wait for a
+// file read; if another CPU loads the same page meanwhile, its copy wins
+// and this one is freed.
+static uint64_t shared_page(VmSpace* vm, VmRegion* region, uint64_t page) {
+    SharedText* shared = vm->shared;
+    uint64_t index = (page - shared->base) / PAGE_SIZE;
+    uint64_t flags = spin_lock_irqsave(&shared_lock);
+    uint64_t physical = shared->pages[index];
+    spin_unlock_irqrestore(&shared_lock, flags);
+
+    if (physical) {
+        __atomic_add_fetch(&stats.shared_hits, 1, __ATOMIC_RELAXED);
+        return physical;
+    }
+
+    uint64_t loaded = new_filled_page(vm, region, page);
+    if (!loaded) {
+        return 0;
+    }
+    flags = spin_lock_irqsave(&shared_lock);
+    physical = shared->pages[index];
+    if (!physical) {
+        shared->pages[index] = loaded;
+    }
+    spin_unlock_irqrestore(&shared_lock, flags);
+    if (physical) {
+        free_physical_page((void*)loaded);
+        __atomic_add_fetch(&stats.shared_hits, 1, __ATOMIC_RELAXED);
+        return physical;
+    }
+    __atomic_add_fetch(&stats.shared_pages, 1, __ATOMIC_RELAXED);
+    return loaded;
+}
+
+// Backs the page holding address in the current task's space if a region
+// covers it. False means the access was invalid, or the file behind it has
+// changed, and the task should be killed.
+//
+// Called with interrupts on. The file is read without vm->lock, since it
+// may mean decompressing the whole file; the lock only covers installing
+// the page, which the task and its poller may race to do.
+bool vm_handle_fault(uint64_t address, bool write) {
+    Task* task = current_task();
+    VmSpace* vm = task->vm;
+    if (!vm) {
+        return false;
+    }
+    uint64_t page = address & ~(uint64_t)(PAGE_SIZE - 1);
+
+    // The regions are fixed once the program runs
+    VmRegion* region = vm->regions;
+    while (region && region->end <= page) {
+        region = region->next;
+    }
+    if (!region || region->start > page || (write && !(region->page_flags & PAGE_WRITABLE))) {
+        return false;
+    }
+    if (user_access_ok((void*)page, PAGE_SIZE, write)) {
+        return true; // Filled by the other task sharing the space
+    }
+    FsStat stat;
+    if (fs_stat(vm->file, &stat) < 0 || stat.generation != vm->generation) {
+        return false;
+    }
+
+    bool shared = vm->shared && !(region->page_flags & PAGE_WRITABLE);
+    uint64_t physical = shared ? shared_page(vm, region, page) : new_filled_page(vm, region, page);
+    if (!physical) {
+        return false;
+    }
+    uint64_t page_flags = PAGE_PRESENT | PAGE_USER | (shared ? PAGE_SHARED : region->page_flags);
+
+    uint64_t flags = spin_lock_irqsave(&vm->lock);
+    bool mapped = user_access_ok((void*)page, PAGE_SIZE, write);
+    bool handled = mapped || map_user_page(task->cr3, page, physical, page_flags);
+    spin_unlock_irqrestore(&vm->lock, flags);
+    if ((mapped || !handled) && !shared) {
+        free_physical_page((void*)physical); // Lost the race, or could not map it
+    }
+    return handled;
+}
+
+// user_access_ok for syscalls, faulting in any lazily backed page of the
+// buffer that has not been touched yet
+bool vm_user_access(const void* addr, size_t size, bool write) {
+    uint64_t start = (uint64_t)addr;
+    if (start < USER_BASE || size > USER_TOP - start) {
+        return false;
+    }
+    for (uint64_t page = start & ~(uint64_t)(PAGE_SIZE - 1); page < start + size; page += PAGE_SIZE) {
+        if (!user_access_ok((void*)page, 1, write) && !vm_handle_fault(page, write)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void vm_get_stats(VmStats* result) {
+    result->file_faults = __atomic_load_n(&stats.file_faults, __ATOMIC_RELAXED);
+    result->zero_faults = __atomic_load_n(&stats.zero_faults, __ATOMIC_RELAXED);
+    result->shared_hits = __atomic_load_n(&stats.shared_hits, __ATOMIC_RELAXED);
+    result->shared_pages = __atomic_load_n(&stats.shared_pages, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,92 @@
+#include "wait.h"
+#include "smp.h"
+#include "timer.h"
+
+void wait_queue_init(WaitQueue* queue) {
+    spin_init(&queue->lock, "wait_queue");
+    queue->head = NULL;
+}
+
+// Queue the current task and mark it blocked. It keeps running until it
+// calls schedule(); a wake_up before then just marks it running again.
+void wait_prepare(WaitQueue* queue) {
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    Task* task = this_cpu()->current;
+    if (task->wait_queue != queue) {
+        Task** link = &queue->head;
+        while (*link) {
+            link = &(*link)->wait_next;
+        }
+        task->wait_next = NULL;
+        *link = task;
+        task->wait_queue = queue;
+    }
+    task->state = TASK_BLOCKED;
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+// Undo wait_prepare once the condition holds
+void wait_finish(WaitQueue* queue) {
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    Task* task = this_cpu()->current;
+    task->state = TASK_RUNNING;
+    if (task->wait_queue == queue) {
+        Task** link = &queue->head;
+        while (*link != task) {
+            link = &(*link)->wait_next;
+        }
+        *link = task->wait_next;
+        task->wait_next = NULL;
+        task->wait_queue = NULL;
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+// Called with queue->lock held
+static void wake_first(WaitQueue* queue) {
+    Task* task = queue->head;
+    queue->head = task->wait_next;
+    task->wait_next = NULL;
+    task->wait_queue = NULL;
+    task_wake(task);
+}
+
+void wake_up(WaitQueue* queue) {
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    while (queue->head) {
+        wake_first(queue);
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+void wake_up_one(WaitQueue* queue) {
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    if (queue->head) {
+        wake_first(queue);
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+// A racy peek, for wakers that want to skip taking the lock
+bool wait_queue_active(WaitQueue* queue) {
+    return __atomic_load_n(&queue->head, __ATOMIC_RELAXED) != NULL;
+}
+
+static void sleep_timeout(KTimer* timer) {
+    task_wake(timer->data);
+}
+
+void sleep_ms(uint32_t ms) {
+    // Round up, plus one tick since the current one is already partly over
+    uint64_t ticks = ((uint64_t)ms * TIMER_HZ + 999) / 1000 + 1;
+
+    // Interrupts stay off until schedule() so the task is not preempted
+    // between blocking and arming the timer that wakes it
+    uint64_t flags = irq_save();
+    Task* task = current_task();
+    ktimer_init(&task->sleep_timer, sleep_timeout, task);
+    task->state = TASK_BLOCKED;
+    ktimer_add(&task->sleep_timer, ticks);
+    schedule();
+    irq_restore(flags);
+}
@@ -0,0 +1,139 @@
+#include "workqueue.h"
+#include "log.h"
+#include "memory.h"
+#include "string.h"
+#include "task.h"
+
+#define SYSTEM_WQ_WORKERS 2
+
+WorkQueue* system_wq = NULL;
+
+// Every queue ever created, for the stats listing; queues are never freed
+static WorkQueue* queues = NULL;
+static spinlock_t queues_lock = SPINLOCK_INIT("workqueues");
+
+static bool work_available(WorkQueue* queue) {
+    return __atomic_load_n(&queue->head, __ATOMIC_RELAXED) != NULL;
+}
+
+// Takes up to WORKQUEUE_BATCH items off the front of the queue in one
+// trip to the lock, waking another worker if some are left behind
+static Work* take_batch(WorkQueue* queue) {
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    Work* batch = queue->head;
+    Work* last = batch;
+    for (int i = 1; last && last->next && i < WORKQUEUE_BATCH; i++) {
+        last = last->next;
+    }
+    if (last) {
+        queue->head = last->next;
+        if (!queue->head) {
+            queue->tail = NULL;
+        }
+        last->next = NULL;
+        queue->batches++;
+    }
+    bool more = queue->head != NULL;
+    spin_unlock_irqrestore(&queue->lock, flags);
+
+    if (more) {
+        wake_up_one(&queue->wait);
+    }
+    return batch;
+}
+
+// Body of every worker task; the queue comes in through the task's arg
+static void worker_main() {
+    WorkQueue* queue = current_task()->arg;
+    while (1) {
+        wait_event(&queue->wait, work_available(queue));
+
+        uint64_t done = 0;
+        Work* work = take_batch(queue);
+        while (work) {
+            Work* next = work->next;
+            // Cleared first so the function may queue its own work again
+            __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+            work->func(work);
+            work = next;
+            done++;
+        }
+        __atomic_fetch_add(&queue->completed, done, __ATOMIC_RELAXED);
+    }
+}
+
+// Returns NULL if memory runs out before a single worker is started
+WorkQueue* workqueue_create(const char* name, int workers) {
+    if (workers < 1) {
+        workers = 1;
+    } else if (workers > WORKQUEUE_MAX_WORKERS) {
+        workers = WORKQUEUE_MAX_WORKERS;
+    }
+
+    WorkQueue* queue = kmalloc(sizeof(WorkQueue));
+    if (!queue) {
+        log_error(LOG_TASK, "Error: Out of memory creating workqueue %s\n", name);
+        return NULL;
+    }
+    memset(queue, 0, sizeof(WorkQueue));
+    queue->name = name;
+    spin_init(&queue->lock, "workqueue");
+    wait_queue_init(&queue->wait);
+
+    for (int i = 0; i < workers; i++) {
+        char task_name[32];
+        snprintf(task_name, sizeof(task_name), "%s/%d", name, i);
+        if (create_task_arg(task_name, worker_main, queue) >= 0) {
+            queue->workers++;
+        }
+    }
+    if (!queue->workers) {
+        kfree(queue);
+        return NULL;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&queues_lock);
+    queue->next_queue = queues;
+    queues = queue;
+    spin_unlock_irqrestore(&queues_lock, flags);
+    return queue;
+}
+
+// Returns false if the work was already queued and not yet started. Safe
+// from any context that may take a spinlock, but not with a lock held that
+// a wakeup needs (a wait queue or run queue lock).
+bool queue_work(WorkQueue* queue, Work* work) {
+    if (__atomic_exchange_n(&work->pending, 1, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&queue->lock);
+    work->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = work;
+    } else {
+        queue->head = work;
+    }
+    queue->tail = work;
+    queue->queued++;
+    spin_unlock_irqrestore(&queue->lock, flags);
+
+    wake_up_one(&queue->wait);
+    return true;
+}
+
+// Needs the scheduler up to start the workers
+void workqueue_init() {
+    system_wq = workqueue_create("events", SYSTEM_WQ_WORKERS);
+}
+
+void workqueue_stats(char* buffer, size_t buffer_size) {
+    size_t offset = snprintf(buffer, buffer_size, "QUEUE    WORKERS     QUEUED  COMPLETED    BATCHES\n");
+    uint64_t flags = spin_lock_irqsave(&queues_lock);
+    for (WorkQueue* queue = queues; queue && offset < buffer_size - 1; queue = queue->next_queue) {
+        offset += snprintf(buffer + offset, buffer_size - offset, "%-8s %7d %10llu %10llu %10llu\n",
+                           queue->name, queue->workers, queue->queued,
+                           __atomic_load_n(&queue->completed, __ATOMIC_RELAXED), queue->batches);
+    }
+    spin_unlock_irqrestore(&queues_lock, flags);
+}
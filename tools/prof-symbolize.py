@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# Turns the profiler's serial dump into folded stacks for flame graphs.
+# Capture serial while running `prof start [ms]`, the workload, then
+# `prof dump` in the kernel shell, for example with
+#   qemu-system-x86_64 -cdrom build/kernel.iso -serial file:serial.log
+# and then
+#   tools/prof-symbolize.py serial.log > profile.folded
+#   flamegraph.pl profile.folded > profile.svg
+#
+# Each output line is "task;outermost;...;innermost count". Addresses are
+# resolved against the kernel's symbol table with nm, so build/kernel.bin
+# must be the binary that produced the dump.
+#
+# Usage: tools/prof-symbolize.py <serial log> [kernel.bin] [--no-task]
+import base64
+import bisect
+import collections
+import struct
+import subprocess
+import sys
+
+FORMAT_VERSION = 1
+FLAG_USER = 0x1
+
+
+def load_symbols(kernel):
+    output = subprocess.run(["nm", "-n", "--defined-only", kernel],
+                            check=True, capture_output=True, text=True).stdout
+    addresses, names = [], []
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tTwW":
+            addresses.append(int(fields[0], 16))
+            names.append(fields[2])
+    return addresses, names
+
+
+def symbolize(symbols, address):
+    addresses, names = symbols
+    index = bisect.bisect_right(addresses, address) - 1
+    return names[index] if index >= 0 else "0x%x" % address
+
+
+# The last complete BEGIN..END section of the log: its samples and task names
+def read_dump(path):
+    samples, tasks, section = [], {}, None
+    with open(path, "rb") as log:
+        for raw in log:
+            line = raw.decode("ascii", "replace")
+            start = line.find("PROF:")
+            if start < 0:
+                continue
+            fields = line[start + 5:].split()
+            if not fields:
+                continue
+            if fields[0] == "BEGIN":
+                if int(fields[1]) != FORMAT_VERSION:
+                    sys.exit("Unsupported profile format %s" % fields[1])
+                section = ([], {})
+            elif section is None:
+                continue
+            elif fields[0] == "S" and len(fields) == 2:
+                section[0].append(base64.b64decode(fields[1]))
+            elif fields[0] == "TASK" and len(fields) >= 3:
+                section[1][int(fields[1])] = " ".join(fields[2:])
+            elif fields[0] == "END":
+                samples, tasks = section
+                section = None
+    return samples, tasks
+
+
+def main():
+    args = [arg for arg in sys.argv[1:] if not arg.startswith("--")]
+    if not args or len(args) > 2:
+        sys.exit("Usage: prof-symbolize.py <serial log> [kernel.bin] [--no-task]")
+    with_task = "--no-task" not in sys.argv
+    symbols = load_symbols(args[1] if len(args) > 1 else "build/kernel.bin")
+    samples, tasks = read_dump(args[0])
+    if not samples:
+        sys.exit("No complete PROF:BEGIN..PROF:END dump in %s" % args[0])
+
+    folded = collections.Counter()
+    for record in samples:
+        cpu, flags, depth, _, task_id, rip = struct.unpack_from("<BBBBiQ", record)
+        frames = []
+        if flags & FLAG_USER:
+            frames.append("[user]")
+        else:
+            returns = struct.unpack_from("<%dQ" % depth, record, 16)
+            # Return addresses point after the call, which may be the
+            # first byte of the next function
+            frames.extend(symbolize(symbols, address - 1) for address in reversed(returns))
+            frames.append(symbolize(symbols, rip))
+        if with_task:
+            frames.insert(0, tasks.get(task_id, "task-%d" % task_id).replace(" ", "_"))
+        folded[";".join(frames)] += 1
+
+    for stack, count in sorted(folded.items()):
+        print("%s %d" % (stack, count))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Runs the SMP scaling benchmark on 1, 2, 4 and 8 vCPUs. Each run boots the
+# kernel with smpbench=<tasks> on its command line; the kernel prints one
+# SMPBENCH line to serial and exits QEMU through the isa-debug-exit device.
+#
+# Usage: tools/smp-bench.sh [tasks]   (default 8; set QEMU_FLAGS=-enable-kvm)
+TASKS=${1:-8}
+ISO=build/smpbench.iso
+
+ISO_DIR=$(mktemp -d)
+mkdir -p "$ISO_DIR/boot/grub"
+cp build/kernel.bin "$ISO_DIR/boot/kernel.bin"
+cat > "$ISO_DIR/boot/grub/grub.cfg" <<EOF
+set timeout=0
+set default=0
+
+menuentry "Zernel SMP benchmark" {
+    multiboot2 /boot/kernel.bin smpbench=$TASKS
+    boot
+}
+EOF
+grub-mkrescue -o "$ISO" "$ISO_DIR" > /dev/null 2>&1 || { echo "grub-mkrescue failed"; exit 1; }
+rm -rf "$ISO_DIR"
+
+base=""
+for cpus in 1 2 4 8; do
+    line=$(timeout 300 qemu-system-x86_64 $QEMU_FLAGS -cdrom "$ISO" -m 1G -smp "$cpus" \
+               -display none -serial stdio -no-reboot \
+               -device isa-debug-exit,iobase=0xf4,iosize=0x04 | grep -a -m1 '^SMPBENCH')
+    cycles=$(echo "$line" | sed -n 's/.*cycles=\([0-9]*\).*/\1/p')
+    if [ -z "$cycles" ] || [ "$cycles" = 0 ]; then
+        echo "$cpus vCPUs: no result"
+        continue
+    fi
+    base=${base:-$cycles}
+    echo "$cpus vCPUs: $TASKS tasks in $((cycles / 1000000)) Mcycles," \
+         "speedup $(awk "BEGIN { printf \"%.2f\", $base / $cycles }")x"
+done